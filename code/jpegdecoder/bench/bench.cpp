@@ -0,0 +1,1021 @@
+/*
+
+  Benchmark suite for the jpeg decoder.
+
+  Runs the decoder kernels (huffman lookup, bitstream reads, IDCT, color
+  conversion, upsampling, encoder) in isolation on synthetic data and decodes every
+  JPEG found in the given files/directories end to end. The results can be
+  written as JSON, two result files can be compared with bench/compare.py.
+
+  Usage: ./jpgd_bench [-o result.json] [-l label] [-r repetitions] [-t threads] [-s] [-k|-d] [-p] [-f] [-n] [-A] [-z] [-e] [-c] [-a heap|hugepage] [-i fast|accurate|float] [files or directories...]
+        -t      number of decoder threads, 0 (default) uses one per core
+        -s      no speculative entropy decoding, only the reconstruction runs in parallel
+        -k      only run the kernel benchmarks
+        -d      only run the decode benchmarks
+        -p      also decode every file into YCbCr planes (decodePlanar)
+        -f      also compute the perceptual fingerprint of every file (DC and AC variant)
+        -n      also decode every file into a normalized 224x224 float NCHW tensor (scaled IDCT + resize)
+        -A      also recompress every file with arithmetic coding (SOF9) and decode both
+                versions from memory, huffman vs arithmetic throughput and size
+        -z      also pack every file losslessly (recompress.h), unpack vs decode time and size, exit
+                code 1 if a file (or a tiny one, which has to be stored) isn't restored exactly
+        -e      also decode every file with EXIF orientation 6 (90 degrees), stored rotated
+                by the decoder vs decoded upright and rotated in a second pass
+        -c      check that the block decoding makes no heap allocations, exit code 1 otherwise
+        -a      allocator of the decode buffers, heap (default) or hugepage
+        -i      IDCT of the decode benchmarks, fast (default), accurate or float
+
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include "bitstream.h"
+#include "bitwriter.h"
+#include "color.h"
+#include "convert.h"
+#include "dct.h"
+#include "fingerprint.h"
+#include "huffmantree.h"
+#include "allocator.h"
+#include "jpegdecoder.h"
+#include "tensor.h"
+#include "jpegencoder.h"
+#include "jpegwriter.h"
+#include "recompress.h"
+#include "upsample.h"
+using namespace std;
+
+struct Result
+{
+        string name;
+        string unit;
+        double value;           // median over all repetitions
+        double best;
+        long iterations;        // number of operations per repetition
+        string extra;           // additional json members (already formatted)
+};
+
+static vector<Result> results;
+static int repetitions = 7;
+static int threads = 0;         // decoder threads, 0 = one per core
+static bool speculative = true;
+static HugePageAllocator hugePages;
+static BufferAllocator* decodeAllocator = defaultAllocator();      // used by the decode benchmarks
+static IDCTMode idctMode = IDCT_FAST;
+static volatile long sink;      // keeps the compiler from removing the benchmarked code
+static atomic<long> allocations(0);     // heap allocations of the process (operator new, see CountingAllocator)
+
+// every form of operator new counts, not inlinable, gcc would otherwise pair the inlined
+// malloc with the free of the replaced operator delete and warn (-Wmismatched-new-delete)
+__attribute__((noinline)) void* operator new(size_t size)
+{
+        allocations.fetch_add(1, memory_order_relaxed);
+        void* memory = malloc(size > 0 ? size : 1);
+        if (memory == nullptr)
+                throw bad_alloc();
+        return memory;
+}
+
+__attribute__((noinline)) void* operator new[](size_t size)
+{
+        return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void* memory) noexcept
+{
+        free(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory) noexcept
+{
+        operator delete(memory);
+}
+
+// sized deallocation (C++14 and later)
+__attribute__((noinline)) void operator delete(void* memory, size_t) noexcept
+{
+        operator delete(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory, size_t) noexcept
+{
+        operator delete(memory);
+}
+
+__attribute__((noinline)) void* operator new(size_t size, const nothrow_t&) noexcept
+{
+        allocations.fetch_add(1, memory_order_relaxed);
+        return malloc(size > 0 ? size : 1);
+}
+
+__attribute__((noinline)) void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+        return operator new(size, nothrow);
+}
+
+__attribute__((noinline)) void operator delete(void* memory, const nothrow_t&) noexcept
+{
+        operator delete(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory, const nothrow_t&) noexcept
+{
+        operator delete(memory);
+}
+
+#ifdef __cpp_aligned_new
+// over-aligned types (C++17 and later)
+__attribute__((noinline)) void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+        allocations.fetch_add(1, memory_order_relaxed);
+        void* memory = nullptr;
+        if (posix_memalign(&memory, max(sizeof(void*), (size_t)alignment), size > 0 ? size : 1) != 0)
+                return nullptr;
+        return memory;
+}
+
+__attribute__((noinline)) void* operator new(size_t size, align_val_t alignment)
+{
+        void* memory = operator new(size, alignment, nothrow);
+        if (memory == nullptr)
+                throw bad_alloc();
+        return memory;
+}
+
+__attribute__((noinline)) void* operator new[](size_t size, align_val_t alignment)
+{
+        return operator new(size, alignment);
+}
+
+__attribute__((noinline)) void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+        return operator new(size, alignment, nothrow);
+}
+
+__attribute__((noinline)) void operator delete(void* memory, align_val_t) noexcept
+{
+        free(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory, align_val_t) noexcept
+{
+        free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void* memory, size_t, align_val_t) noexcept
+{
+        free(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory, size_t, align_val_t) noexcept
+{
+        free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void* memory, align_val_t, const nothrow_t&) noexcept
+{
+        free(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory, align_val_t, const nothrow_t&) noexcept
+{
+        free(memory);
+}
+#endif
+
+// Standard luminance AC huffman table, ITU-T81 Annex K.3
+static unsigned char acBits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D };
+static unsigned char acValues[162] = {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+        0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+        0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+        0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+        0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+        0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+        0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+        0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+        0xF9, 0xFA };
+
+// xorshift generator, the synthetic data has to be the same on every run
+static unsigned int randomState = 2463534242u;
+static unsigned int nextRandom()
+{
+        randomState ^= randomState << 13;
+        randomState ^= randomState >> 17;
+        randomState ^= randomState << 5;
+        return randomState;
+}
+
+static double now()
+{
+        return chrono::duration<double, micro>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static string jsonEscape(const string& s)
+{
+        string result;
+        for (char c : s) {
+                if (c == '"' || c == '\\')
+                        result += '\\';
+                result += c;
+        }
+        return result;
+}
+
+// runs the function repetitions times and records the median time per operation
+template<typename F>
+static void measure(const string& name, long operations, const string& unit, double scale, F function)
+{
+        vector<double> times;
+        function();     // warm up caches
+        for (int i = 0; i < repetitions; i++) {
+                double start = now();
+                function();
+                times.push_back((now() - start) * scale / operations);
+        }
+        sort(times.begin(), times.end());
+
+        Result result;
+        result.name = name;
+        result.unit = unit;
+        result.value = times[times.size() / 2];
+        result.best = times[0];
+        result.iterations = operations;
+        results.push_back(result);
+        printf("%-40s %12.3f %s\n", name.c_str(), result.value, unit.c_str());
+}
+
+static void benchHuffman()
+{
+        // assign the canonical codes of the table
+        unsigned int codes[162];
+        unsigned char lengths[162];
+        unsigned int code = 0;
+        int k = 0;
+        for (int len = 1; len <= 16; len++) {
+                for (int i = 0; i < acBits[len - 1]; i++) {
+                        codes[k] = code++;
+                        lengths[k++] = len;
+                }
+                code <<= 1;
+        }
+
+        HuffmanTree tree;
+        char* values = (char*)acValues;
+        for (int i = 0; i < 16; i++) {
+                tree.insertNextRow(values, acBits[i]);
+                values += acBits[i];
+        }
+
+        // short codes are chosen more often, like in real image data
+        const long symbols = 1 << 20;
+        string data;
+        BitWriter writer(data);
+        for (long i = 0; i < symbols; i++) {
+                int s = 0;
+                while (s < 161 && (nextRandom() & 0x03) != 0)
+                        s += 1 + nextRandom() % 3;
+                s = min(s, 161);
+                writer.write(codes[s], lengths[s]);
+        }
+        writer.flush();
+        data += "\xFF\xD9";   // the bitstream never reads the last bit of its input
+
+        measure("kernel/huffman_getvalue", symbols, "ns/symbol", 1000.0, [&]() {
+                BitStream stream(&data[0], data.size());
+                int error = 0;
+                long sum = 0;
+                for (long i = 0; i < symbols; i++)
+                        sum += tree.getValue(stream, error);
+                sink = sum + error;
+        });
+}
+
+static void benchBitStream()
+{
+        // random data with bytestuffing, just like a real scan
+        string data;
+        BitWriter writer(data);
+        for (int i = 0; i < (1 << 21); i++)
+                writer.write(nextRandom() & 0xFF, 8);
+        writer.flush();
+        data += "\xFF\xD9";   // the bitstream never reads the last bit of its input
+
+        const long bits = (1 << 21) * 8L - 64;
+        measure("kernel/bitstream_next", bits, "ns/bit", 1000.0, [&]() {
+                BitStream stream(&data[0], data.size());
+                long sum = 0;
+                for (long i = 0; i < bits; i++)
+                        sum += stream.next();
+                sink = sum;
+        });
+
+        // magnitude bits as they follow a huffman code: 1..11 bits
+        long reads = 0;
+        for (long n = 0; n + (reads % 11) + 1 < bits; reads++)
+                n += (reads % 11) + 1;
+        measure("kernel/bitstream_next_n", reads, "ns/read", 1000.0, [&]() {
+                BitStream stream(&data[0], data.size());
+                int error = 0;
+                long sum = 0;
+                for (long i = 0; i < reads; i++)
+                        sum += stream.next((i % 11) + 1, error);
+                sink = sum + error;
+        });
+}
+
+static void benchIDCT()
+{
+        const int blocks = 4096;
+        vector<int> sparse(blocks * 64, 0);
+        vector<int> dense(blocks * 64, 0);
+        vector<int> work(blocks * 64, 0);
+
+        // typical blocks only contain the DC and a few low frequency coefficients
+        for (int b = 0; b < blocks; b++) {
+                sparse[b * 64] = (int)(nextRandom() % 2048) - 1024;
+                for (int k = 0; k < 6; k++)
+                        sparse[b * 64 + (nextRandom() % 3) * 8 + nextRandom() % 3] = (int)(nextRandom() % 256) - 128;
+                for (int k = 0; k < 64; k++)
+                        dense[b * 64 + k] = (int)(nextRandom() % 512) - 256;
+        }
+
+        measure("kernel/idct_fast_sparse", blocks, "ns/block", 1000.0, [&]() {
+                memcpy(&work[0], &sparse[0], work.size() * sizeof(int));
+                for (int b = 0; b < blocks; b++)
+                        DCT::fastTransform(&work[b * 64]);
+                sink = work[blocks * 64 - 1];
+        });
+        measure("kernel/idct_fast_dense", blocks, "ns/block", 1000.0, [&]() {
+                memcpy(&work[0], &dense[0], work.size() * sizeof(int));
+                for (int b = 0; b < blocks; b++)
+                        DCT::fastTransform(&work[b * 64]);
+                sink = work[blocks * 64 - 1];
+        });
+        measure("kernel/idct_accurate_dense", blocks, "ns/block", 1000.0, [&]() {
+                memcpy(&work[0], &dense[0], work.size() * sizeof(int));
+                for (int b = 0; b < blocks; b++)
+                        DCT::accurateTransform(&work[b * 64]);
+                sink = work[blocks * 64 - 1];
+        });
+        measure("kernel/idct_float_dense", blocks, "ns/block", 1000.0, [&]() {
+                memcpy(&work[0], &dense[0], work.size() * sizeof(int));
+                for (int b = 0; b < blocks; b++)
+                        DCT::floatTransform(&work[b * 64]);
+                sink = work[blocks * 64 - 1];
+        });
+
+        // encoder side: level shifted samples
+        for (int k = 0; k < blocks * 64; k++)
+                dense[k] = (int)(nextRandom() % 256) - 128;
+        measure("kernel/fdct", blocks, "ns/block", 1000.0, [&]() {
+                memcpy(&work[0], &dense[0], work.size() * sizeof(int));
+                for (int b = 0; b < blocks; b++)
+                        DCT::forwardTransform(&work[b * 64]);
+                sink = work[blocks * 64 - 1];
+        });
+}
+
+static void benchEncode()
+{
+        // smooth gradients with some noise, 1 MP 4:2:0
+        const int width = 1024, height = 1024;
+        vector<unsigned char> rgb(width * height * 3);
+        for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                        unsigned char* p = &rgb[(y * width + x) * 3];
+                        p[0] = (unsigned char)(x / 4 + (nextRandom() & 0x0F));
+                        p[1] = (unsigned char)(y / 4 + (nextRandom() & 0x0F));
+                        p[2] = (unsigned char)((x + y) / 8 + (nextRandom() & 0x0F));
+                }
+        }
+
+        JpegEncoder encoder;
+        string out;
+        measure("kernel/encode_1mp_standard", width * height, "ns/pixel", 1000.0, [&]() {
+                out.clear();
+                encoder.encode(&rgb[0], width, height, width * 3, PIXEL_RGB, out);
+                sink = out.size();
+        });
+        encoder.setOptimizeHuffman(true);
+        measure("kernel/encode_1mp_optimized", width * height, "ns/pixel", 1000.0, [&]() {
+                out.clear();
+                encoder.encode(&rgb[0], width, height, width * 3, PIXEL_RGB, out);
+                sink = out.size();
+        });
+}
+
+// page faults and TLB misses of a picture sized buffer: fault it in, then read it in random order
+static void benchAllocator(BufferAllocator* allocator)
+{
+        const size_t size = 256 << 20;
+        const long reads = 1 << 22;
+        measure(string("kernel/buffer_") + allocator->name() + "_256mb", size / 4096, "ns/page", 1000.0, [&]() {
+                Buffer<unsigned char> buffer(allocator, size);
+                for (size_t i = 0; i < size; i += 64)
+                        buffer[i] = (unsigned char)i;
+                unsigned int position = 12345;
+                long sum = 0;
+                for (long i = 0; i < reads; i++) {
+                        position = position * 1103515245u + 12345u;
+                        sum += buffer[position % size];
+                }
+                sink = sum;
+        });
+}
+
+static void benchHamming()
+{
+        const size_t count = 1 << 20;
+        vector<unsigned long long> candidates(count);
+        for (auto& candidate : candidates)
+                candidate = ((unsigned long long)nextRandom() << 32) | nextRandom();
+        vector<size_t> matches;
+        measure("kernel/hamming_1m", count, "ns/candidate", 1000.0, [&]() {
+                matches.clear();
+                findSimilar(candidates[0], &candidates[0], count, 10, matches);
+                sink = matches.size();
+        });
+}
+
+static void benchColor()
+{
+        const int pixels = 1 << 20;
+        vector<int> y(pixels), cb(pixels), cr(pixels), rgb(pixels * 3);
+        for (int i = 0; i < pixels; i++) {
+                y[i] = nextRandom() & 0xFF;
+                cb[i] = nextRandom() & 0xFF;
+                cr[i] = nextRandom() & 0xFF;
+        }
+
+        measure("kernel/color_ycbcr_to_rgb", pixels, "ns/pixel", 1000.0, [&]() {
+                for (int i = 0; i < pixels; i++) {
+                        rgb[i * 3] = Color::toRed(y[i], cb[i], cr[i]);
+                        rgb[i * 3 + 1] = Color::toGreen(y[i], cb[i], cr[i]);
+                        rgb[i * 3 + 2] = Color::toBlue(y[i], cb[i], cr[i]);
+                }
+                sink = rgb[pixels - 1];
+        });
+}
+
+static void benchUpsample()
+{
+        const int mcus = 1 << 14;
+        vector<int> source(mcus * 256), work(mcus * 256);
+        for (int i = 0; i < mcus * 256; i++)
+                source[i] = nextRandom() & 0xFF;
+
+        measure("kernel/upsample_h2v1", mcus, "ns/mcu", 1000.0, [&]() {
+                memcpy(&work[0], &source[0], work.size() * sizeof(int));
+                for (int m = 0; m < mcus; m++) {
+                        Upsample::horizontal(2, 1, 1, &work[m * 256]);
+                        Upsample::vertical(2, 1, 1, &work[m * 256]);
+                }
+                sink = work[mcus * 256 - 1];
+        });
+        measure("kernel/upsample_h2v2", mcus, "ns/mcu", 1000.0, [&]() {
+                memcpy(&work[0], &source[0], work.size() * sizeof(int));
+                for (int m = 0; m < mcus; m++) {
+                        Upsample::horizontal(2, 1, 1, &work[m * 256]);
+                        Upsample::vertical(2, 2, 1, &work[m * 256]);
+                }
+                sink = work[mcus * 256 - 1];
+        });
+}
+
+static unsigned long long checksum(Picture& picture)
+{
+        // FNV-1a over the clipped rgb values
+        unsigned long long hash = 14695981039346656037ull;
+        for (int y = 0; y < picture.getHeight(); y++) {
+                for (int x = 0; x < picture.getWidth(); x++) {
+                        Pixel& p = picture.getPixel(x, y);
+                        int c[3] = { p.red, p.green, p.blue };
+                        for (int i = 0; i < 3; i++) {
+                                hash ^= (unsigned long long)CLIP(c[i]);
+                                hash *= 1099511628211ull;
+                        }
+                }
+        }
+        return hash;
+}
+
+static unsigned long long checksum(const vector<unsigned char>* planes)
+{
+        unsigned long long hash = 14695981039346656037ull;
+        for (int c = 0; c < 3; c++) {
+                for (unsigned char value : planes[c]) {
+                        hash ^= value;
+                        hash *= 1099511628211ull;
+                }
+        }
+        return hash;
+}
+
+// planar: Y, Cb and Cr planes without upsampling and color conversion (decodePlanar)
+static void benchDecode(const string& path, bool planar)
+{
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+                return;
+
+        int width = 0, height = 0, errcode = 0;
+        unsigned long long hash = 0;
+        vector<double> times;
+        vector<unsigned char> planes[3];
+
+        for (int i = 0; i <= repetitions; i++) {
+                JpegDecoder decoder;
+                decoder.setThreads(threads);
+                decoder.setSpeculative(speculative);
+                decoder.setAllocator(decodeAllocator);
+                decoder.setIDCT(idctMode);
+                if (!decoder.read(path)) {
+                        cout << "Could not read file " << path << endl;
+                        return;
+                }
+                PlanarImage image;
+                if (planar) {
+                        errcode = decoder.probe();
+                        for (int c = 0; c < 3 && errcode == 0; c++) {
+                                int planeWidth, planeHeight;
+                                decoder.getPlaneSize(c, planeWidth, planeHeight);
+                                planes[c].resize((size_t)planeWidth * planeHeight);
+                                image.planes[c] = &planes[c][0];
+                                image.strides[c] = planeWidth;
+                        }
+                        if (errcode != 0)
+                                break;
+                }
+                double start = now();
+                errcode = planar ? decoder.decodePlanar(image) : decoder.decode();
+                double time = now() - start;
+                if (i == 0) {   // the first run is the warm up
+                        width = decoder.getWidth();
+                        height = decoder.getHeight();
+                        if (errcode == 0)
+                                hash = planar ? checksum(planes) : checksum(decoder.getPicture());
+                } else {
+                        times.push_back(time / 1000.0);
+                }
+                if (errcode != 0)
+                        break;
+        }
+
+        string name = path.substr(path.find_last_of('/') + 1);
+        Result result;
+        result.name = (planar ? "decode_planar/" : "decode/") + name;
+        result.unit = "ms";
+        result.iterations = 1;
+        if (times.empty()) {
+                result.value = result.best = 0;
+        } else {
+                sort(times.begin(), times.end());
+                result.value = times[times.size() / 2];
+                result.best = times[0];
+        }
+
+        double mpixels = (double)width * height / 1e6;
+        ostringstream extra;
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", hash);
+        extra << "\"width\": " << width << ", \"height\": " << height
+              << ", \"bytes\": " << (long)st.st_size << ", \"error\": " << errcode
+              << ", \"mpixels_per_s\": " << (result.value > 0 ? mpixels / (result.value / 1000.0) : 0)
+              << ", \"mbytes_per_s\": " << (result.value > 0 ? st.st_size / 1e6 / (result.value / 1000.0) : 0)
+              << ", \"checksum\": \"" << hex << "\"";
+        result.extra = extra.str();
+        results.push_back(result);
+
+        if (errcode != 0)
+                printf("%-40s error %d\n", result.name.c_str(), errcode);
+        else
+                printf("%-40s %12.3f ms %8.1f MP/s\n", result.name.c_str(), result.value,
+                       mpixels / (result.value / 1000.0));
+}
+
+// forwards to another allocator and counts its buffers (posix_memalign or mmap), which
+// operator new doesn't see
+class CountingAllocator : public BufferAllocator
+{
+private:
+        BufferAllocator* allocator;
+public:
+        explicit CountingAllocator(BufferAllocator* allocator) : allocator(allocator) {}
+
+        void* allocate(size_t size)
+        {
+                allocations.fetch_add(1, memory_order_relaxed);
+                return allocator->allocate(size);
+        }
+        void release(void* memory, size_t size) { allocator->release(memory, size); }
+        const char* name() { return allocator->name(); }
+};
+
+// counts the heap allocations between the first and the last band, i.e. while the blocks are decoded
+class AllocationCounter : public RowSink
+{
+public:
+        long start = 0;
+        long count = 0;
+        int bands = 0;
+
+        int band(int y, int rows, const unsigned char* rgb, int stride)
+        {
+                if (bands++ == 0)
+                        start = allocations.load();
+                else
+                        count = allocations.load() - start;
+                return 0;
+        }
+};
+
+/*!
+ * The per block work has to be free of hidden costs: no heap allocations, neither with
+ * operator new nor through the BufferAllocator of the decoder (and no reference
+ * counting, which has no portable counter, the block decoder only borrows the tables).
+ * Decodes with one thread, the threaded decoders allocate their thread state while the
+ * first bands may already arrive. Returns false if anything was allocated.
+ */
+static bool checkHotPath(const string& path)
+{
+        CountingAllocator allocator(decodeAllocator);
+        JpegDecoder decoder;
+        decoder.setThreads(1);
+        decoder.setAllocator(&allocator);
+        decoder.setIDCT(idctMode);
+        if (!decoder.read(path)) {
+                cout << "Could not read file " << path << endl;
+                return false;
+        }
+
+        long blocks = 0;
+        int errcode = decoder.probe();
+        for (int c = 0; c < 3 && errcode == 0; c++) {
+                int planeWidth, planeHeight;
+                decoder.getPlaneSize(c, planeWidth, planeHeight);
+                blocks += (long)((planeWidth + 7) / 8) * ((planeHeight + 7) / 8);
+        }
+        AllocationCounter counter;
+        decoder.setSink(&counter);
+        if (errcode == 0)
+                errcode = decoder.decode();
+
+        string name = path.substr(path.find_last_of('/') + 1);
+        Result result;
+        result.name = "hotpath/" + name;
+        result.unit = "allocations";
+        result.value = result.best = counter.count;
+        result.iterations = blocks;
+        result.extra = "\"error\": " + to_string(errcode);
+        results.push_back(result);
+
+        if (errcode != 0) {
+                printf("%-40s error %d\n", result.name.c_str(), errcode);
+                return true;
+        }
+        printf("%-40s %8ld allocations, %ld blocks%s\n", result.name.c_str(), counter.count, blocks,
+               counter.count != 0 ? "  FAILED" : "");
+        return counter.count == 0;
+}
+
+static void benchFingerprint(const string& path)
+{
+        ifstream file(path.c_str(), ios::binary);
+        if (!file)
+                return;
+        string name = path.substr(path.find_last_of('/') + 1);
+        // every run needs a fresh decoder, copying the data is part of the measured time
+        string data;
+        data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+
+        for (int useAC = 0; useAC < 2; useAC++) {
+                measure((useAC ? "fingerprint_ac/" : "fingerprint/") + name, 1, "ms", 0.001, [&]() {
+                        JpegDecoder decoder;
+                        decoder.setData(string(data));
+                        unsigned long long hash = 0;
+                        if (fingerprint(decoder, hash, useAC) == 0)
+                                sink = hash;
+                });
+        }
+}
+
+static void benchTensor(const string& path)
+{
+        ifstream file(path.c_str(), ios::binary);
+        if (!file)
+                return;
+        string name = path.substr(path.find_last_of('/') + 1);
+        string data;
+        data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+
+        const float mean[3] = { 0.485f, 0.456f, 0.406f };
+        const float deviation[3] = { 0.229f, 0.224f, 0.225f };
+        vector<float> tensor(3 * 224 * 224);
+        TensorSink sink(tensor.data(), TENSOR_NCHW, TENSOR_FLOAT32, 1, 224, 224);
+        sink.setNormalization(mean, deviation);
+        sink.setResize(true);
+        measure("tensor/" + name, 1, "ms", 0.001, [&]() {
+                JpegDecoder decoder;
+                decoder.setThreads(threads);
+                decoder.setSpeculative(speculative);
+                decoder.setIDCT(idctMode);
+                decoder.setData(string(data));
+                decodeTensor(decoder, sink, 0);
+        });
+}
+
+// decodes the file and its arithmetic coded recompression (same coefficients) from memory
+static void benchArithmetic(const string& path)
+{
+        ifstream file(path.c_str(), ios::binary);
+        if (!file)
+                return;
+        string name = path.substr(path.find_last_of('/') + 1);
+        string data[2];
+        data[0].assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+
+        JpegDecoder reader;
+        reader.setData(string(data[0]));
+        CoefficientImage image;
+        JpegWriter writer;
+        writer.setArithmetic(true);
+        if (reader.readCoefficients(image) != 0 || writer.write(image, data[1]) != 0) {
+                printf("%-40s not recompressed\n", ("decode_arith/" + name).c_str());
+                return;
+        }
+
+        const char* names[2] = { "decode_huffman/", "decode_arith/" };
+        for (int i = 0; i < 2; i++) {
+                int errcode = 0;
+                measure(names[i] + name, 1, "ms", 0.001, [&]() {
+                        JpegDecoder decoder;
+                        decoder.setThreads(threads);
+                        decoder.setSpeculative(speculative);
+                        decoder.setIDCT(idctMode);
+                        decoder.setData(string(data[i]));
+                        errcode = decoder.decode();
+                });
+                ostringstream extra;
+                extra << "\"bytes\": " << data[i].size() << ", \"error\": " << errcode;
+                results.back().extra = extra.str();
+        }
+        printf("%-40s %12.3f size ratio\n", ("arith_size/" + name).c_str(), (double)data[1].size() / data[0].size());
+}
+
+// packs the file, times unpacking it against decoding it (both from memory), false if
+// the original isn't restored exactly
+static bool benchPack(const string& path)
+{
+        ifstream file(path.c_str(), ios::binary);
+        if (!file)
+                return true;
+        string name = path.substr(path.find_last_of('/') + 1);
+        string data(istreambuf_iterator<char>(file), (istreambuf_iterator<char>()));
+        string packed;
+        if (packJpeg(data, packed, threads) != 0)
+                return false;
+
+        int errcode = 0;
+        string jpeg;
+        measure("unpack/" + name, 1, "ms", 0.001, [&]() {
+                jpeg.clear();
+                errcode = unpackJpeg(packed, jpeg, threads);
+                sink += jpeg.size();
+        });
+        ostringstream extra;
+        extra << "\"bytes\": " << packed.size() << ", \"error\": " << errcode;
+        results.back().extra = extra.str();
+        bool restored = errcode == 0 && jpeg == data;
+        printf("%-40s %12.3f size ratio%s\n", ("pack_size/" + name).c_str(), (double)packed.size() / data.size(),
+               restored ? "" : "  FAILED");
+        return restored;
+}
+
+// a tiny image has to be stored, the coded form would be larger
+static bool checkPackTiny()
+{
+        unsigned char rgb[8 * 8 * 3];
+        for (int i = 0; i < 8 * 8 * 3; i++)
+                rgb[i] = (unsigned char)(i * 37);
+        JpegEncoder encoder;
+        string jpeg, packed, unpacked;
+        encoder.encode(rgb, 8, 8, 8 * 3, PIXEL_RGB, jpeg);
+        bool clean = packJpeg(jpeg, packed, threads) == 0 && packed.size() <= jpeg.size() + 5
+                     && unpackJpeg(packed, unpacked, threads) == 0 && unpacked == jpeg;
+        printf("%-40s %8zu -> %zu bytes%s\n", "pack_size/tiny_8x8", jpeg.size(), packed.size(), clean ? "" : "  FAILED");
+        return clean;
+}
+
+// the whole image in one buffer, also for the rotated store
+class ImageSink : public RowSink
+{
+public:
+        vector<unsigned char> pixels;
+        int width;
+        int height;
+
+        ImageSink() : width(0), height(0) {}
+        PixelFormat format() { return PIXEL_XRGB32; }
+        int begin(int width, int height) {
+                this->width = width;
+                this->height = height;
+                pixels.resize((size_t)width * height * 4);
+                return 0;
+        }
+        unsigned char* target(int y, int& stride) {
+                stride = width * 4;
+                return &pixels[(size_t)y * stride];
+        }
+        unsigned char* image(int& stride) {
+                stride = width * 4;
+                return pixels.data();
+        }
+        int band(int y, int rows, const unsigned char* rgb, int stride) { return 0; }
+};
+
+// decodes the file with an Exif segment saying it has to be rotated by 90 degrees
+static void benchOrientation(const string& path)
+{
+        ifstream file(path.c_str(), ios::binary);
+        if (!file)
+                return;
+        string name = path.substr(path.find_last_of('/') + 1);
+        string data(istreambuf_iterator<char>(file), (istreambuf_iterator<char>()));
+        // APP1 with a little endian TIFF header and IFD0 holding only the orientation 6
+        static const unsigned char exif[] = {
+                0xFF, 0xE1, 0x00, 0x22, 'E', 'x', 'i', 'f', 0, 0, 'I', 'I', 42, 0, 8, 0, 0, 0,
+                1, 0, 0x12, 0x01, 3, 0, 1, 0, 0, 0, 6, 0, 0, 0, 0, 0, 0, 0
+        };
+        data.insert(2, (const char*)exif, sizeof(exif));
+
+        ImageSink sink;
+        vector<unsigned int> rotated;
+        int errcode = 0;
+        measure("rotate_pass/" + name, 1, "ms", 0.001, [&]() {
+                JpegDecoder decoder;
+                decoder.setThreads(threads);
+                decoder.setSink(&sink);
+                decoder.setData(string(data));
+                errcode = decoder.decode();
+                rotated.resize((size_t)sink.width * sink.height);
+                const unsigned int* source = (const unsigned int*)sink.pixels.data();
+                for (int y = 0; y < sink.height; y++) {
+                        for (int x = 0; x < sink.width; x++)
+                                rotated[(size_t)x * sink.height + sink.height - 1 - y] = source[(size_t)y * sink.width + x];
+                }
+        });
+        measure("orient/" + name, 1, "ms", 0.001, [&]() {
+                JpegDecoder decoder;
+                decoder.setThreads(threads);
+                decoder.setAutoOrient(true);
+                decoder.setSink(&sink);
+                decoder.setData(string(data));
+                errcode |= decoder.decode();
+        });
+        if (errcode != 0 || memcmp(rotated.data(), sink.pixels.data(), sink.pixels.size()) != 0)
+                printf("%-40s differs from the rotated image\n", ("orient/" + name).c_str());
+}
+
+static bool writeJSON(const string& path, const string& label)
+{
+        ofstream out(path.c_str());
+        if (!out)
+                return false;
+
+        out << "{\n  \"label\": \"" << jsonEscape(label) << "\",\n"
+            << "  \"timestamp\": " << (long)time(nullptr) << ",\n"
+            << "  \"repetitions\": " << repetitions << ",\n"
+            << "  \"threads\": " << threads << ",\n"
+            << "  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); i++) {
+                Result& r = results[i];
+                out << "    { \"name\": \"" << jsonEscape(r.name) << "\", \"unit\": \"" << r.unit
+                    << "\", \"value\": " << r.value << ", \"best\": " << r.best
+                    << ", \"iterations\": " << r.iterations;
+                if (!r.extra.empty())
+                        out << ", " << r.extra;
+                out << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+        return true;
+}
+
+int main(int argc, char** argv)
+{
+        string output;
+        string label = "unnamed";
+        bool kernels = true;
+        bool decode = true;
+        bool planar = false;
+        bool hotPath = false;
+        bool fingerprints = false;
+        bool tensors = false;
+        bool arithmetic = false;
+        bool pack = false;
+        bool orientation = false;
+        vector<string> files;
+
+        for (int i = 1; i < argc; i++) {
+                string arg = argv[i];
+                if (arg == "-o" && i + 1 < argc) {
+                        output = argv[++i];
+                } else if (arg == "-l" && i + 1 < argc) {
+                        label = argv[++i];
+                } else if (arg == "-r" && i + 1 < argc) {
+                        repetitions = max(1, atoi(argv[++i]));
+                } else if (arg == "-t" && i + 1 < argc) {
+                        threads = max(0, atoi(argv[++i]));
+                } else if (arg == "-s") {
+                        speculative = false;
+                } else if (arg == "-k") {
+                        decode = false;
+                } else if (arg == "-d") {
+                        kernels = false;
+                } else if (arg == "-p") {
+                        planar = true;
+                } else if (arg == "-f") {
+                        fingerprints = true;
+                } else if (arg == "-n") {
+                        tensors = true;
+                } else if (arg == "-A") {
+                        arithmetic = true;
+                } else if (arg == "-z") {
+                        pack = true;
+                } else if (arg == "-e") {
+                        orientation = true;
+                } else if (arg == "-c") {
+                        hotPath = true;
+                } else if (arg == "-i" && i + 1 < argc) {
+                        string mode = argv[++i];
+                        idctMode = mode == "accurate" ? IDCT_ACCURATE : (mode == "float" ? IDCT_FLOAT : IDCT_FAST);
+                } else if (arg == "-a" && i + 1 < argc) {
+                        string name = argv[++i];
+                        decodeAllocator = name == "hugepage" ? (BufferAllocator*)&hugePages : defaultAllocator();
+                } else if (arg[0] == '-') {
+                        cout << "Usage: ./jpgd_bench [-o result.json] [-l label] [-r repetitions] [-t threads] [-s] [-k|-d] [-p] [-f] [-n] [-A] [-z] [-e] [-c] [-a heap|hugepage] [-i fast|accurate|float] [files or directories...]" << endl;
+                        return -1;
+                } else {
+                        collectInputs(arg, files);
+                }
+        }
+
+        if (kernels) {
+                benchHuffman();
+                benchBitStream();
+                benchIDCT();
+                benchColor();
+                benchUpsample();
+                benchHamming();
+                benchEncode();
+                benchAllocator(defaultAllocator());
+                benchAllocator(&hugePages);
+        }
+
+        bool clean = true;
+        if (decode && pack)
+                clean = checkPackTiny();
+        if (decode) {
+                for (auto& file : files) {
+                        benchDecode(file, false);
+                        if (planar)
+                                benchDecode(file, true);
+                        if (fingerprints)
+                                benchFingerprint(file);
+                        if (tensors)
+                                benchTensor(file);
+                        if (arithmetic)
+                                benchArithmetic(file);
+                        if (pack)
+                                clean = benchPack(file) && clean;
+                        if (orientation)
+                                benchOrientation(file);
+                }
+        }
+
+        if (hotPath) {
+                for (auto& file : files)
+                        clean = checkHotPath(file) && clean;
+        }
+
+        if (!output.empty() && !writeJSON(output, label)) {
+                cout << "Could not write " << output << endl;
+                return -1;
+        }
+        return clean ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+#ifndef __BENCHUTIL_H
+#define __BENCHUTIL_H
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// helpers shared by the measurement tools in bench/
+
+// the whole file, empty if it can't be read
+inline std::string readFile(const std::string& path)
+{
+        std::ifstream file(path.c_str(), std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// p in [0, 1], the nearest rank of the sorted values (values must not be empty)
+inline double percentile(std::vector<double> values, double p)
+{
+        std::sort(values.begin(), values.end());
+        size_t index = std::min(values.size() - 1, (size_t)(p * (values.size() - 1) + 0.5));
+        return values[index];
+}
+
+#endif // __BENCHUTIL_H
@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+#
+# Compares two result files written by jpgd_bench -o.
+#
+# Usage: python3 bench/compare.py baseline.json current.json [threshold-percent]
+#
+# Prints the relative change of every benchmark (lower is better for all
+# units) and returns 1 if one of them got slower than the threshold
+# (default 5%) or a decoded image changed its checksum.
+
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return data.get("label", path), {r["name"]: r for r in data["results"]}
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit("Usage: compare.py baseline.json current.json [threshold-percent]")
+    threshold = float(sys.argv[3]) if len(sys.argv) > 3 else 5.0
+
+    base_label, base = load(sys.argv[1])
+    cur_label, cur = load(sys.argv[2])
+    print("%-48s %12s %12s %9s" % ("benchmark", base_label[:12], cur_label[:12], "change"))
+
+    failed = False
+    for name in sorted(set(base) | set(cur)):
+        if name not in base or name not in cur:
+            print("%-48s %s" % (name, "only in " + (base_label if name in base else cur_label)))
+            continue
+        b, c = base[name], cur[name]
+        note = ""
+        if b["value"] > 0:
+            change = (c["value"] - b["value"]) / b["value"] * 100.0
+        else:
+            change = 0.0
+        if change > threshold:
+            note = " slower"
+            failed = True
+        if b.get("checksum") != c.get("checksum"):
+            note += " output changed"
+            failed = True
+        if c.get("error", 0) != 0:
+            note += " error %d" % c["error"]
+            failed = True
+        print("%-48s %12.3f %12.3f %+8.1f%%%s" % (name, b["value"], c["value"], change, note))
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
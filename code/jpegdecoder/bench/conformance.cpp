@@ -0,0 +1,162 @@
+/*
+
+  Accuracy of the IDCT modes of dct.h, measured like IEEE Std 1180-1990.
+
+  Random 8x8 blocks of samples in [-L, H] are transformed with a double precision
+  forward DCT, rounded to integer coefficients (clipped to [-2048, 2047]) and then
+  reconstructed with a double precision IDCT (the reference) and with every IDCT
+  mode. 10000 blocks are tested per range, and again with the signs of the samples
+  inverted. The decoder IDCTs add 128 and clip to [0, 255], so the reference is
+  shifted and clipped the same way before comparing.
+
+  Limits of the standard: peak error <= 1, mean square error <= 0.06 for every
+  pixel and <= 0.02 overall, mean error <= 0.015 for every pixel and <= 0.0015
+  overall.
+
+  Usage: ./jpgd_conformance [-b blocks]
+
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "dct.h"
+
+struct Statistics
+{
+        int peak;
+        double squared[64];
+        double error[64];
+        long blocks;
+};
+
+// random number generator of the standard, samples in [-L, H]
+static long randx = 1;
+static long ieeeRandom(long L, long H)
+{
+        static const double z = (double)0x7FFFFFFF;
+        randx = (randx * 1103515245) + 12345;
+        long i = randx & 0x7FFFFFFE;
+        double x = ((double)i) / z;
+        x *= (L + H + 1);
+        long j = (long)x;
+        return j - L;
+}
+
+static double basis(int u, int x)
+{
+        return (u == 0 ? sqrt(0.5) : 1.0) / 2.0 * cos((2 * x + 1) * u * M_PI / 16.0);
+}
+
+static void referenceForward(const int* samples, int* coefficients)
+{
+        for (int v = 0; v < 8; v++) {
+                for (int u = 0; u < 8; u++) {
+                        double sum = 0;
+                        for (int y = 0; y < 8; y++) {
+                                for (int x = 0; x < 8; x++)
+                                        sum += basis(v, y) * basis(u, x) * samples[y * 8 + x];
+                        }
+                        long value = lround(sum);
+                        coefficients[v * 8 + u] = (int)(value < -2048 ? -2048 : (value > 2047 ? 2047 : value));
+                }
+        }
+}
+
+// level shifted and clipped just like the decoder IDCTs
+static void referenceInverse(const int* coefficients, int* samples)
+{
+        for (int y = 0; y < 8; y++) {
+                for (int x = 0; x < 8; x++) {
+                        double sum = 0;
+                        for (int v = 0; v < 8; v++) {
+                                for (int u = 0; u < 8; u++)
+                                        sum += basis(v, y) * basis(u, x) * coefficients[v * 8 + u];
+                        }
+                        long value = lround(sum) + 128;
+                        samples[y * 8 + x] = (int)(value < 0 ? 0 : (value > 255 ? 255 : value));
+                }
+        }
+}
+
+static void check(int L, int H, int sign, long blocks, Statistics* statistics)
+{
+        randx = 1;
+        for (long b = 0; b < blocks; b++) {
+                int samples[64], coefficients[64], reference[64];
+                for (int i = 0; i < 64; i++)
+                        samples[i] = (int)ieeeRandom(L, H) * sign;
+                referenceForward(samples, coefficients);
+                referenceInverse(coefficients, reference);
+
+                for (int mode = 0; mode < 3; mode++) {
+                        int values[64];
+                        for (int i = 0; i < 64; i++)
+                                values[i] = coefficients[i];
+                        DCT::inverse((IDCTMode)mode, values);
+
+                        Statistics& s = statistics[mode];
+                        for (int i = 0; i < 64; i++) {
+                                int error = values[i] - reference[i];
+                                s.peak = max(s.peak, abs(error));
+                                s.squared[i] += error * error;
+                                s.error[i] += error;
+                        }
+                        s.blocks++;
+                }
+        }
+}
+
+int main(int argc, char** argv)
+{
+        long blocks = 10000;
+        for (int i = 1; i < argc; i++) {
+                std::string arg = argv[i];
+                if (arg == "-b" && i + 1 < argc) {
+                        blocks = std::max(1L, atol(argv[++i]));
+                } else {
+                        printf("Usage: ./jpgd_conformance [-b blocks]\n");
+                        return -1;
+                }
+        }
+
+        const char* names[3] = { "fast", "accurate", "float" };
+        const int ranges[3][2] = { { 256, 255 }, { 5, 5 }, { 300, 300 } };
+        bool allPassed[3] = { true, true, true };
+
+        printf("%-9s %-12s %5s %10s %10s %10s %10s  %s\n", "mode", "range", "peak", "pixel mse", "mse", "pixel me", "me", "result");
+        for (int r = 0; r < 3; r++) {
+                for (int sign = 1; sign >= -1; sign -= 2) {
+                        Statistics statistics[3] = {};
+                        check(ranges[r][0], ranges[r][1], sign, blocks, statistics);
+
+                        for (int mode = 0; mode < 3; mode++) {
+                                Statistics& s = statistics[mode];
+                                double worstSquared = 0, worstError = 0, squared = 0, error = 0;
+                                for (int i = 0; i < 64; i++) {
+                                        worstSquared = max(worstSquared, s.squared[i] / s.blocks);
+                                        worstError = max(worstError, fabs(s.error[i] / s.blocks));
+                                        squared += s.squared[i];
+                                        error += s.error[i];
+                                }
+                                squared /= 64.0 * s.blocks;
+                                error /= 64.0 * s.blocks;
+                                bool passed = s.peak <= 1 && worstSquared <= 0.06 && squared <= 0.02
+                                              && worstError <= 0.015 && fabs(error) <= 0.0015;
+                                allPassed[mode] = allPassed[mode] && passed;
+
+                                char range[32];
+                                snprintf(range, sizeof(range), "%s[-%d,%d]", sign < 0 ? "-" : "", ranges[r][0], ranges[r][1]);
+                                printf("%-9s %-12s %5d %10.5f %10.5f %10.5f %10.5f  %s\n", names[mode], range, s.peak,
+                                       worstSquared, squared, worstError, error, passed ? "pass" : "FAIL");
+                        }
+                }
+        }
+
+        printf("\n");
+        for (int mode = 0; mode < 3; mode++)
+                printf("%-9s %s\n", names[mode], allPassed[mode] ? "meets the IEEE 1180 limits" : "exceeds the IEEE 1180 limits");
+        return 0;
+}
@@ -0,0 +1,137 @@
+/*
+
+  Latency of small decodes next to a large one on a single thread (decodetask.h).
+
+  The large image and all small images are started at the same time on one
+  RoundRobinScheduler, the large one first. Without a budget every task decodes its
+  whole image in one step, so the small images wait for the large one. With a budget
+  the tasks take turns after every few MCU rows / microseconds. Printed are the
+  percentiles of the completion times of the small images and the time of the large
+  one, once without and once with the budget.
+
+  Usage: ./jpgd_latency [-r rows] [-u microseconds] [-n repetitions] large.jpg small files/directories...
+
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "benchutil.h"
+#include "convert.h"
+#include "decodetask.h"
+#include "jpegdecoder.h"
+
+using namespace std;
+typedef chrono::steady_clock Clock;
+
+// discards the pixels, only the decoding is measured
+class NullSink : public RowSink
+{
+public:
+        virtual int band(int y, int rows, const unsigned char* rgb, int stride) { return 0; }
+};
+
+// fire and forget coroutine, used to take the completion time of a task
+struct Detached
+{
+        struct promise_type
+        {
+                Detached get_return_object() { return {}; }
+                suspend_never initial_suspend() noexcept { return {}; }
+                suspend_never final_suspend() noexcept { return {}; }
+                void return_void() {}
+                void unhandled_exception() { terminate(); }
+        };
+};
+
+static Detached finish(DecodeTask& task, Clock::time_point start, double& milliseconds, int& error)
+{
+        error = co_await task;
+        milliseconds = chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+// decodes everything once on one thread, the times are appended
+static bool run(const vector<string>& data, DecodeBudget budget, vector<double>& small, double& large)
+{
+        RoundRobinScheduler scheduler;
+        NullSink sink;
+        vector<unique_ptr<JpegDecoder>> decoders;
+        vector<DecodeTask> tasks;
+        vector<double> times(data.size());
+        vector<int> errors(data.size());
+        for (size_t i = 0; i < data.size(); i++) {
+                decoders.emplace_back(new JpegDecoder());
+                decoders[i]->setData(string(data[i]));
+                decoders[i]->setSink(&sink);
+                tasks.push_back(decodeAsync(*decoders[i], scheduler, budget));
+        }
+
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < data.size(); i++)
+                finish(tasks[i], start, times[i], errors[i]);
+        scheduler.run();
+
+        for (size_t i = 0; i < data.size(); i++) {
+                if (errors[i] != 0) {
+                        printf("decoding failed with error 0x%x\n", errors[i]);
+                        return false;
+                }
+        }
+        large += times[0];
+        small.insert(small.end(), times.begin() + 1, times.end());
+        return true;
+}
+
+int main(int argc, char** argv)
+{
+        DecodeBudget budget = { 4, 0 };
+        int repetitions = 5;
+        vector<string> files;
+        for (int i = 1; i < argc; i++) {
+                string arg = argv[i];
+                if (arg == "-r" && i + 1 < argc) {
+                        budget.rows = max(0, atoi(argv[++i]));
+                } else if (arg == "-u" && i + 1 < argc) {
+                        budget.microseconds = max(0, atoi(argv[++i]));
+                } else if (arg == "-n" && i + 1 < argc) {
+                        repetitions = max(1, atoi(argv[++i]));
+                } else if (arg[0] == '-') {
+                        printf("Usage: ./jpgd_latency [-r rows] [-u microseconds] [-n repetitions] large.jpg small files/directories...\n");
+                        return -1;
+                } else if (files.empty()) {
+                        files.push_back(arg);
+                } else {
+                        collectInputs(arg, files);
+                }
+        }
+        if (files.size() < 2) {
+                printf("Usage: ./jpgd_latency [-r rows] [-u microseconds] [-n repetitions] large.jpg small files/directories...\n");
+                return -1;
+        }
+
+        vector<string> data;
+        for (auto& file : files)
+                data.push_back(readFile(file));
+
+        DecodeBudget budgets[2] = { { 0, 0 }, budget };
+        const char* names[2] = { "whole image", "budget" };
+        printf("%zu small images next to %s, %d repetitions\n", files.size() - 1, files[0].c_str(), repetitions);
+        printf("%-12s %10s %10s %10s %12s\n", "", "p50 ms", "p99 ms", "max ms", "large ms");
+        for (int b = 0; b < 2; b++) {
+                vector<double> small;
+                double large = 0;
+                for (int r = 0; r < repetitions; r++) {
+                        if (!run(data, budgets[b], small, large))
+                                return 1;
+                }
+                printf("%-12s %10.2f %10.2f %10.2f %12.2f\n", names[b], percentile(small, 0.5),
+                       percentile(small, 0.99), percentile(small, 1.0), large / repetitions);
+        }
+        return 0;
+}
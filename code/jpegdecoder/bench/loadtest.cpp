@@ -0,0 +1,214 @@
+/*
+
+  Load test of the decode daemon (decodeserver.h).
+
+  Every connection is a thread with its own DecodeClient which sends the files one
+  request at a time, round robin, until the requests are used up. Printed are the
+  throughput and the percentiles of the request latency (submit until the pixels are
+  mapped and read). -S starts the daemon in this process instead of connecting to a
+  running one, -i decodes in the connection threads without a daemon (a new decoder
+  with one thread per core for every image, like separate worker processes would)
+  for comparison.
+
+  Usage: ./jpgd_loadtest [-s socket] [-S] [-i] [-t threads] [-c connections] [-n requests] [-f rgb|xrgb] [-x scale] [-O] [-F] files/directories...
+        -t      worker threads of the daemon started with -S, 0 (default) uses one per core
+        -O      apply the EXIF orientation of the images
+        -F      pass open file descriptors instead of paths
+
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "benchutil.h"
+#include "convert.h"
+#include "decodeclient.h"
+#include "decodeserver.h"
+#include "jpegdecoder.h"
+
+using namespace std;
+typedef chrono::steady_clock Clock;
+
+// the decoded pixels in one buffer, as the daemon returns them
+class BufferSink : public RowSink
+{
+private:
+        PixelFormat pixelFormat;
+        int stride;
+        vector<unsigned char>& pixels;
+public:
+        BufferSink(PixelFormat pixelFormat, vector<unsigned char>& pixels) : pixelFormat(pixelFormat), stride(0), pixels(pixels) {}
+
+        PixelFormat format() { return pixelFormat; }
+        int begin(int width, int height) {
+                stride = width * pixelSize(pixelFormat);
+                pixels.resize((size_t)stride * height);
+                return 0;
+        }
+        unsigned char* target(int y, int& rowStride) {
+                rowStride = stride;
+                return &pixels[(size_t)y * stride];
+        }
+        unsigned char* image(int& rowStride) {
+                rowStride = stride;
+                return pixels.data();
+        }
+        int band(int y, int rows, const unsigned char* rgb, int stride) { return 0; }
+};
+
+// reads a byte of every page, so the mapping is actually used
+static unsigned long touch(const unsigned char* pixels, size_t size)
+{
+        unsigned long sum = 0;
+        for (size_t i = 0; i < size; i += 4096)
+                sum += pixels[i];
+        return sum;
+}
+
+int main(int argc, char** argv)
+{
+        string socketPath;
+        bool startServer = false;
+        bool inProcess = false;
+        bool descriptors = false;
+        int threads = 0;
+        int connections = 4;
+        int requests = 200;
+        DecodeOptions options;
+        vector<string> files;
+        const char* usage = "Usage: ./jpgd_loadtest [-s socket] [-S] [-i] [-t threads] [-c connections] [-n requests] [-f rgb|xrgb] [-x scale] [-O] [-F] files/directories...\n";
+
+        for (int i = 1; i < argc; i++) {
+                string arg = argv[i];
+                if (arg == "-s" && i + 1 < argc) {
+                        socketPath = argv[++i];
+                } else if (arg == "-S") {
+                        startServer = true;
+                } else if (arg == "-i") {
+                        inProcess = true;
+                } else if (arg == "-t" && i + 1 < argc) {
+                        threads = max(0, atoi(argv[++i]));
+                } else if (arg == "-c" && i + 1 < argc) {
+                        connections = max(1, atoi(argv[++i]));
+                } else if (arg == "-n" && i + 1 < argc) {
+                        requests = max(1, atoi(argv[++i]));
+                } else if (arg == "-f" && i + 1 < argc) {
+                        options.format = string(argv[++i]) == "xrgb" ? PIXEL_XRGB32 : PIXEL_RGB;
+                } else if (arg == "-x" && i + 1 < argc) {
+                        options.scale = atoi(argv[++i]);
+                } else if (arg == "-O") {
+                        options.orient = true;
+                } else if (arg == "-F") {
+                        descriptors = true;
+                } else if (arg[0] == '-') {
+                        printf("%s", usage);
+                        return -1;
+                } else {
+                        collectInputs(arg, files);
+                }
+        }
+        if (files.empty()) {
+                printf("%s", usage);
+                return -1;
+        }
+
+        if (socketPath.empty() && !inProcess && defaultDaemonSocket(socketPath, startServer) != 0) {
+                printf("No private socket directory, use -s\n");
+                return 1;
+        }
+        DecodeServer server(threads);
+        thread serverThread;
+        if (startServer && !inProcess) {
+                socketPath += "." + to_string(getpid());
+                if (server.listen(socketPath) != 0) {
+                        printf("Could not listen on %s\n", socketPath.c_str());
+                        return 1;
+                }
+                serverThread = thread(&DecodeServer::run, &server);
+        }
+
+        atomic<int> next(0);
+        atomic<int> errors(0);
+        atomic<long> pixels(0);
+        atomic<unsigned long> checksum(0);
+        vector<vector<double>> latencies(connections);
+        vector<thread> clients;
+        Clock::time_point start = Clock::now();
+        for (int c = 0; c < connections; c++) {
+                clients.push_back(thread([&, c]() {
+                        DecodeClient client;
+                        if (!inProcess && client.connect(socketPath) != 0) {
+                                printf("Could not connect to %s\n", socketPath.c_str());
+                                errors += requests;
+                                return;
+                        }
+                        vector<unsigned char> buffer;
+                        DecodedImage image;
+                        int index;
+                        while ((index = next++) < requests) {
+                                const string& path = files[index % files.size()];
+                                Clock::time_point begin = Clock::now();
+                                int errcode;
+                                if (inProcess) {
+                                        JpegDecoder decoder;
+                                        BufferSink sink(options.format, buffer);
+                                        decoder.setScale(options.scale);
+                                        decoder.setAutoOrient(options.orient);
+                                        decoder.setSink(&sink);
+                                        errcode = decoder.read(path) ? decoder.decode() : ERROR_DAEMONREAD;
+                                        if (errcode == 0) {
+                                                checksum += touch(buffer.data(), buffer.size());
+                                                pixels += (long)decoder.getOutputWidth() * decoder.getOutputHeight();
+                                        }
+                                } else {
+                                        if (descriptors) {
+                                                int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                                                errcode = client.decode(file, options, image);
+                                                if (file >= 0)
+                                                        close(file);
+                                        } else {
+                                                errcode = client.decode(path, options, image);
+                                        }
+                                        if (errcode == 0) {
+                                                checksum += touch(image.pixels(), (size_t)image.stride * image.height);
+                                                pixels += (long)image.width * image.height;
+                                        }
+                                        image.release();
+                                }
+                                latencies[c].push_back(chrono::duration<double, milli>(Clock::now() - begin).count());
+                                if (errcode != 0) {
+                                        if (errors++ == 0)
+                                                printf("%s: error code 0x%x\n", path.c_str(), errcode);
+                                }
+                        }
+                }));
+        }
+        for (auto& client : clients)
+                client.join();
+        double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+        if (serverThread.joinable()) {
+                server.stop();
+                serverThread.join();
+        }
+
+        vector<double> all;
+        for (auto& times : latencies)
+                all.insert(all.end(), times.begin(), times.end());
+        if (all.empty())
+                return 1;
+        printf("%s, %d connections, %zu requests, %d errors (checksum %lu)\n",
+               inProcess ? "in process" : socketPath.c_str(), connections, all.size(), errors.load(), checksum.load());
+        printf("%10s %10s %10s %10s %10s %10s\n", "images/s", "MP/s", "p50 ms", "p90 ms", "p99 ms", "max ms");
+        printf("%10.1f %10.1f %10.2f %10.2f %10.2f %10.2f\n", all.size() / seconds, pixels.load() / seconds / 1e6,
+               percentile(all, 0.5), percentile(all, 0.9), percentile(all, 0.99), percentile(all, 1.0));
+        return errors.load() == 0 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+#
+# Generates the benchmark corpus for jpgd_bench.
+#
+# The images are built from the photos in data/ (downscaled for the small
+# sizes, tiled for the large ones) and encoded with every combination of
+# size, chroma subsampling, restart interval and quality. The encoder is
+# deterministic for a given Pillow/libjpeg version, the versions used are
+# recorded in manifest.json next to the images.
+#
+# Usage: python3 bench/mkcorpus.py [--quick] [--sizes icon,vga,...] output_directory
+#
+# Requires Pillow (pip install pillow).
+
+import argparse
+import json
+import os
+import sys
+
+from PIL import Image, features
+
+SIZES = [
+    ("icon", 48, 48),
+    ("thumb", 160, 120),
+    ("vga", 640, 480),
+    ("fullhd", 1920, 1080),
+    ("12mp", 4000, 3000),
+    ("50mp", 8192, 6144),
+]
+
+# Pillow can't express 1x2 (4:4:0) sampling, the decoder supports it as well
+SUBSAMPLING = [("444", "4:4:4"), ("422", "4:2:2"), ("420", "4:2:0")]
+QUALITY = [30, 75, 95]
+RESTART = [("nori", 0), ("rst", 1)]     # restart marker after every MCU row
+
+
+def source_images():
+    data = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "data")
+    names = sorted(n for n in os.listdir(data) if n.endswith(".jpg"))
+    return [Image.open(os.path.join(data, n)).convert("RGB") for n in names]
+
+
+def build(sources, width, height):
+    first = sources[0]
+    if width <= first.width and height <= first.height:
+        return first.resize((width, height), Image.LANCZOS)
+
+    # tile the photos at their native resolution, large images keep the
+    # entropy of real camera pictures instead of being smooth upscales
+    canvas = Image.new("RGB", (width, height))
+    i = 0
+    for y in range(0, height, first.height):
+        for x in range(0, width, first.width):
+            canvas.paste(sources[i % len(sources)], (x, y))
+            i += 1
+    return canvas
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate the jpgd benchmark corpus.")
+    parser.add_argument("output")
+    parser.add_argument("--quick", action="store_true",
+                        help="only quality 75 and sizes up to 12 MP")
+    parser.add_argument("--sizes", help="comma separated subset of: "
+                        + ",".join(s[0] for s in SIZES))
+    args = parser.parse_args()
+
+    sizes = SIZES
+    qualities = QUALITY
+    if args.quick:
+        sizes = [s for s in SIZES if s[0] != "50mp"]
+        qualities = [75]
+    if args.sizes:
+        wanted = args.sizes.split(",")
+        sizes = [s for s in SIZES if s[0] in wanted]
+        if not sizes:
+            sys.exit("no known size in --sizes")
+
+    os.makedirs(args.output, exist_ok=True)
+    sources = source_images()
+    manifest = {
+        "pillow": Image.__version__,
+        "libjpeg": features.version("jpg"),
+        "files": [],
+    }
+
+    for name, width, height in sizes:
+        image = build(sources, width, height)
+        for ss, sampling in SUBSAMPLING:
+            for quality in qualities:
+                for rst, rows in RESTART:
+                    filename = "%s_%dx%d_%s_q%d_%s.jpg" % (name, width, height, ss, quality, rst)
+                    image.save(os.path.join(args.output, filename), quality=quality,
+                               subsampling=sampling, restart_marker_rows=rows,
+                               optimize=False, progressive=False)
+                    manifest["files"].append({
+                        "file": filename, "width": width, "height": height,
+                        "subsampling": sampling, "quality": quality,
+                        "restart_rows": rows,
+                    })
+                    print(filename)
+
+    with open(os.path.join(args.output, "manifest.json"), "w") as out:
+        json.dump(manifest, out, indent=2)
+
+
+if __name__ == "__main__":
+    main()
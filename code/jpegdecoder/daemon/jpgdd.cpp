@@ -0,0 +1,14 @@
+/*
+
+  The decode daemon without the viewer (no gtkmm needed), same as ./jpgd serve.
+
+  Usage: ./jpgdd [-s socket] [-t threads]
+
+ */
+
+#include "decodeserver.h"
+
+int main(int argc, char** argv)
+{
+        return serveCommand(argc, argv);
+}
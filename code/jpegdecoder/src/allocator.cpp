@@ -0,0 +1,111 @@
+#include "allocator.h"
+#include <cstdlib>
+#include <sys/mman.h>
+using namespace std;
+
+#define HUGE_PAGE_SIZE  (2 << 20)
+
+void* HeapAllocator::allocate(size_t size)
+{
+        void* memory = nullptr;
+        if (posix_memalign(&memory, 64, size != 0 ? size : 1) != 0)
+                return nullptr;
+        return memory;
+}
+
+void HeapAllocator::release(void* memory, size_t size)
+{
+        free(memory);
+}
+
+static size_t roundUp(size_t size, size_t alignment)
+{
+        return (size + alignment - 1) / alignment * alignment;
+}
+
+void* HugePageAllocator::allocate(size_t size)
+{
+        if (size < HUGE_PAGE_SIZE)
+                return heap.allocate(size);
+
+        size_t length = roundUp(size, HUGE_PAGE_SIZE);
+#ifdef MAP_HUGETLB
+        void* memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED)
+                return memory;
+#endif
+
+        // no reserved huge pages: map one huge page more and cut the mapping to a 2 MiB boundary
+        char* mapping = (char*)mmap(nullptr, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+                return nullptr;
+        char* aligned = (char*)roundUp((size_t)mapping, HUGE_PAGE_SIZE);
+        if (aligned != mapping)
+                munmap(mapping, aligned - mapping);
+        munmap(aligned + length, mapping + HUGE_PAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, length, MADV_HUGEPAGE);
+#endif
+        return aligned;
+}
+
+void HugePageAllocator::release(void* memory, size_t size)
+{
+        if (memory == nullptr)
+                return;
+        if (size < HUGE_PAGE_SIZE)
+                heap.release(memory, size);
+        else
+                munmap(memory, roundUp(size, HUGE_PAGE_SIZE));
+}
+
+RecyclingAllocator::~RecyclingAllocator()
+{
+        for (auto& entry : spare)
+                allocator->release(entry.second, entry.first);
+}
+
+void* RecyclingAllocator::allocate(size_t size)
+{
+        {
+                lock_guard<std::mutex> lock(mutex);
+                auto found = spare.lower_bound(size);
+                if (found != spare.end() && found->first / 2 <= size) {
+                        void* memory = found->second;
+                        capacities[memory] = found->first;
+                        cached -= found->first;
+                        spare.erase(found);
+                        return memory;
+                }
+        }
+        void* memory = allocator->allocate(size);
+        if (memory != nullptr) {
+                lock_guard<std::mutex> lock(mutex);
+                capacities[memory] = size;
+        }
+        return memory;
+}
+
+void RecyclingAllocator::release(void* memory, size_t size)
+{
+        if (memory == nullptr)
+                return;
+        unique_lock<std::mutex> lock(mutex);
+        auto found = capacities.find(memory);
+        size_t capacity = found != capacities.end() ? found->second : size;
+        if (found != capacities.end())
+                capacities.erase(found);
+        if (cached + capacity <= limit) {
+                spare.insert(make_pair(capacity, memory));
+                cached += capacity;
+                return;
+        }
+        lock.unlock();
+        allocator->release(memory, capacity);
+}
+
+BufferAllocator* defaultAllocator()
+{
+        static HeapAllocator allocator;
+        return &allocator;
+}
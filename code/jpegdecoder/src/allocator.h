@@ -0,0 +1,101 @@
+#ifndef __ALLOCATOR_H
+#define __ALLOCATOR_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+/*!
+ * Memory for the large buffers of the decoder (picture, coefficient rows, bands).
+ *
+ * None of the implementations touches the memory it returns, so every page is
+ * faulted in by the thread which writes it first. With the pipelined decoder the
+ * rows of the picture are written by the worker which reconstructed them, so on a
+ * NUMA machine the pages end up on the node of that worker (first touch placement).
+ */
+class BufferAllocator
+{
+public:
+        virtual ~BufferAllocator() {}
+        virtual void* allocate(size_t size) = 0;
+        // size has to be the one passed to allocate
+        virtual void release(void* memory, size_t size) = 0;
+        virtual const char* name() = 0;
+};
+
+// malloc, 64 byte aligned
+class HeapAllocator : public BufferAllocator
+{
+public:
+        void* allocate(size_t size);
+        void release(void* memory, size_t size);
+        const char* name() { return "heap"; }
+};
+
+/*!
+ * Buffers of at least 2 MiB are mapped with MAP_HUGETLB if the system has reserved
+ * huge pages, otherwise they are 2 MiB aligned anonymous mappings with
+ * madvise(MADV_HUGEPAGE), so transparent huge pages can back them. Smaller buffers
+ * come from the heap.
+ */
+class HugePageAllocator : public BufferAllocator
+{
+private:
+        HeapAllocator heap;
+public:
+        void* allocate(size_t size);
+        void release(void* memory, size_t size);
+        const char* name() { return "hugepage"; }
+};
+
+/*!
+ * Keeps released buffers (up to limit bytes) and hands them out again for requests
+ * of at most the same size and at least half of it, so a long running decoder (see
+ * decodeserver.h) doesn't map and fault in its band and coefficient buffers for every
+ * image. The buffers come from the wrapped allocator, which has to outlive this one.
+ */
+class RecyclingAllocator : public BufferAllocator
+{
+private:
+        BufferAllocator* allocator;
+        size_t limit;
+        size_t cached;                          // bytes of the free buffers
+        std::multimap<size_t, void*> spare;     // capacity -> buffer
+        std::map<void*, size_t> capacities;     // handed out buffers
+        std::mutex mutex;
+
+public:
+        RecyclingAllocator(BufferAllocator* allocator, size_t limit)
+                : allocator(allocator), limit(limit), cached(0) {}
+        ~RecyclingAllocator();
+        void* allocate(size_t size);
+        void release(void* memory, size_t size);
+        const char* name() { return "recycling"; }
+};
+
+// the allocator used if none has been set
+BufferAllocator* defaultAllocator();
+
+// uninitialized array from an allocator, frees the memory when it goes out of scope
+template<typename T>
+class Buffer
+{
+private:
+        BufferAllocator* allocator;
+        T* memory;
+        size_t count;
+
+        Buffer(const Buffer&);
+        Buffer& operator=(const Buffer&);
+
+public:
+        Buffer(BufferAllocator* allocator, size_t count)
+                : allocator(allocator), memory((T*)allocator->allocate(count * sizeof(T))), count(count) {}
+        ~Buffer() { allocator->release(memory, count * sizeof(T)); }
+
+        T* data() { return memory; }
+        T& operator[](size_t i) { return memory[i]; }
+        size_t size() { return count; }
+};
+
+#endif // __ALLOCATOR_H
@@ -0,0 +1,437 @@
+#include "arithmetic.h"
+#include <cstring>
+#include "zigzag.h"
+using namespace std;
+
+// probability estimation state machine of T.81 Table D.2, the last entry is
+// the fixed 0.5 estimate used for the signs of the AC coefficients
+struct QMState
+{
+        unsigned short qe;              // probability estimate of the less probable symbol
+        unsigned char nextLPS;
+        unsigned char nextMPS;
+        unsigned char switchMPS;        // 1: the sense of the MPS changes after a LPS
+};
+
+static const QMState states[114] = {
+        { 0x5a1d,   1,   1, 1 }, { 0x2586,  14,   2, 0 }, { 0x1114,  16,   3, 0 }, { 0x080b,  18,   4, 0 },
+        { 0x03d8,  20,   5, 0 }, { 0x01da,  23,   6, 0 }, { 0x00e5,  25,   7, 0 }, { 0x006f,  28,   8, 0 },
+        { 0x0036,  30,   9, 0 }, { 0x001a,  33,  10, 0 }, { 0x000d,  35,  11, 0 }, { 0x0006,   9,  12, 0 },
+        { 0x0003,  10,  13, 0 }, { 0x0001,  12,  13, 0 }, { 0x5a7f,  15,  15, 1 }, { 0x3f25,  36,  16, 0 },
+        { 0x2cf2,  38,  17, 0 }, { 0x207c,  39,  18, 0 }, { 0x17b9,  40,  19, 0 }, { 0x1182,  42,  20, 0 },
+        { 0x0cef,  43,  21, 0 }, { 0x09a1,  45,  22, 0 }, { 0x072f,  46,  23, 0 }, { 0x055c,  48,  24, 0 },
+        { 0x0406,  49,  25, 0 }, { 0x0303,  51,  26, 0 }, { 0x0240,  52,  27, 0 }, { 0x01b1,  54,  28, 0 },
+        { 0x0144,  56,  29, 0 }, { 0x00f5,  57,  30, 0 }, { 0x00b7,  59,  31, 0 }, { 0x008a,  60,  32, 0 },
+        { 0x0068,  62,  33, 0 }, { 0x004e,  63,  34, 0 }, { 0x003b,  32,  35, 0 }, { 0x002c,  33,   9, 0 },
+        { 0x5ae1,  37,  37, 1 }, { 0x484c,  64,  38, 0 }, { 0x3a0d,  65,  39, 0 }, { 0x2ef1,  67,  40, 0 },
+        { 0x261f,  68,  41, 0 }, { 0x1f33,  69,  42, 0 }, { 0x19a8,  70,  43, 0 }, { 0x1518,  72,  44, 0 },
+        { 0x1177,  73,  45, 0 }, { 0x0e74,  74,  46, 0 }, { 0x0bfb,  75,  47, 0 }, { 0x09f8,  77,  48, 0 },
+        { 0x0861,  78,  49, 0 }, { 0x0706,  79,  50, 0 }, { 0x05cd,  48,  51, 0 }, { 0x04de,  50,  52, 0 },
+        { 0x040f,  50,  53, 0 }, { 0x0363,  51,  54, 0 }, { 0x02d4,  52,  55, 0 }, { 0x025c,  53,  56, 0 },
+        { 0x01f8,  54,  57, 0 }, { 0x01a4,  55,  58, 0 }, { 0x0160,  56,  59, 0 }, { 0x0125,  57,  60, 0 },
+        { 0x00f6,  58,  61, 0 }, { 0x00cb,  59,  62, 0 }, { 0x00ab,  61,  63, 0 }, { 0x008f,  61,  32, 0 },
+        { 0x5b12,  65,  65, 1 }, { 0x4d04,  80,  66, 0 }, { 0x412c,  81,  67, 0 }, { 0x37d8,  82,  68, 0 },
+        { 0x2fe8,  83,  69, 0 }, { 0x293c,  84,  70, 0 }, { 0x2379,  86,  71, 0 }, { 0x1edf,  87,  72, 0 },
+        { 0x1aa9,  87,  73, 0 }, { 0x174e,  72,  74, 0 }, { 0x1424,  72,  75, 0 }, { 0x119c,  74,  76, 0 },
+        { 0x0f6b,  74,  77, 0 }, { 0x0d51,  75,  78, 0 }, { 0x0bb6,  77,  79, 0 }, { 0x0a40,  77,  48, 0 },
+        { 0x5832,  80,  81, 1 }, { 0x4d1c,  88,  82, 0 }, { 0x438e,  89,  83, 0 }, { 0x3bdd,  90,  84, 0 },
+        { 0x34ee,  91,  85, 0 }, { 0x2eae,  92,  86, 0 }, { 0x299a,  93,  87, 0 }, { 0x2516,  86,  71, 0 },
+        { 0x5570,  88,  89, 1 }, { 0x4ca9,  95,  90, 0 }, { 0x44d9,  96,  91, 0 }, { 0x3e22,  97,  92, 0 },
+        { 0x3824,  99,  93, 0 }, { 0x32b4,  99,  94, 0 }, { 0x2e17,  93,  86, 0 }, { 0x56a8,  95,  96, 1 },
+        { 0x4f46, 101,  97, 0 }, { 0x47e5, 102,  98, 0 }, { 0x41cf, 103,  99, 0 }, { 0x3c3d, 104, 100, 0 },
+        { 0x375e,  99,  93, 0 }, { 0x5231, 105, 102, 0 }, { 0x4c0f, 106, 103, 0 }, { 0x4639, 107, 104, 0 },
+        { 0x415e, 103,  99, 0 }, { 0x5627, 105, 106, 1 }, { 0x50e7, 108, 107, 0 }, { 0x4b85, 109, 103, 0 },
+        { 0x5597, 110, 109, 0 }, { 0x504f, 111, 107, 0 }, { 0x5a10, 110, 111, 1 }, { 0x5522, 112, 109, 0 },
+        { 0x59eb, 112, 111, 1 }, { 0x5a1d, 113, 113, 0 },
+};
+
+#define FIXED_STATE     113
+
+void ArithmeticConditioning::reset()
+{
+        for (int t = 0; t < 4; t++) {
+                dcL[t] = 0;
+                dcU[t] = 1;
+                acK[t] = 5;
+        }
+}
+
+ArithmeticDecoder::ArithmeticDecoder()
+{
+        data = nullptr;
+        length = 0;
+        start(nullptr, 0);
+}
+
+void ArithmeticDecoder::start(const unsigned char* data, size_t length)
+{
+        this->data = data;
+        this->length = length;
+        position = 0;
+        reset();
+}
+
+void ArithmeticDecoder::reset()
+{
+        memset(dcStats, 0, sizeof(dcStats));
+        memset(acStats, 0, sizeof(acStats));
+        fixedBin = FIXED_STATE;
+        dcContext[0] = dcContext[1] = dcContext[2] = 0;
+        marker = false;
+        c = 0;
+        a = 0;
+        ct = -16;               // the first decode reads two bytes
+}
+
+void ArithmeticDecoder::restart()
+{
+        // the code may end before the last byte of the interval
+        size_t p = position;
+        while (p + 1 < length && !(data[p] == 0xFF && data[p + 1] != 0x00 && data[p + 1] != 0xFF))
+                p++;
+        if (p + 1 < length && (data[p + 1] & 0xF8) == 0xD0)
+                p += 2;
+        position = p;
+        reset();
+}
+
+// next byte of the code, 0 once a marker or the end of the data has been reached
+unsigned char ArithmeticDecoder::nextByte()
+{
+        if (marker || position >= length) {
+                marker = true;
+                return 0;
+        }
+        unsigned char byte = data[position++];
+        if (byte != 0xFF)
+                return byte;
+
+        // a stuffed zero or a marker (with optional fill bytes)
+        size_t next = position;
+        while (next < length && data[next] == 0xFF)
+                next++;
+        if (next < length && data[next] == 0x00) {
+                position = next + 1;
+                return 0xFF;
+        }
+        position = next - 1;
+        marker = true;
+        return 0;
+}
+
+// decodes one binary decision with the statistics bin state (D.2)
+inline int ArithmeticDecoder::decode(unsigned char* state)
+{
+        // renormalization and input of the next bytes
+        while (a < 0x8000) {
+                if (--ct < 0) {
+                        c = (c << 8) | nextByte();
+                        if ((ct += 8) < 0) {
+                                // initialization, two bytes are read before a is set
+                                if (++ct == 0)
+                                        a = 0x8000;
+                        }
+                }
+                a <<= 1;
+        }
+
+        int sv = *state;
+        const QMState& s = states[sv & 0x7F];
+        unsigned int qe = s.qe;
+        unsigned char afterLPS = s.nextLPS | (s.switchMPS << 7);
+        a -= qe;
+        unsigned int temp = a << ct;
+        if (c >= temp) {
+                // LPS interval, unless the conditional exchange applies
+                c -= temp;
+                if (a < qe) {
+                        *state = (sv & 0x80) ^ s.nextMPS;
+                } else {
+                        *state = (sv & 0x80) ^ afterLPS;
+                        sv ^= 0x80;
+                }
+                a = qe;
+        } else if (a < 0x8000) {
+                if (a < qe) {
+                        *state = (sv & 0x80) ^ afterLPS;
+                        sv ^= 0x80;
+                } else {
+                        *state = (sv & 0x80) ^ s.nextMPS;
+                }
+        }
+        return sv >> 7;
+}
+
+int ArithmeticDecoder::decodeBlock(int component, int dcTable, int acTable, const unsigned short* quantization,
+                                   int& previousDC, int* values)
+{
+        memset((void*)values, 0, 64 * sizeof(int));
+
+        // DC difference (F.2.4.1), the context depends on the previous difference
+        unsigned char* st = dcStats[dcTable] + dcContext[component];
+        if (decode(st) == 0) {
+                dcContext[component] = 0;
+        } else {
+                int sign = decode(st + 1);
+                st += 2 + sign;
+                int m = decode(st);
+                if (m != 0) {
+                        st = dcStats[dcTable] + 20;
+                        while (decode(st)) {
+                                if ((m <<= 1) == 0x8000)
+                                        return ERROR_ARITHMETICCODE;
+                                st++;
+                        }
+                }
+                if (m < (1 << conditioning.dcL[dcTable]) >> 1)
+                        dcContext[component] = 0;
+                else if (m > (1 << conditioning.dcU[dcTable]) >> 1)
+                        dcContext[component] = 12 + sign * 4;
+                else
+                        dcContext[component] = 4 + sign * 4;
+                int v = m;
+                st += 14;
+                while (m >>= 1) {
+                        if (decode(st))
+                                v |= m;
+                }
+                v += 1;
+                previousDC += sign ? -v : v;
+        }
+        values[0] = previousDC * quantization[0];
+
+        // AC coefficients (F.2.4.2): end of block, zero runs, sign and magnitude
+        for (int k = 1; k < 64; k++) {
+                st = acStats[acTable] + 3 * (k - 1);
+                if (decode(st))
+                        break;
+                while (decode(st + 1) == 0) {
+                        st += 3;
+                        if (++k > 63)
+                                return ERROR_ARITHMETICCODE;
+                }
+                int sign = decode(&fixedBin);
+                st += 2;
+                int m = decode(st);
+                if (m != 0 && decode(st)) {
+                        m <<= 1;
+                        st = acStats[acTable] + (k <= conditioning.acK[acTable] ? 189 : 217);
+                        while (decode(st)) {
+                                if ((m <<= 1) == 0x8000)
+                                        return ERROR_ARITHMETICCODE;
+                                st++;
+                        }
+                }
+                int v = m;
+                st += 14;
+                while (m >>= 1) {
+                        if (decode(st))
+                                v |= m;
+                }
+                v += 1;
+                values[zz[k]] = (sign ? -v : v) * quantization[k];
+        }
+        return 0;
+}
+
+ArithmeticEncoder::ArithmeticEncoder(string& out) : out(out)
+{
+        c = 0;
+        a = 0x10000;
+        ct = 11;
+        buffer = -1;
+        stacked = 0;
+        zeros = 0;
+        memset(dcStats, 0, sizeof(dcStats));
+        memset(acStats, 0, sizeof(acStats));
+        fixedBin = FIXED_STATE;
+        dcContext[0] = dcContext[1] = dcContext[2] = 0;
+}
+
+void ArithmeticEncoder::emitZeros()
+{
+        for (; zeros > 0; zeros--)
+                emit(0x00);
+}
+
+// writes the buffered byte (plus a carry) and the stacked 0xFF bytes
+void ArithmeticEncoder::release(bool carry)
+{
+        if (carry) {
+                if (buffer >= 0) {
+                        emitZeros();
+                        emit(buffer + 1);
+                        if (buffer + 1 == 0xFF)
+                                emit(0x00);
+                }
+                // the carry turns the stacked 0xFF bytes into zeros
+                zeros += stacked;
+                stacked = 0;
+                return;
+        }
+        if (buffer == 0) {
+                zeros++;
+        } else if (buffer > 0) {
+                emitZeros();
+                emit(buffer);
+        }
+        if (stacked > 0) {
+                emitZeros();
+                for (; stacked > 0; stacked--) {
+                        emit(0xFF);
+                        emit(0x00);
+                }
+        }
+}
+
+// encodes one binary decision (D.1)
+void ArithmeticEncoder::encode(unsigned char* state, int value)
+{
+        int sv = *state;
+        const QMState& s = states[sv & 0x7F];
+        unsigned int qe = s.qe;
+        a -= qe;
+        if (value != (sv >> 7)) {
+                if (a >= qe) {
+                        c += a;
+                        a = qe;
+                }
+                *state = (sv & 0x80) ^ (s.nextLPS | (s.switchMPS << 7));
+        } else {
+                if (a >= 0x8000)
+                        return;
+                if (a < qe) {
+                        c += a;
+                        a = qe;
+                }
+                *state = (sv & 0x80) ^ s.nextMPS;
+        }
+
+        // renormalization and output of the finished bytes
+        do {
+                a <<= 1;
+                c <<= 1;
+                if (--ct == 0) {
+                        unsigned int temp = c >> 19;
+                        if (temp == 0xFF) {
+                                stacked++;
+                        } else {
+                                release(temp > 0xFF);
+                                buffer = temp & 0xFF;
+                        }
+                        c &= 0x7FFFF;
+                        ct += 8;
+                }
+        } while (a < 0x8000);
+}
+
+void ArithmeticEncoder::encodeBlock(int component, int dcTable, int acTable, const short* block, int& previousDC)
+{
+        // DC difference (F.1.4.1)
+        unsigned char* st = dcStats[dcTable] + dcContext[component];
+        int v = block[0] - previousDC;
+        if (v == 0) {
+                encode(st, 0);
+                dcContext[component] = 0;
+        } else {
+                previousDC = block[0];
+                encode(st, 1);
+                if (v > 0) {
+                        encode(st + 1, 0);
+                        st += 2;
+                        dcContext[component] = 4;
+                } else {
+                        v = -v;
+                        encode(st + 1, 1);
+                        st += 3;
+                        dcContext[component] = 8;
+                }
+                int m = 0;
+                if (v -= 1) {
+                        encode(st, 1);
+                        m = 1;
+                        st = dcStats[dcTable] + 20;
+                        for (int rest = v >> 1; rest != 0; rest >>= 1) {
+                                encode(st, 1);
+                                m <<= 1;
+                                st++;
+                        }
+                }
+                encode(st, 0);
+                if (m < (1 << conditioning.dcL[dcTable]) >> 1)
+                        dcContext[component] = 0;
+                else if (m > (1 << conditioning.dcU[dcTable]) >> 1)
+                        dcContext[component] += 8;
+                st += 14;
+                while (m >>= 1)
+                        encode(st, (m & v) ? 1 : 0);
+        }
+
+        // AC coefficients (F.1.4.2)
+        int end = 63;
+        while (end > 0 && block[zz[end]] == 0)
+                end--;
+        int k;
+        for (k = 1; k <= end; k++) {
+                st = acStats[acTable] + 3 * (k - 1);
+                encode(st, 0);
+                while ((v = block[zz[k]]) == 0) {
+                        encode(st + 1, 0);
+                        st += 3;
+                        k++;
+                }
+                encode(st + 1, 1);
+                if (v > 0) {
+                        encode(&fixedBin, 0);
+                } else {
+                        v = -v;
+                        encode(&fixedBin, 1);
+                }
+                st += 2;
+                int m = 0;
+                if (v -= 1) {
+                        encode(st, 1);
+                        m = 1;
+                        int rest = v >> 1;
+                        if (rest != 0) {
+                                encode(st, 1);
+                                m <<= 1;
+                                st = acStats[acTable] + (k <= conditioning.acK[acTable] ? 189 : 217);
+                                for (rest >>= 1; rest != 0; rest >>= 1) {
+                                        encode(st, 1);
+                                        m <<= 1;
+                                        st++;
+                                }
+                        }
+                }
+                encode(st, 0);
+                st += 14;
+                while (m >>= 1)
+                        encode(st, (m & v) ? 1 : 0);
+        }
+        if (k < 64)
+                encode(acStats[acTable] + 3 * (k - 1), 1);
+}
+
+void ArithmeticEncoder::flush()
+{
+        // the value inside the final interval with the most trailing zero bits (D.1.8)
+        unsigned int temp = (a - 1 + c) & 0xFFFF0000;
+        c = temp < c ? temp + 0x8000 : temp;
+        c <<= ct;
+        release((c & 0xF8000000) != 0);
+        // trailing zero bytes are left out
+        if (c & 0x7FFF800) {
+                emitZeros();
+                int byte = (c >> 19) & 0xFF;
+                emit(byte);
+                if (byte == 0xFF)
+                        emit(0x00);
+                if (c & 0x7F800) {
+                        byte = (c >> 11) & 0xFF;
+                        emit(byte);
+                        if (byte == 0xFF)
+                                emit(0x00);
+                }
+        }
+}
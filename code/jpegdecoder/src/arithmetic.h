@@ -0,0 +1,109 @@
+#ifndef __ARITHMETIC_H
+#define __ARITHMETIC_H
+
+#include <cstddef>
+#include <string>
+
+#define ERROR_ARITHMETICCODE    0x53    // invalid arithmetic coded data (magnitude or spectral overflow)
+
+/*!
+ * Conditioning of the statistical model (DAC segment), one entry per table:
+ * the DC bounds L and U of the difference categories and the AC index K which
+ * splits the statistics of the magnitude categories (T.81 F.1.4.4).
+ */
+struct ArithmeticConditioning
+{
+        unsigned char dcL[4];
+        unsigned char dcU[4];
+        unsigned char acK[4];
+
+        ArithmeticConditioning() { reset(); }
+        // the default values 0, 1 and 5
+        void reset();
+};
+
+/*!
+ * QM-coder decoder of sequential arithmetic coded scans (SOF9, T.81 Annex D and
+ * F.2.4). The adaptive statistics are kept per table: 64 DC and 256 AC bins of
+ * one byte each, bit 7 is the sense of the more probable symbol and the lower
+ * bits index the probability estimation state machine (Table D.2).
+ *
+ * The decoder reads the entropy coded bytes itself, a marker inside the data is
+ * legal and is followed by zero bits until the scan is complete.
+ */
+class ArithmeticDecoder
+{
+private:
+        const unsigned char* data;
+        size_t length;
+        size_t position;
+        bool marker;                    // stopped in front of a marker
+
+        unsigned int c;                 // code register
+        unsigned int a;                 // interval size
+        int ct;                         // bits left in c until the next byte is needed
+
+        unsigned char dcStats[4][64];
+        unsigned char acStats[4][256];
+        unsigned char fixedBin;         // fixed probability 0.5 for the AC signs
+        int dcContext[3];
+
+        unsigned char nextByte();
+        inline int decode(unsigned char* state);
+        void reset();
+
+public:
+        ArithmeticConditioning conditioning;
+
+        explicit ArithmeticDecoder();
+
+        // start of the entropy coded data of a scan
+        void start(const unsigned char* data, size_t length);
+        // skips the next RSTn marker and resets the statistics (end of a restart interval)
+        void restart();
+        /*!
+         * One block of component (0..2 in the scan): the DC difference is added to
+         * previousDC, the values are dequantized with the table (zigzag order) and
+         * stored in natural order like the huffman block decoder does.
+         */
+        int decodeBlock(int component, int dcTable, int acTable, const unsigned short* quantization,
+                        int& previousDC, int* values);
+};
+
+/*!
+ * QM-coder encoder (T.81 Annex D.1 and F.1.4), the counterpart of the decoder:
+ * the blocks of a sequential scan are appended to out with zero byte stuffing.
+ */
+class ArithmeticEncoder
+{
+private:
+        std::string& out;
+        unsigned int c;
+        unsigned int a;
+        int ct;
+        int buffer;                     // last byte which may still receive a carry, -1 = none
+        int stacked;                    // 0xFF bytes waiting for a possible carry
+        int zeros;                      // 0x00 bytes which are only written if data follows
+
+        unsigned char dcStats[4][64];
+        unsigned char acStats[4][256];
+        unsigned char fixedBin;
+        int dcContext[3];
+
+        void encode(unsigned char* state, int value);
+        void emit(int byte) { out += (char)byte; }
+        void emitZeros();
+        void release(bool carry);
+
+public:
+        ArithmeticConditioning conditioning;
+
+        explicit ArithmeticEncoder(std::string& out);
+
+        // block in natural order, previousDC as for the decoder
+        void encodeBlock(int component, int dcTable, int acTable, const short* block, int& previousDC);
+        // terminates the code (D.1.8)
+        void flush();
+};
+
+#endif // __ARITHMETIC_H
@@ -8,6 +8,7 @@ using namespace std;
 BitStream::BitStream(char* raw, unsigned int length)
 {
         position = 0;
+        storedPosition = 0;
         this->length = length * 8;
         this->raw = raw;
 }
@@ -84,3 +85,13 @@ unsigned char BitStream::nextByte(bool skip)
         return result;
 }
 
+void BitStream::skipStuffing()
+{
+        // the padding bits in front of a marker may end in a 0xFF byte,
+        // in that case the following 0x00 is just used for bytestuffing
+        if (position % 8 == 0 && position >= 8 && position + 8 < length
+            && raw[position/8] == 0x00 && (unsigned char)raw[position/8 - 1] == 0xFF) {
+                position += 8;
+        }
+}
+
@@ -1,8 +1,6 @@
 #ifndef __BITSTREAM_H
 #define __BITSTREAM_H
 
-#include <stack>
-
 #define BITSTREAM_EOS -1
 
 class BitStream
@@ -13,7 +11,7 @@ private:
         char* raw;      // I don't use unique_ptr here because the source stream (from JpegDecoder object)
                         // is handled by std::string and freeing it twice would
                         // obviously result in a segfault
-        std::stack<unsigned int> storedPositions;
+        unsigned int storedPosition;    // one level is enough for the marker lookahead
 public:
         BitStream(char* raw, unsigned int length);
         ~BitStream();
@@ -23,10 +21,13 @@ public:
         unsigned char nextByte(bool skip);
         bool isEnd() { return length-1 <= position; }
         void moveBack(int bits) { position -= bits; }
-        void remember() { storedPositions.push(position); }
-        void forget() { storedPositions.pop(); }
-        void rewind() { position = storedPositions.top(); forget(); }
+        // bit position in the raw data, including the stuffed bytes
+        unsigned int getPosition() { return position; }
+        void setPosition(unsigned int position) { this->position = position; }
+        void remember() { storedPosition = position; }
+        void rewind() { position = storedPosition; }
         void skipRest() { position += (8-(position%8))%8; }
+        void skipStuffing();
         bool available(unsigned int size) { return (position+size) <= length-1; }
 };
 
@@ -0,0 +1,81 @@
+#ifndef __BITWRITER_H
+#define __BITWRITER_H
+
+#include <string>
+
+/*!
+ * Writes entropy coded data, the counterpart of BitStream: bits are written
+ * msb first and every 0xFF byte is followed by a stuffed 0x00.
+ */
+class BitWriter
+{
+private:
+        std::string& out;
+        unsigned long long buffer;
+        int count;                      // number of bits in buffer
+
+        void emit(unsigned char byte)
+        {
+                out += (char)byte;
+                if (byte == 0xFF)
+                        out += (char)0x00;      // bytestuffing
+        }
+
+        // writes the complete bytes in buffer
+        void drain()
+        {
+                while (count >= 8) {
+                        count -= 8;
+                        emit((unsigned char)(buffer >> count));
+                }
+        }
+
+public:
+        explicit BitWriter(std::string& out) : out(out), buffer(0), count(0) {}
+
+        // writes the lowest n bits of bits (n <= 24)
+        void write(unsigned int bits, int n)
+        {
+                buffer = (buffer << n) | (bits & ((1u << n) - 1));
+                count += n;
+                if (count < 32)
+                        return;
+                count -= 32;
+                unsigned int word = (unsigned int)(buffer >> count);
+                // four bytes at once unless one of them is 0xFF and needs stuffing
+                if (((~word - 0x01010101u) & word & 0x80808080u) == 0) {
+                        char bytes[4] = { (char)(word >> 24), (char)(word >> 16), (char)(word >> 8), (char)word };
+                        out.append(bytes, 4);
+                } else {
+                        for (int shift = 24; shift >= 0; shift -= 8)
+                                emit((unsigned char)(word >> shift));
+                }
+        }
+
+        // the bits which don't fill a byte yet, their number is returned
+        int partial(unsigned int& bits)
+        {
+                drain();
+                bits = (unsigned int)(buffer & ((1u << count) - 1));
+                return count;
+        }
+        // continues a stream which another writer left with a partial byte
+        void resume(unsigned int bits, int count)
+        {
+                buffer = bits;
+                this->count = count;
+        }
+
+        // pads the last byte with 1 bits (or 0 bits, only to reproduce other encoders)
+        void flush(bool ones = true)
+        {
+                drain();
+                if (count > 0) {
+                        write(ones ? 0x7F : 0x00, 8 - count);
+                        drain();
+                }
+                buffer = 0;
+        }
+};
+
+#endif // __BITWRITER_H
@@ -0,0 +1,47 @@
+#ifndef __COEFFICIENTS_H
+#define __COEFFICIENTS_H
+
+#include <vector>
+
+/*!
+ * Quantized DCT coefficients of one color component. The blocks are stored row by
+ * row in natural order (row * 8 + column inside a block), the DC values are absolute
+ * (not predicted). The grid is padded to full MCUs, like in the entropy coded data.
+ */
+struct ComponentCoefficients
+{
+        unsigned char hsf;              // horizontal sampling factor
+        unsigned char vsf;              // vertical sampling factor
+        unsigned char qt;               // number of the quantization table
+        int blocksWide;
+        int blocksHigh;
+        std::vector<short> blocks;      // blocksWide * blocksHigh * 64 values
+
+        short* block(int x, int y) { return &blocks[(y * blocksWide + x) * 64]; }
+        const short* block(int x, int y) const { return &blocks[(y * blocksWide + x) * 64]; }
+};
+
+// the entropy decoded content of a baseline YCbCr JPEG
+struct CoefficientImage
+{
+        int width;
+        int height;
+        ComponentCoefficients components[3];    // Y, Cb, Cr
+        unsigned short qTables[4][64];          // natural order
+        bool hasQTable[4];
+};
+
+/*!
+ * The first coefficients (zigzag order, dequantized) of the luma blocks which cover the
+ * image, e.g. for fingerprints without IDCT. The DC value is 8 times the mean of the
+ * block minus 128.
+ */
+struct LowFrequencyImage
+{
+        int coefficients;               // per block, set by the caller: 1 (DC only) to 64
+        int blocksWide;
+        int blocksHigh;
+        std::vector<int> values;        // blocksWide * blocksHigh * coefficients, row by row
+};
+
+#endif // __COEFFICIENTS_H
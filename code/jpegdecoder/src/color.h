@@ -28,6 +28,19 @@ namespace Color
                 int cbi = cb - 128;
                 return ((yi + 454 * cbi + 128) >> 8); 
         }
+
+        // the other direction, 16 bit fixed point (0.299 * 65536 = 19595, ...)
+        inline int toY(int r, int g, int b) {
+                return (19595 * r + 38470 * g + 7471 * b + 32768) >> 16;
+        }
+
+        inline int toCb(int r, int g, int b) {
+                return ((-11059 * r - 21709 * g + 32768 * b + 32768) >> 16) + 128;
+        }
+
+        inline int toCr(int r, int g, int b) {
+                return ((32768 * r - 27439 * g - 5329 * b + 32768) >> 16) + 128;
+        }
 };
 
 #endif // __COLOR_H
@@ -0,0 +1,464 @@
+#include "convert.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "dct.h"
+#include "jpegdecoder.h"
+#include "jpegencoder.h"
+#include "profiler.h"
+#include "ringbuffer.h"
+using namespace std;
+
+#define WRITE_BUFFER_SIZE       (4 << 20)       // bands larger than that are written with writev
+#define MAX_IOVEC               64
+
+struct ConvertJob
+{
+        string path;
+        string data;
+        bool ok;
+};
+
+// writes the decoded rows as ppm (P6) or raw rgb file
+class FileSink : public RowSink
+{
+private:
+        int fd;
+        bool ppm;
+        int width;
+        vector<char> buffer;
+        size_t used;
+        long long written;
+        bool failed;
+
+        bool writeAll(const char* data, size_t size)
+        {
+                while (size > 0) {
+                        ssize_t n = ::write(fd, data, size);
+                        if (n < 0)
+                                return false;
+                        data += n;
+                        size -= n;
+                }
+                return true;
+        }
+
+        // writes the vectors with one syscall, short writes are finished with plain writes
+        bool writeVectors(const struct iovec* vectors, int count)
+        {
+                ssize_t n = ::writev(fd, vectors, count);
+                if (n < 0)
+                        return false;
+                size_t done = n;
+                size_t total = 0;
+                for (int i = 0; i < count; i++) {
+                        size_t length = vectors[i].iov_len;
+                        total += length;
+                        if (done >= length) {
+                                done -= length;
+                                continue;
+                        }
+                        if (!writeAll((const char*)vectors[i].iov_base + done, length - done))
+                                return false;
+                        done = 0;
+                }
+                written += total;
+                return true;
+        }
+
+        bool flush()
+        {
+                if (used > 0 && !writeAll(&buffer[0], used))
+                        return false;
+                written += used;
+                used = 0;
+                return true;
+        }
+
+public:
+        FileSink(bool ppm) : fd(-1), ppm(ppm), width(0), buffer(WRITE_BUFFER_SIZE), used(0), written(0), failed(false) {}
+        ~FileSink() { close(); }
+
+        bool open(const string& path)
+        {
+                fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                used = 0;
+                failed = false;
+                return fd >= 0;
+        }
+
+        bool close()
+        {
+                bool ok = !failed;
+                if (fd >= 0) {
+                        ok = flush() && ok;
+                        ok = ::close(fd) == 0 && ok;
+                }
+                fd = -1;
+                return ok;
+        }
+
+        long long bytesWritten() { return written; }
+
+        int begin(int width, int height)
+        {
+                this->width = width;
+                if (ppm)
+                        used += snprintf(&buffer[used], buffer.size() - used, "P6\n%d %d\n255\n", width, height);
+                return 0;
+        }
+
+        int band(int y, int rows, const unsigned char* rgb, int stride)
+        {
+                size_t rowSize = (size_t)width * 3;
+                size_t size = rowSize * rows;
+
+                if (used + size <= buffer.size()) {
+                        for (int row = 0; row < rows; row++) {
+                                copy(rgb + row * stride, rgb + row * stride + rowSize, &buffer[used]);
+                                used += rowSize;
+                        }
+                        return 0;
+                }
+
+                // the band doesn't fit anymore: write the buffer and the rows, MAX_IOVEC at a time
+                struct iovec vectors[MAX_IOVEC];
+                int count = 0;
+                if (used > 0) {
+                        vectors[count].iov_base = &buffer[0];
+                        vectors[count++].iov_len = used;
+                }
+                used = 0;
+                for (int row = 0; row < rows; ) {
+                        for (; row < rows && count < MAX_IOVEC; row++) {
+                                vectors[count].iov_base = (void*)(rgb + row * stride);
+                                vectors[count++].iov_len = rowSize;
+                        }
+                        if (!writeVectors(vectors, count)) {
+                                failed = true;
+                                return -1;
+                        }
+                        count = 0;
+                }
+                return 0;
+        }
+};
+
+// decodes without writing anything
+class NullSink : public RowSink
+{
+public:
+        int band(int y, int rows, const unsigned char* rgb, int stride) { return 0; }
+};
+
+static bool isJpeg(const string& name)
+{
+        if (name.size() < 4)
+                return false;
+        string ext = name.substr(name.find_last_of('.') + 1);
+        for (auto& c : ext)
+                c = tolower(c);
+        return ext == "jpg" || ext == "jpeg";
+}
+
+void collectInputs(const string& path, vector<string>& inputs)
+{
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+                cout << "Could not find " << path << endl;
+                return;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+                inputs.push_back(path);
+                return;
+        }
+
+        DIR* dir = opendir(path.c_str());
+        if (dir == nullptr)
+                return;
+        vector<string> entries;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+                if (isJpeg(entry->d_name))
+                        entries.push_back(path + "/" + entry->d_name);
+        }
+        closedir(dir);
+        sort(entries.begin(), entries.end());
+        inputs.insert(inputs.end(), entries.begin(), entries.end());
+}
+
+static bool readFile(const string& path, string& data)
+{
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+                return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+                ::close(fd);
+                return false;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        data.resize(st.st_size);
+        size_t done = 0;
+        while (done < data.size()) {
+                ssize_t n = ::read(fd, &data[done], data.size() - done);
+                if (n <= 0)
+                        break;
+                done += n;
+        }
+        ::close(fd);
+        data.resize(done);
+        return done == (size_t)st.st_size;
+}
+
+// asks the kernel to start reading the file in the background
+static void prefetch(const string& path)
+{
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+                return;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        ::close(fd);
+}
+
+static string outputPath(const string& directory, const string& input, const string& format)
+{
+        string name = input.substr(input.find_last_of('/') + 1);
+        size_t dot = name.find_last_of('.');
+        if (dot != string::npos)
+                name = name.substr(0, dot);
+        return directory + "/" + name + (format == "raw" ? ".rgb" : "." + format);
+}
+
+static void usage()
+{
+        cout << "Usage: ./jpgd convert [-o directory] [-f ppm|raw|jpg] [-q quality] [-i idct] [-l listfile] [-j readahead] [-t threads] [-P] files/directories..." << endl
+             << "        -o      output directory, without it the images are only decoded" << endl
+             << "        -f      output format, ppm (default), raw rgb or jpg (re-encoded while decoding)" << endl
+             << "        -q      jpg quality 1..100 (default 75)" << endl
+             << "        -i      IDCT accuracy: fast (default), accurate or float" << endl
+             << "        -l      file with one input path per line, - for stdin" << endl
+             << "        -j      number of files read ahead (default 8)" << endl
+             << "        -t      decoder threads per image, 0 (default) uses one per core" << endl
+             << "        -P      profile the decoding stages with the hardware performance counters" << endl
+             << "                (per image and in total, one thread per image)" << endl;
+}
+
+int convert(int argc, char** argv)
+{
+        string outputDirectory;
+        string format = "ppm";
+        int quality = 75;
+        int idct = IDCT_FAST;
+        int readahead = 8;
+        int threads = 0;
+        bool profile = false;
+        vector<string> inputs;
+
+        for (int i = 1; i < argc; i++) {
+                string arg = argv[i];
+                if (arg == "-o" && i + 1 < argc) {
+                        outputDirectory = argv[++i];
+                } else if (arg == "-f" && i + 1 < argc) {
+                        format = argv[++i];
+                        if (format != "ppm" && format != "raw" && format != "jpg") {
+                                usage();
+                                return -1;
+                        }
+                } else if (arg == "-i" && i + 1 < argc) {
+                        string mode = argv[++i];
+                        idct = mode == "accurate" ? IDCT_ACCURATE : (mode == "float" ? IDCT_FLOAT : IDCT_FAST);
+                } else if (arg == "-q" && i + 1 < argc) {
+                        quality = atoi(argv[++i]);
+                } else if (arg == "-l" && i + 1 < argc) {
+                        string list = argv[++i];
+                        ifstream file;
+                        istream& in = list == "-" ? cin : (file.open(list.c_str()), file);
+                        if (!in) {
+                                cout << "Could not read " << list << endl;
+                                return -1;
+                        }
+                        string line;
+                        while (getline(in, line)) {
+                                if (!line.empty())
+                                        inputs.push_back(line);
+                        }
+                } else if (arg == "-j" && i + 1 < argc) {
+                        readahead = max(1, atoi(argv[++i]));
+                } else if (arg == "-t" && i + 1 < argc) {
+                        threads = max(0, atoi(argv[++i]));
+                } else if (arg == "-P") {
+                        profile = true;
+                } else if (arg[0] == '-') {
+                        usage();
+                        return -1;
+                } else {
+                        collectInputs(arg, inputs);
+                }
+        }
+
+        if (inputs.empty()) {
+                usage();
+                return -1;
+        }
+        if (!outputDirectory.empty()) {
+                mkdir(outputDirectory.c_str(), 0755);
+        }
+
+        auto start = chrono::steady_clock::now();
+
+        // the reader thread keeps up to readahead files in memory
+        RingBuffer<ConvertJob*> jobs(readahead);
+        atomic<bool> stop(false);
+        thread reader([&]() {
+                size_t advised = 0;
+                for (size_t i = 0; i < inputs.size() && !stop.load(); i++) {
+                        for (; advised < inputs.size() && advised <= i + readahead; advised++)
+                                prefetch(inputs[advised]);
+
+                        ConvertJob* job = new ConvertJob();
+                        job->path = inputs[i];
+                        job->ok = readFile(job->path, job->data);
+                        while (!jobs.push(job)) {
+                                if (stop.load()) {
+                                        delete job;
+                                        return;
+                                }
+                                this_thread::yield();
+                        }
+                }
+        });
+
+        long long bytesRead = 0;
+        long long bytesWritten = 0;
+        double megapixels = 0;
+        int failed = 0;
+        FileSink fileSink(format == "ppm");
+        NullSink nullSink;
+        JpegEncoder encoder;
+        encoder.setQuality(quality);
+        string encoded;
+        unique_ptr<StageProfiler> profiler;
+        Profile total;
+        if (profile) {
+                profiler.reset(new StageProfiler());
+                if (!profiler->getError().empty())
+                        cout << "Profiling: " << profiler->getError() << endl;
+        }
+
+        for (size_t i = 0; i < inputs.size(); i++) {
+                ConvertJob* job;
+                while (!jobs.pop(job)) {
+                        // waiting for the disk, don't take the cpu away from the reader
+                        this_thread::sleep_for(chrono::microseconds(50));
+                }
+
+                if (!job->ok) {
+                        cout << job->path << ": could not read file" << endl;
+                        failed++;
+                        delete job;
+                        continue;
+                }
+                bytesRead += job->data.size();
+
+                JpegDecoder decoder;
+                decoder.setThreads(threads);
+                decoder.setIDCT(idct);
+                decoder.setProfiler(profiler.get());
+                decoder.setData(std::move(job->data));
+                if (profiler)
+                        profiler->reset();
+
+                int errcode = 0;
+                if (outputDirectory.empty()) {
+                        decoder.setSink(&nullSink);
+                        errcode = decoder.decode();
+                } else if (format == "jpg") {
+                        string output = outputPath(outputDirectory, job->path, format);
+                        encoded.clear();
+                        encoder.setOutput(&encoded);
+                        decoder.setSink(&encoder);
+                        errcode = decoder.decode();
+                        if (errcode == 0)
+                                errcode = encoder.getError();
+                        if (errcode == 0) {
+                                ofstream file(output.c_str(), ios::binary);
+                                file.write(encoded.data(), encoded.size());
+                                if (!file) {
+                                        cout << output << ": could not write file" << endl;
+                                        failed++;
+                                        delete job;
+                                        continue;
+                                }
+                                bytesWritten += encoded.size();
+                        }
+                } else {
+                        string output = outputPath(outputDirectory, job->path, format);
+                        if (!fileSink.open(output)) {
+                                cout << output << ": could not create file" << endl;
+                                failed++;
+                                delete job;
+                                continue;
+                        }
+                        long long before = fileSink.bytesWritten();
+                        decoder.setSink(&fileSink);
+                        errcode = decoder.decode();
+                        bool written = fileSink.close();
+                        bytesWritten += fileSink.bytesWritten() - before;
+                        if (errcode != 0 || !written) {
+                                unlink(output.c_str());
+                                if (errcode == 0) {
+                                        cout << output << ": could not write file" << endl;
+                                        failed++;
+                                        delete job;
+                                        continue;
+                                }
+                        }
+                }
+
+                if (errcode != 0) {
+                        cout << job->path << ": error code " << errcode << endl;
+                        failed++;
+                } else {
+                        megapixels += (double)decoder.getWidth() * decoder.getHeight() / 1e6;
+                }
+                if (profiler) {
+                        cout << job->path << " (" << decoder.getWidth() << "x" << decoder.getHeight() << "):" << endl;
+                        profiler->print(cout, profiler->getProfile());
+                        total.add(profiler->getProfile());
+                }
+                delete job;
+        }
+
+        stop.store(true);
+        reader.join();
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        int converted = (int)inputs.size() - failed;
+        cout << "Converted " << converted << " of " << inputs.size() << " images in " << seconds << "s: "
+             << converted / seconds << " images/s, "
+             << bytesRead / 1e6 / seconds << " MB/s read, "
+             << bytesWritten / 1e6 / seconds << " MB/s written, "
+             << megapixels / seconds << " MP/s" << endl;
+        if (profiler) {
+                cout << "All images:" << endl;
+                profiler->print(cout, total);
+        }
+
+        return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+#ifndef __CONVERT_H
+#define __CONVERT_H
+
+#include <string>
+#include <vector>
+
+/*!
+ * Headless batch conversion: ./jpgd convert [options] files/directories...
+ *
+ * The input files are read ahead by a separate thread (with posix_fadvise
+ * readahead hints for the following files) while the current one is decoded,
+ * the decoded rows are streamed into the output file through large buffered
+ * or vectored writes. argv[0] is "convert".
+ */
+int convert(int argc, char** argv);
+
+// adds the file or the JPEG files of the directory (sorted by name) to inputs
+void collectInputs(const std::string& path, std::vector<std::string>& inputs);
+
+#endif // __CONVERT_H
@@ -0,0 +1,66 @@
+#ifndef __DAEMONPROTOCOL_H
+#define __DAEMONPROTOCOL_H
+
+#include <string>
+
+#define ERROR_DAEMONSOCKET      0xD0    // the socket couldn't be created, bound or connected
+#define ERROR_DAEMONPROTOCOL    0xD1    // malformed message or the connection was closed
+#define ERROR_SHAREDMEMORY      0xD2    // the memfd for the pixels couldn't be created or mapped
+#define ERROR_REGION            0xD3    // the region isn't inside the (scaled) image
+#define ERROR_DAEMONREAD        0xD4    // the daemon couldn't read the file
+
+#define DAEMON_VERSION          2
+#define DAEMON_SOCKET           "jpgd.sock"     // file name of the default socket, see defaultDaemonSocket
+#define DAEMON_MAXMESSAGE       8192    // request including the path
+
+#define DAEMON_ORIENT           0x01    // request flag: apply the EXIF orientation (JpegDecoder::setAutoOrient)
+
+/*!
+ * Messages between DecodeClient and DecodeServer on a SOCK_SEQPACKET unix socket,
+ * one message per request and response, in native byte order (both ends are on the
+ * same machine).
+ *
+ * A request names the JPEG either by its absolute path (appended to the header,
+ * without terminating zero, relative paths are rejected with ERROR_DAEMONPROTOCOL) or, with pathLength 0, by an open file descriptor passed along
+ * with SCM_RIGHTS. The response of a successful decode carries a sealed memfd with
+ * the pixels (stride * height bytes, rows from the top), the client maps it and
+ * nothing is copied. A client may send several requests before reading the
+ * responses, they are decoded concurrently and answered in the order they finish.
+ */
+struct DaemonRequest
+{
+        unsigned int version;           // DAEMON_VERSION
+        unsigned int id;                // returned in the response
+        int format;                     // PixelFormat of rowsink.h
+        int scale;                      // 1, 2, 4 or 8, see JpegDecoder::setScale
+        int flags;                      // DAEMON_ORIENT
+        int x;                          // region of the scaled (and oriented) image, width 0 = the whole image
+        int y;
+        int width;
+        int height;
+        unsigned int pathLength;
+};
+
+struct DaemonResponse
+{
+        unsigned int id;
+        int error;                      // 0 or the error code of the decoder / daemon
+        int width;                      // size of the returned pixels (the region)
+        int height;
+        int stride;                     // in bytes
+        int format;
+        unsigned long long size;        // of the memfd
+};
+
+/*!
+ * The default socket: DAEMON_SOCKET in $XDG_RUNTIME_DIR or, without it, in /tmp/jpgd-<uid>.
+ * The directory has to belong to the user and must not be accessible by others, so nobody
+ * else can connect or put a socket of their own there. With create the one in /tmp is
+ * made if it doesn't exist. Returns 0 or ERROR_DAEMONSOCKET.
+ */
+int defaultDaemonSocket(std::string& path, bool create);
+
+// true if the process at the other end of the connected unix socket runs as the same user
+bool samePeerUser(int socket);
+
+#endif // __DAEMONPROTOCOL_H
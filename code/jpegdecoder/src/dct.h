@@ -14,44 +14,17 @@ using namespace std;
 #define W7  565
 #define CLIP(x) ((x < 0) ? 0 : ((x > 0xFF) ? 0xFF : x));
 
+// accuracy of the inverse DCT, see bench/conformance.cpp for the errors of each mode
+enum IDCTMode
+{
+        IDCT_FAST,                      // fastTransform, 11 bit fixed point (default)
+        IDCT_ACCURATE,                  // accurateTransform, islow algorithm of the IJG libjpeg
+        IDCT_FLOAT                      // floatTransform, separable float matrix multiplication
+};
+
 class DCT
 {
 public:
-        // 2d dct for 8x8 matrix in form of an array with 64 values
-        // DCT is a lot slower than the FDCT, this method has just been used to validating the FDCT algorithm
-        /*static inline void transform(float* values)
-        {
-                float* result = new float[64];
-                int x,y;
-                for(int i = 0; i < 64; i++) {
-                        x = i % 8;
-                        y = i / 8;
-
-                        float sum = 0;
-                        float cm = 1.0 / sqrt(2);
-                        float cn = cm;
-                        for (int m = 0; m < 8; m++) {
-                                if (m != 0)
-                                        cm = 1;
-                                for (int n = 0; n < 8; n++)
-                                {
-                                        if (n != 0)
-                                                cn = 1;
-                                        sum += values[n*8+m]*cm*cn*cos((2.0*x+1.0)*m*M_PI/16.0)*cos((2.0*y+1.0)*n*M_PI/16.0);
-                                }
-                                cn = 1 / sqrt(2);
-                        }
-                        result[i] = sum / 4.0;
-                }
-
-                for(int i = 0; i < 64; i++)
-                {
-                        values[i] = round(result[i]) + 128;
-                }
-
-                delete result;
-        }*/
-
         // FDCT based on ujpeg.c
         static inline void rowTransform(int* values)
         {
@@ -156,10 +129,263 @@ public:
                 result[56 + column] = CLIP(((x7 - x1) >> 14) + 128);
         }
 
+        /*!
+         * Forward DCT of the columns (islow algorithm of the IJG libjpeg, jfdctint.c). All 8
+         * columns are computed by the same straight line code on contiguous rows, so the
+         * compiler can keep the 8 lanes in vector registers. The first pass keeps 2 fraction
+         * bits, after the second one the results are scaled up by 8.
+         */
+        template<bool FIRST_PASS>
+        static inline void forwardColumns(int* v)
+        {
+                const int descale = FIRST_PASS ? 13 - 2 : 13 + 2;
+                const int round = 1 << (descale - 1);
+
+                for (int c = 0; c < 8; c++) {
+                        int tmp0 = v[c] + v[56 + c];
+                        int tmp7 = v[c] - v[56 + c];
+                        int tmp1 = v[8 + c] + v[48 + c];
+                        int tmp6 = v[8 + c] - v[48 + c];
+                        int tmp2 = v[16 + c] + v[40 + c];
+                        int tmp5 = v[16 + c] - v[40 + c];
+                        int tmp3 = v[24 + c] + v[32 + c];
+                        int tmp4 = v[24 + c] - v[32 + c];
+
+                        // even part
+                        int tmp10 = tmp0 + tmp3;
+                        int tmp13 = tmp0 - tmp3;
+                        int tmp11 = tmp1 + tmp2;
+                        int tmp12 = tmp1 - tmp2;
+                        if (FIRST_PASS) {
+                                v[c] = (tmp10 + tmp11) << 2;
+                                v[32 + c] = (tmp10 - tmp11) << 2;
+                        } else {
+                                v[c] = (tmp10 + tmp11 + 2) >> 2;
+                                v[32 + c] = (tmp10 - tmp11 + 2) >> 2;
+                        }
+                        int z1 = (tmp12 + tmp13) * 4433;
+                        v[16 + c] = (z1 + tmp13 * 6270 + round) >> descale;
+                        v[48 + c] = (z1 - tmp12 * 15137 + round) >> descale;
+
+                        // odd part
+                        z1 = tmp4 + tmp7;
+                        int z2 = tmp5 + tmp6;
+                        int z3 = tmp4 + tmp6;
+                        int z4 = tmp5 + tmp7;
+                        int z5 = (z3 + z4) * 9633;
+                        tmp4 *= 2446;
+                        tmp5 *= 16819;
+                        tmp6 *= 25172;
+                        tmp7 *= 12299;
+                        z1 *= -7373;
+                        z2 *= -20995;
+                        z3 = z3 * -16069 + z5;
+                        z4 = z4 * -3196 + z5;
+                        v[56 + c] = (tmp4 + z1 + z3 + round) >> descale;
+                        v[40 + c] = (tmp5 + z2 + z4 + round) >> descale;
+                        v[24 + c] = (tmp6 + z2 + z3 + round) >> descale;
+                        v[8 + c] = (tmp7 + z1 + z4 + round) >> descale;
+                }
+        }
+
+        static inline void transpose(int* values)
+        {
+                for (int y = 0; y < 8; y++) {
+                        for (int x = y + 1; x < 8; x++) {
+                                int t = values[y * 8 + x];
+                                values[y * 8 + x] = values[x * 8 + y];
+                                values[x * 8 + y] = t;
+                        }
+                }
+        }
+
+        // forward 2d DCT of level shifted samples (-128..127), same layout as fastTransform,
+        // the coefficients are 8 times larger than the ones fastTransform expects
+        static inline void forwardTransform(int* values)
+        {
+                forwardColumns<true>(values);
+                transpose(values);
+                forwardColumns<false>(values);
+                transpose(values);
+        }
+
+        /*!
+         * Inverse DCT of the columns, islow algorithm of the IJG libjpeg (jidctint.c): 13 bit
+         * constants, 2 additional fraction bits between the passes. Like forwardColumns all
+         * 8 columns run through the same code.
+         */
+        template<bool FIRST_PASS>
+        static inline void inverseColumns(int* v)
+        {
+                const int descale = FIRST_PASS ? 13 - 2 : 13 + 2 + 3;
+                const int round = 1 << (descale - 1);
+
+                for (int c = 0; c < 8; c++) {
+                        // even part
+                        int z2 = v[16 + c];
+                        int z3 = v[48 + c];
+                        int z1 = (z2 + z3) * 4433;
+                        int tmp2 = z1 - z3 * 15137;
+                        int tmp3 = z1 + z2 * 6270;
+                        int tmp0 = (v[c] + v[32 + c]) << 13;
+                        int tmp1 = (v[c] - v[32 + c]) << 13;
+                        int tmp10 = tmp0 + tmp3;
+                        int tmp13 = tmp0 - tmp3;
+                        int tmp11 = tmp1 + tmp2;
+                        int tmp12 = tmp1 - tmp2;
+
+                        // odd part
+                        tmp0 = v[56 + c];
+                        tmp1 = v[40 + c];
+                        tmp2 = v[24 + c];
+                        tmp3 = v[8 + c];
+                        z1 = tmp0 + tmp3;
+                        z2 = tmp1 + tmp2;
+                        z3 = tmp0 + tmp2;
+                        int z4 = tmp1 + tmp3;
+                        int z5 = (z3 + z4) * 9633;
+                        tmp0 *= 2446;
+                        tmp1 *= 16819;
+                        tmp2 *= 25172;
+                        tmp3 *= 12299;
+                        z1 *= -7373;
+                        z2 *= -20995;
+                        z3 = z3 * -16069 + z5;
+                        z4 = z4 * -3196 + z5;
+                        tmp0 += z1 + z3;
+                        tmp1 += z2 + z4;
+                        tmp2 += z2 + z3;
+                        tmp3 += z1 + z4;
+
+                        v[c] = (tmp10 + tmp3 + round) >> descale;
+                        v[56 + c] = (tmp10 - tmp3 + round) >> descale;
+                        v[8 + c] = (tmp11 + tmp2 + round) >> descale;
+                        v[48 + c] = (tmp11 - tmp2 + round) >> descale;
+                        v[16 + c] = (tmp12 + tmp1 + round) >> descale;
+                        v[40 + c] = (tmp12 - tmp1 + round) >> descale;
+                        v[24 + c] = (tmp13 + tmp0 + round) >> descale;
+                        v[32 + c] = (tmp13 - tmp0 + round) >> descale;
+                }
+        }
+
+        // same result as fastTransform (level shifted and clipped), more accurate
+        static inline void accurateTransform(int* values)
+        {
+                inverseColumns<true>(values);
+                transpose(values);
+                inverseColumns<false>(values);
+                transpose(values);
+                for (int i = 0; i < 64; i++) {
+                        int value = values[i] + 128;
+                        values[i] = CLIP(value);
+                }
+        }
+
+        // cos((2x + 1) * u * pi / 16) * C(u) / 2, [u][x]
+        struct FloatBasis
+        {
+                float values[64];
+
+                FloatBasis()
+                {
+                        for (int u = 0; u < 8; u++) {
+                                for (int x = 0; x < 8; x++)
+                                        values[u * 8 + x] = (float)((u == 0 ? sqrt(0.5) : 1.0) / 2.0 * cos((2 * x + 1) * u * M_PI / 16.0));
+                        }
+                }
+        };
+
+        // the definition of the IDCT in float, the most accurate mode
+        static inline void floatTransform(int* values)
+        {
+                static const FloatBasis bases;          // thread safe initialization
+                const float* basis = bases.values;
+                float tmp[64];
+
+                // columns: tmp[y][u] = sum over v
+                for (int y = 0; y < 8; y++) {
+                        for (int u = 0; u < 8; u++) {
+                                float sum = 0;
+                                for (int v = 0; v < 8; v++)
+                                        sum += basis[v * 8 + y] * values[v * 8 + u];
+                                tmp[y * 8 + u] = sum;
+                        }
+                }
+                for (int y = 0; y < 8; y++) {
+                        for (int x = 0; x < 8; x++) {
+                                float sum = 0;
+                                for (int u = 0; u < 8; u++)
+                                        sum += basis[u * 8 + x] * tmp[y * 8 + u];
+                                int value = (int)lrintf(sum) + 128;
+                                values[y * 8 + x] = CLIP(value);
+                        }
+                }
+        }
+
+        // c(u) * sqrt(n / 8) * cos((2x + 1) * u * pi / 2n) with c(0) = sqrt(1 / n), c(u) = sqrt(2 / n)
+        // for n = 1, 2 and 4, [u][x]
+        struct ScaledBasis
+        {
+                float values[3][16];
+
+                ScaledBasis()
+                {
+                        for (int i = 0; i < 3; i++) {
+                                int n = 1 << i;
+                                for (int u = 0; u < n; u++) {
+                                        double c = u == 0 ? sqrt(1.0 / n) : sqrt(2.0 / n);
+                                        for (int x = 0; x < n; x++)
+                                                values[i][u * n + x] = (float)(c * sqrt(n / 8.0) * cos((2 * x + 1) * u * M_PI / (2.0 * n)));
+                                }
+                        }
+                }
+        };
+
+        /*!
+         * Reduced IDCT (like libjpeg's scaled decoding): the lowest size x size frequencies
+         * of a block are transformed with a size point IDCT, which gives the block at
+         * 1/(8/size) of its resolution (size = 1, 2 or 4, 1 is the DC value). The samples
+         * are level shifted, clipped and stored as values[y * size + x].
+         */
+        static inline void scaledInverse(int* values, int size)
+        {
+                static const ScaledBasis bases;         // thread safe initialization
+                const float* basis = bases.values[size == 1 ? 0 : (size == 2 ? 1 : 2)];
+                float tmp[16];
+
+                for (int y = 0; y < size; y++) {
+                        for (int u = 0; u < size; u++) {
+                                float sum = 0;
+                                for (int v = 0; v < size; v++)
+                                        sum += basis[v * size + y] * values[v * 8 + u];
+                                tmp[y * size + u] = sum;
+                        }
+                }
+                for (int y = 0; y < size; y++) {
+                        for (int x = 0; x < size; x++) {
+                                float sum = 0;
+                                for (int u = 0; u < size; u++)
+                                        sum += basis[u * size + x] * tmp[y * size + u];
+                                int value = (int)lrintf(sum) + 128;
+                                values[y * size + x] = CLIP(value);
+                        }
+                }
+        }
+
+        static inline void inverse(IDCTMode mode, int* values)
+        {
+                if (mode == IDCT_FAST)
+                        fastTransform(values);
+                else if (mode == IDCT_ACCURATE)
+                        accurateTransform(values);
+                else
+                        floatTransform(values);
+        }
+
         // same operation, but uses the FDCT algorithm
         static inline void fastTransform(int* values)
         {
-                static int tmp[64];
+                int tmp[64];    // no static buffer, the IDCT runs on multiple threads
 
                 for (int row = 0; row < 64; row += 8) {
                         rowTransform(&values[row]);
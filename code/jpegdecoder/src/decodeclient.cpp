@@ -0,0 +1,198 @@
+#include "decodeclient.h"
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+using namespace std;
+
+int defaultDaemonSocket(string& path, bool create)
+{
+        const char* runtime = getenv("XDG_RUNTIME_DIR");
+        string directory = runtime != nullptr && runtime[0] == '/' ? string(runtime) : "/tmp/jpgd-" + to_string(geteuid());
+        if (create && mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST)
+                return ERROR_DAEMONSOCKET;
+        struct stat st;
+        if (lstat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077) != 0)
+                return ERROR_DAEMONSOCKET;
+        path = directory + "/" DAEMON_SOCKET;
+        return 0;
+}
+
+bool samePeerUser(int socket)
+{
+        struct ucred credentials;
+        socklen_t size = sizeof(credentials);
+        return getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0 && credentials.uid == geteuid();
+}
+
+void DecodedImage::release()
+{
+        if (mapping != nullptr)
+                munmap(mapping, size);
+        mapping = nullptr;
+        size = 0;
+}
+
+int DecodeClient::connect(const string& socketPath)
+{
+        close();
+        string path = socketPath;
+        if (path.empty() && defaultDaemonSocket(path, false) != 0)
+                return ERROR_DAEMONSOCKET;
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+                return ERROR_DAEMONSOCKET;
+        strcpy(address.sun_path, path.c_str());
+
+        socket = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (socket < 0)
+                return ERROR_DAEMONSOCKET;
+        // a socket somebody else put there isn't the daemon of this user
+        if (::connect(socket, (struct sockaddr*)&address, sizeof(address)) != 0 || !samePeerUser(socket)) {
+                close();
+                return ERROR_DAEMONSOCKET;
+        }
+        return 0;
+}
+
+void DecodeClient::close()
+{
+        if (socket >= 0)
+                ::close(socket);
+        socket = -1;
+}
+
+int DecodeClient::send(const DaemonRequest& request, const string& path, int file)
+{
+        if (socket < 0)
+                return ERROR_DAEMONSOCKET;
+        if (sizeof(request) + path.size() > DAEMON_MAXMESSAGE)
+                return ERROR_DAEMONREAD;
+
+        struct iovec vectors[2] = { { (void*)&request, sizeof(request) }, { (void*)path.data(), path.size() } };
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = vectors;
+        header.msg_iovlen = 2;
+        char control[CMSG_SPACE(sizeof(int))];
+        if (file >= 0) {
+                memset(control, 0, sizeof(control));
+                header.msg_control = control;
+                header.msg_controllen = sizeof(control);
+                struct cmsghdr* data = CMSG_FIRSTHDR(&header);
+                data->cmsg_level = SOL_SOCKET;
+                data->cmsg_type = SCM_RIGHTS;
+                data->cmsg_len = CMSG_LEN(sizeof(int));
+                memcpy(CMSG_DATA(data), &file, sizeof(int));
+        }
+        ssize_t sent;
+        while ((sent = sendmsg(socket, &header, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+        return sent == (ssize_t)(sizeof(request) + path.size()) ? 0 : ERROR_DAEMONPROTOCOL;
+}
+
+static DaemonRequest makeRequest(const DecodeOptions& options, unsigned int id, size_t pathLength)
+{
+        DaemonRequest request;
+        memset(&request, 0, sizeof(request));
+        request.version = DAEMON_VERSION;
+        request.id = id;
+        request.format = options.format;
+        request.scale = options.scale;
+        request.flags = options.orient ? DAEMON_ORIENT : 0;
+        request.x = options.x;
+        request.y = options.y;
+        request.width = options.width;
+        request.height = options.height;
+        request.pathLength = pathLength;
+        return request;
+}
+
+int DecodeClient::submit(const string& path, const DecodeOptions& options, unsigned int& id)
+{
+        // the daemon runs in a different working directory
+        char absolute[PATH_MAX];
+        if (path.empty() || realpath(path.c_str(), absolute) == nullptr)
+                return ERROR_DAEMONREAD;
+        id = nextId++;
+        string resolved = absolute;
+        return send(makeRequest(options, id, resolved.size()), resolved, -1);
+}
+
+int DecodeClient::submit(int file, const DecodeOptions& options, unsigned int& id)
+{
+        if (file < 0)
+                return ERROR_DAEMONREAD;
+        id = nextId++;
+        return send(makeRequest(options, id, 0), string(), file);
+}
+
+int DecodeClient::receive(DecodedImage& image)
+{
+        image.release();
+        if (socket < 0)
+                return image.error = ERROR_DAEMONSOCKET;
+
+        DaemonResponse response;
+        char control[CMSG_SPACE(sizeof(int))];
+        struct iovec vector = { &response, sizeof(response) };
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = &vector;
+        header.msg_iovlen = 1;
+        header.msg_control = control;
+        header.msg_controllen = sizeof(control);
+        ssize_t size;
+        while ((size = recvmsg(socket, &header, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+
+        int memory = -1;
+        for (struct cmsghdr* data = CMSG_FIRSTHDR(&header); data != nullptr; data = CMSG_NXTHDR(&header, data)) {
+                if (data->cmsg_level == SOL_SOCKET && data->cmsg_type == SCM_RIGHTS)
+                        memcpy(&memory, CMSG_DATA(data), sizeof(int));
+        }
+        if (size != (ssize_t)sizeof(response)) {
+                if (memory >= 0)
+                        ::close(memory);
+                return image.error = ERROR_DAEMONPROTOCOL;
+        }
+
+        image.id = response.id;
+        image.error = response.error;
+        image.width = response.width;
+        image.height = response.height;
+        image.stride = response.stride;
+        image.format = (PixelFormat)response.format;
+        if (response.error == 0) {
+                void* mapping = memory >= 0 ? mmap(nullptr, response.size, PROT_READ, MAP_SHARED, memory, 0) : MAP_FAILED;
+                if (mapping == MAP_FAILED) {
+                        image.error = ERROR_SHAREDMEMORY;
+                } else {
+                        image.mapping = (unsigned char*)mapping;
+                        image.size = response.size;
+                }
+        }
+        // the mapping keeps the memory alive
+        if (memory >= 0)
+                ::close(memory);
+        return image.error;
+}
+
+int DecodeClient::decode(const string& path, const DecodeOptions& options, DecodedImage& image)
+{
+        unsigned int id;
+        int errcode = submit(path, options, id);
+        return errcode != 0 ? (image.error = errcode) : receive(image);
+}
+
+int DecodeClient::decode(int file, const DecodeOptions& options, DecodedImage& image)
+{
+        unsigned int id;
+        int errcode = submit(file, options, id);
+        return errcode != 0 ? (image.error = errcode) : receive(image);
+}
@@ -0,0 +1,88 @@
+#ifndef __DECODECLIENT_H
+#define __DECODECLIENT_H
+
+#include <cstddef>
+#include <string>
+
+#include "daemonprotocol.h"
+#include "rowsink.h"
+
+struct DecodeOptions
+{
+        PixelFormat format;
+        int scale;                      // 1, 2, 4 or 8
+        bool orient;                    // rotate / mirror the image according to its EXIF orientation
+        int x;                          // region of the scaled (and oriented) image, width 0 = the whole image
+        int y;
+        int width;
+        int height;
+
+        DecodeOptions() : format(PIXEL_RGB), scale(1), orient(false), x(0), y(0), width(0), height(0) {}
+};
+
+// pixels decoded by the daemon, a read only mapping of its memfd until release()
+class DecodedImage
+{
+private:
+        unsigned char* mapping;
+        size_t size;
+
+        DecodedImage(const DecodedImage&);
+        DecodedImage& operator=(const DecodedImage&);
+
+        friend class DecodeClient;
+
+public:
+        unsigned int id;                // of the request
+        int error;
+        int width;
+        int height;
+        int stride;                     // in bytes
+        PixelFormat format;
+
+        DecodedImage() : mapping(nullptr), size(0), id(0), error(0), width(0), height(0), stride(0), format(PIXEL_RGB) {}
+        ~DecodedImage() { release(); }
+
+        const unsigned char* pixels() const { return mapping; }
+        void release();
+};
+
+/*!
+ * Connection to the decode daemon (decodeserver.h). One client must not be used by
+ * several threads at once, every thread opens its own connection.
+ *
+ * decode() waits for the image. With submit() several requests can be sent first,
+ * receive() then returns the responses in the order the daemon finishes them, the id
+ * tells them apart.
+ */
+class DecodeClient
+{
+private:
+        int socket;
+        unsigned int nextId;
+
+        int send(const DaemonRequest& request, const std::string& path, int file);
+
+        DecodeClient(const DecodeClient&);
+        DecodeClient& operator=(const DecodeClient&);
+
+public:
+        DecodeClient() : socket(-1), nextId(0) {}
+        ~DecodeClient() { close(); }
+
+        // an empty path connects to defaultDaemonSocket, the daemon has to run as the same user
+        int connect(const std::string& path = std::string());
+        void close();
+
+        // the daemon opens the file itself, a relative path is made absolute first
+        int submit(const std::string& path, const DecodeOptions& options, unsigned int& id);
+        // the descriptor is passed to the daemon, file stays open in the caller
+        int submit(int file, const DecodeOptions& options, unsigned int& id);
+        // waits for the next response, returns image.error
+        int receive(DecodedImage& image);
+
+        int decode(const std::string& path, const DecodeOptions& options, DecodedImage& image);
+        int decode(int file, const DecodeOptions& options, DecodedImage& image);
+};
+
+#endif // __DECODECLIENT_H
@@ -0,0 +1,439 @@
+#include "decodeserver.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "allocator.h"
+#include "jpegdecoder.h"
+using namespace std;
+
+#define REGION_COMPLETE         0x7FFF          // returned by the sink once the region has been stored
+#define WORKER_BUFFERS          (64ul << 20)    // buffers kept by each worker for the next image
+
+struct DecodeServer::Connection
+{
+        int socket;
+        std::mutex sending;
+
+        explicit Connection(int socket) : socket(socket) {}
+        ~Connection() { close(socket); }
+};
+
+struct DecodeServer::Job
+{
+        shared_ptr<Connection> connection;
+        DaemonRequest request;
+        string path;
+        int file;                       // passed file descriptor, -1 if the path is used
+};
+
+// stores the decoded rows (or the region of them) in the shared memory
+class SharedSink : public RowSink
+{
+private:
+        unsigned char* pixels;
+        int stride;
+        PixelFormat pixelFormat;
+        int x, y, width, height;
+        bool whole;                     // the decoder writes straight into the pixels
+
+public:
+        SharedSink(unsigned char* pixels, int stride, PixelFormat pixelFormat, int x, int y, int width, int height, bool whole)
+                : pixels(pixels), stride(stride), pixelFormat(pixelFormat), x(x), y(y), width(width), height(height),
+                  whole(whole) {}
+
+        PixelFormat format() { return pixelFormat; }
+        unsigned char* target(int row, int& rowStride) {
+                if (!whole)
+                        return nullptr;
+                rowStride = stride;
+                return pixels + (size_t)row * stride;
+        }
+        unsigned char* image(int& rowStride) {
+                rowStride = stride;
+                return whole ? pixels : nullptr;
+        }
+        int band(int row, int rows, const unsigned char* rgb, int rgbStride) {
+                if (whole)
+                        return 0;
+                int size = pixelSize(pixelFormat);
+                for (int r = max(row, y); r < min(row + rows, y + height); r++)
+                        memcpy(pixels + (size_t)(r - y) * stride, rgb + (size_t)(r - row) * rgbStride + x * size, width * size);
+                // nothing below the region is needed
+                return row + rows >= y + height ? REGION_COMPLETE : 0;
+        }
+};
+
+static bool readDescriptor(int file, string& data)
+{
+        struct stat st;
+        if (fstat(file, &st) != 0 || !S_ISREG(st.st_mode))
+                return false;
+        data.resize(st.st_size);
+        size_t done = 0;
+        while (done < data.size()) {
+                ssize_t bytes = pread(file, &data[done], data.size() - done, done);
+                if (bytes < 0 && errno == EINTR)
+                        continue;
+                if (bytes <= 0)
+                        return false;
+                done += bytes;
+        }
+        return true;
+}
+
+// the message and, if file isn't -1, the file descriptor
+static bool sendMessage(int socket, const void* message, size_t size, int file)
+{
+        struct iovec vector = { (void*)message, size };
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = &vector;
+        header.msg_iovlen = 1;
+        char control[CMSG_SPACE(sizeof(int))];
+        if (file >= 0) {
+                memset(control, 0, sizeof(control));
+                header.msg_control = control;
+                header.msg_controllen = sizeof(control);
+                struct cmsghdr* data = CMSG_FIRSTHDR(&header);
+                data->cmsg_level = SOL_SOCKET;
+                data->cmsg_type = SCM_RIGHTS;
+                data->cmsg_len = CMSG_LEN(sizeof(int));
+                memcpy(CMSG_DATA(data), &file, sizeof(int));
+        }
+        ssize_t sent;
+        while ((sent = sendmsg(socket, &header, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+        return sent == (ssize_t)size;
+}
+
+DecodeServer::DecodeServer(int threads)
+        : threads(threads), listener(-1), stopped(false)
+{
+        wake[0] = wake[1] = -1;
+}
+
+DecodeServer::~DecodeServer()
+{
+        if (listener >= 0) {
+                close(listener);
+                unlink(socketPath.c_str());
+        }
+        for (int i = 0; i < 2; i++) {
+                if (wake[i] >= 0)
+                        close(wake[i]);
+        }
+}
+
+int DecodeServer::listen(const string& path)
+{
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+                return ERROR_DAEMONSOCKET;
+        strcpy(address.sun_path, path.c_str());
+
+        listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (listener < 0 || pipe2(wake, O_CLOEXEC) != 0)
+                return ERROR_DAEMONSOCKET;
+
+        // only a socket of this user may be replaced
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0 && (!S_ISSOCK(st.st_mode) || st.st_uid != geteuid()))
+                return ERROR_DAEMONSOCKET;
+        // a socket nobody accepts on is left over from a daemon which didn't exit cleanly
+        int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        bool running = probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+        if (probe >= 0)
+                close(probe);
+        if (running)
+                return ERROR_DAEMONSOCKET;
+        unlink(path.c_str());
+
+        // nobody can connect before listen(), so there is no window with the default mode
+        if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || chmod(path.c_str(), 0600) != 0
+            || ::listen(listener, 128) != 0)
+                return ERROR_DAEMONSOCKET;
+        socketPath = path;
+
+        int count = threads > 0 ? threads : max(1, (int)thread::hardware_concurrency());
+        for (int i = 0; i < count; i++)
+                workers.emplace_back(&DecodeServer::work, this);
+        return 0;
+}
+
+void DecodeServer::stop()
+{
+        stopped.store(true);
+        if (wake[1] >= 0) {
+                char byte = 0;
+                ssize_t ignored = write(wake[1], &byte, 1);
+                (void)ignored;
+        }
+}
+
+/*!
+ * Accepts connections and reads the requests of all of them on the calling thread (the
+ * requests are small, the work is done by the workers).
+ */
+void DecodeServer::run()
+{
+        map<int, shared_ptr<Connection>> connections;
+        vector<struct pollfd> polled;
+        while (!stopped.load()) {
+                polled.clear();
+                polled.push_back({ wake[0], POLLIN, 0 });
+                polled.push_back({ listener, POLLIN, 0 });
+                for (auto& connection : connections)
+                        polled.push_back({ connection.first, POLLIN, 0 });
+                if (poll(polled.data(), polled.size(), -1) < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        break;
+                }
+
+                if (polled[1].revents & POLLIN) {
+                        int socket = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+                        // the requests are decoded with the rights of the daemon
+                        if (socket >= 0 && !samePeerUser(socket))
+                                close(socket);
+                        else if (socket >= 0)
+                                connections[socket] = make_shared<Connection>(socket);
+                }
+                for (size_t i = 2; i < polled.size(); i++) {
+                        if (polled[i].revents == 0)
+                                continue;
+                        auto connection = connections.find(polled[i].fd);
+                        if (!receive(connection->second))
+                                connections.erase(connection);
+                }
+        }
+
+        {
+                lock_guard<std::mutex> lock(mutex);
+                stopped.store(true);
+        }
+        wakeup.notify_all();
+        for (auto& worker : workers)
+                worker.join();
+        workers.clear();
+        // the requests nobody started on
+        for (auto& job : jobs) {
+                if (job.file >= 0)
+                        close(job.file);
+        }
+        jobs.clear();
+}
+
+// reads one request of the connection and queues it, false once the connection is closed
+bool DecodeServer::receive(const shared_ptr<Connection>& connection)
+{
+        char message[DAEMON_MAXMESSAGE];
+        char control[CMSG_SPACE(sizeof(int))];
+        struct iovec vector = { message, sizeof(message) };
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = &vector;
+        header.msg_iovlen = 1;
+        header.msg_control = control;
+        header.msg_controllen = sizeof(control);
+        ssize_t size;
+        while ((size = recvmsg(connection->socket, &header, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+        if (size <= 0)
+                return false;
+
+        Job job;
+        job.connection = connection;
+        job.file = -1;
+        for (struct cmsghdr* data = CMSG_FIRSTHDR(&header); data != nullptr; data = CMSG_NXTHDR(&header, data)) {
+                if (data->cmsg_level == SOL_SOCKET && data->cmsg_type == SCM_RIGHTS) {
+                        int files = (data->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                        for (int i = 0; i < files; i++) {
+                                int file;
+                                memcpy(&file, CMSG_DATA(data) + i * sizeof(int), sizeof(int));
+                                if (job.file < 0)
+                                        job.file = file;
+                                else
+                                        close(file);
+                        }
+                }
+        }
+
+        DaemonRequest& request = job.request;
+        bool valid = (size_t)size >= sizeof(request) && (header.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) == 0;
+        if (valid) {
+                memcpy(&request, message, sizeof(request));
+                valid = request.version == DAEMON_VERSION && (size_t)size == sizeof(request) + request.pathLength
+                        && (request.pathLength != 0) != (job.file >= 0)
+                        // relative paths would be resolved against the working directory of the daemon
+                        && (request.pathLength == 0 || message[sizeof(request)] == '/');
+        }
+        if (!valid) {
+                if (job.file >= 0)
+                        close(job.file);
+                DaemonResponse response;
+                memset(&response, 0, sizeof(response));
+                response.id = (size_t)size >= sizeof(request) ? ((DaemonRequest*)message)->id : 0;
+                response.error = ERROR_DAEMONPROTOCOL;
+                lock_guard<std::mutex> lock(connection->sending);
+                return sendMessage(connection->socket, &response, sizeof(response), -1);
+        }
+        job.path.assign(message + sizeof(request), request.pathLength);
+
+        {
+                lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(std::move(job));
+        }
+        wakeup.notify_one();
+        return true;
+}
+
+void DecodeServer::work()
+{
+        RecyclingAllocator allocator(defaultAllocator(), WORKER_BUFFERS);
+        unique_lock<std::mutex> lock(mutex);
+        while (!stopped.load()) {
+                if (jobs.empty()) {
+                        wakeup.wait(lock);
+                        continue;
+                }
+                Job job = std::move(jobs.front());
+                jobs.pop_front();
+                lock.unlock();
+
+                DaemonResponse response;
+                memset(&response, 0, sizeof(response));
+                response.id = job.request.id;
+                int memory = -1;
+                response.error = process(job, allocator, response, memory);
+                if (job.file >= 0)
+                        close(job.file);
+                {
+                        lock_guard<std::mutex> sending(job.connection->sending);
+                        sendMessage(job.connection->socket, &response, sizeof(response), response.error == 0 ? memory : -1);
+                }
+                if (memory >= 0)
+                        close(memory);
+                job.connection.reset();
+
+                lock.lock();
+        }
+}
+
+// decodes the image of the job into a new memfd (memory), returns the error code
+int DecodeServer::process(Job& job, RecyclingAllocator& allocator, DaemonResponse& response, int& memory)
+{
+        const DaemonRequest& request = job.request;
+        JpegDecoder decoder;
+        // one thread per image, the pool runs as many images as there are cores
+        decoder.setThreads(1);
+        decoder.setAllocator(&allocator);
+        decoder.setScale(request.scale);
+        decoder.setAutoOrient((request.flags & DAEMON_ORIENT) != 0);
+        if (job.file >= 0) {
+                string data;
+                if (!readDescriptor(job.file, data))
+                        return ERROR_DAEMONREAD;
+                decoder.setData(std::move(data));
+        } else if (!decoder.read(job.path)) {
+                return ERROR_DAEMONREAD;
+        }
+        int errcode = decoder.probe();
+        if (errcode != 0)
+                return errcode;
+
+        int width = decoder.getOutputWidth();
+        int height = decoder.getOutputHeight();
+        bool whole = request.width == 0;
+        int x = whole ? 0 : request.x;
+        int y = whole ? 0 : request.y;
+        int regionWidth = whole ? width : request.width;
+        int regionHeight = whole ? height : request.height;
+        // no sums, the values of the client could overflow them
+        if (x < 0 || y < 0 || regionWidth <= 0 || regionHeight <= 0 || regionWidth > width - x
+            || regionHeight > height - y)
+                return ERROR_REGION;
+
+        PixelFormat format = request.format == PIXEL_XRGB32 ? PIXEL_XRGB32 : PIXEL_RGB;
+        response.width = regionWidth;
+        response.height = regionHeight;
+        response.stride = regionWidth * pixelSize(format);
+        response.format = format;
+        response.size = (unsigned long long)response.stride * regionHeight;
+
+        memory = memfd_create("jpgd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (memory < 0 || ftruncate(memory, response.size) != 0)
+                return ERROR_SHAREDMEMORY;
+        void* pixels = mmap(nullptr, response.size, PROT_READ | PROT_WRITE, MAP_SHARED, memory, 0);
+        if (pixels == MAP_FAILED)
+                return ERROR_SHAREDMEMORY;
+
+        SharedSink sink((unsigned char*)pixels, response.stride, format, x, y, regionWidth, regionHeight, whole);
+        decoder.setSink(&sink);
+        errcode = decoder.decode();
+        munmap(pixels, response.size);
+        if (errcode == REGION_COMPLETE)
+                errcode = 0;
+        // the client gets pixels nobody can change any more
+        if (errcode == 0 && fcntl(memory, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0)
+                return ERROR_SHAREDMEMORY;
+        return errcode;
+}
+
+static DecodeServer* activeServer = nullptr;
+
+static void stopServer(int signal)
+{
+        if (activeServer != nullptr)
+                activeServer->stop();
+}
+
+int serveCommand(int argc, char** argv)
+{
+        string path;
+        int threads = 0;
+        for (int i = 1; i < argc; i++) {
+                string arg = argv[i];
+                if (arg == "-s" && i + 1 < argc) {
+                        path = argv[++i];
+                } else if (arg == "-t" && i + 1 < argc) {
+                        threads = max(0, atoi(argv[++i]));
+                } else {
+                        printf("Usage: serve [-s socket] [-t threads]\n");
+                        return 1;
+                }
+        }
+
+        if (path.empty() && defaultDaemonSocket(path, true) != 0) {
+                printf("Could not create a private socket directory, use -s\n");
+                return 1;
+        }
+        DecodeServer server(threads);
+        int errcode = server.listen(path);
+        if (errcode != 0) {
+                printf("Could not listen on %s (error code %d)\n", path.c_str(), errcode);
+                return 1;
+        }
+        activeServer = &server;
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = stopServer;
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+        signal(SIGPIPE, SIG_IGN);
+
+        printf("Decoding on %s\n", path.c_str());
+        server.run();
+        activeServer = nullptr;
+        return 0;
+}
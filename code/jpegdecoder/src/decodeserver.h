@@ -0,0 +1,68 @@
+#ifndef __DECODESERVER_H
+#define __DECODESERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "allocator.h"
+#include "daemonprotocol.h"
+
+/*!
+ * Decode daemon: accepts DecodeClient connections on a unix socket (see
+ * daemonprotocol.h) and decodes their requests on a fixed pool of worker threads.
+ *
+ * The workers live as long as the server and every one decodes a single image at a
+ * time on one thread, so a busy machine isn't oversubscribed by the decoders of many
+ * processes, and each keeps its band and coefficient buffers between images
+ * (RecyclingAllocator). The pixels are written by the decoder straight into a memfd,
+ * which is sealed and passed to the client.
+ */
+class DecodeServer
+{
+private:
+        struct Connection;
+        struct Job;
+
+        int threads;
+        int listener;
+        int wake[2];                    // pipe, written by stop()
+        std::string socketPath;
+        std::atomic<bool> stopped;
+
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        std::deque<Job> jobs;
+        std::vector<std::thread> workers;
+
+        void work();
+        bool receive(const std::shared_ptr<Connection>& connection);
+        int process(Job& job, RecyclingAllocator& allocator, DaemonResponse& response, int& memory);
+
+public:
+        // threads decoding workers, 0 = one per core
+        explicit DecodeServer(int threads = 0);
+        ~DecodeServer();
+
+        // binds the socket with mode 0600 (a stale socket of the same user is replaced, other
+        // files never) and starts the workers, only processes of the same user are accepted
+        int listen(const std::string& path);
+        // accepts connections until stop() is called, then waits for the running decodes,
+        // requests which haven't been started are dropped
+        void run();
+        // ends run(), async signal safe
+        void stop();
+};
+
+/*!
+ * ./jpgd serve [-s socket] [-t threads], argv[0] is "serve", the socket defaults to
+ * defaultDaemonSocket. Runs until SIGINT or SIGTERM.
+ */
+int serveCommand(int argc, char** argv);
+
+#endif // __DECODESERVER_H
@@ -0,0 +1,151 @@
+/*
+
+  C++20 coroutine interface of the incremental decoding (JpegDecoder::beginDecode and
+  resumeDecode). Only this header needs C++20, the decoder itself stays C++11.
+
+  A DecodeTask decodes a budget of MCU rows or microseconds, then hands itself to a
+  scheduler and suspends, so large and small images can be interleaved on the same
+  threads (e.g. the reactor of an event loop) without one decode blocking the others:
+
+        RoundRobinScheduler scheduler;
+        DecodeTask task = decodeAsync(decoder, scheduler, { 4, 2000 });
+        task.start();                   // or: int error = co_await task; inside a coroutine
+        scheduler.run();
+        int error = task.result();
+
+ */
+
+#ifndef __DECODETASK_H
+#define __DECODETASK_H
+
+#if __cplusplus < 202002L
+#error "decodetask.h needs C++20 (-std=c++20)"
+#endif
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include "jpegdecoder.h"
+
+// work done between two suspensions, 0 = no limit (both 0: the whole image in one step)
+struct DecodeBudget
+{
+        int rows;                       // MCU rows (8 or 16 pixel rows)
+        int microseconds;
+};
+
+// resumes the suspended tasks, e.g. by posting them to the queue of an event loop
+class DecodeScheduler
+{
+public:
+        virtual ~DecodeScheduler() {}
+        virtual void schedule(std::coroutine_handle<> handle) = 0;
+};
+
+// runs the scheduled coroutines in order on the calling thread
+class RoundRobinScheduler : public DecodeScheduler
+{
+private:
+        std::deque<std::coroutine_handle<>> queue;
+
+public:
+        virtual void schedule(std::coroutine_handle<> handle) { queue.push_back(handle); }
+        // resumes coroutines until none is left
+        void run()
+        {
+                while (!queue.empty()) {
+                        std::coroutine_handle<> handle = queue.front();
+                        queue.pop_front();
+                        handle.resume();
+                }
+        }
+        bool empty() { return queue.empty(); }
+};
+
+/*!
+ * Lazily started decode of one image, the result is the return value of decode().
+ * The task owns its coroutine frame and has to outlive the decoding, the decoder and
+ * its sink are used until the task is done.
+ */
+class DecodeTask
+{
+public:
+        struct promise_type
+        {
+                DecodeScheduler* scheduler;
+                std::coroutine_handle<> continuation;
+                int result;
+
+                promise_type(JpegDecoder&, DecodeScheduler& scheduler, DecodeBudget)
+                        : scheduler(&scheduler), result(0) {}
+
+                DecodeTask get_return_object() { return DecodeTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+                std::suspend_always initial_suspend() noexcept { return {}; }
+                // continues the awaiting coroutine, if there is one
+                struct FinalAwaiter
+                {
+                        bool await_ready() noexcept { return false; }
+                        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                        {
+                                std::coroutine_handle<> next = handle.promise().continuation;
+                                return next ? next : std::noop_coroutine();
+                        }
+                        void await_resume() noexcept {}
+                };
+                FinalAwaiter final_suspend() noexcept { return {}; }
+                void return_value(int value) { result = value; }
+                void unhandled_exception() { std::terminate(); }
+        };
+
+        // suspends the task and lets the scheduler resume it later
+        struct Yield
+        {
+                DecodeScheduler* scheduler;
+                bool await_ready() noexcept { return false; }
+                void await_suspend(std::coroutine_handle<> handle) { scheduler->schedule(handle); }
+                void await_resume() noexcept {}
+        };
+
+private:
+        std::coroutine_handle<promise_type> handle;
+
+        explicit DecodeTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+public:
+        DecodeTask(DecodeTask&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+        DecodeTask(const DecodeTask&) = delete;
+        DecodeTask& operator=(const DecodeTask&) = delete;
+        ~DecodeTask()
+        {
+                if (handle)
+                        handle.destroy();
+        }
+
+        // hands the first step to the scheduler (without an awaiting coroutine)
+        void start() { handle.promise().scheduler->schedule(handle); }
+        bool done() { return handle.done(); }
+        // return value of decode(), valid once done() is true
+        int result() { return handle.promise().result; }
+
+        // co_await task: runs the task, the awaiting coroutine continues with its result
+        bool await_ready() { return handle.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+        {
+                handle.promise().continuation = awaiting;
+                return handle;
+        }
+        int await_resume() { return handle.promise().result; }
+};
+
+// the coroutine: parses the headers, then decodes the rows budget by budget
+inline DecodeTask decodeAsync(JpegDecoder& decoder, DecodeScheduler& scheduler, DecodeBudget budget)
+{
+        int error = decoder.beginDecode();
+        while (error == DECODE_PENDING) {
+                co_await DecodeTask::Yield{ &scheduler };
+                error = decoder.resumeDecode(budget.rows, budget.microseconds);
+        }
+        co_return error;
+}
+
+#endif // __DECODETASK_H
@@ -0,0 +1,97 @@
+#include "exif.h"
+#include <cstring>
+using namespace std;
+
+#define TIFF_SHORT      3
+#define TIFF_LONG       4
+
+bool ExifReader::open(const char* segment, size_t length)
+{
+        tiff = nullptr;
+        size = 0;
+        if (length < 6 + 8 || memcmp(segment, "Exif\0\0", 6) != 0)
+                return false;
+
+        tiff = (const unsigned char*)segment + 6;
+        size = length - 6;
+        if (tiff[0] == 'I' && tiff[1] == 'I')
+                littleEndian = true;
+        else if (tiff[0] == 'M' && tiff[1] == 'M')
+                littleEndian = false;
+        else
+                size = 0;
+        if (size == 0 || readShort(2) != 42) {
+                tiff = nullptr;
+                size = 0;
+                return false;
+        }
+        return true;
+}
+
+unsigned int ExifReader::readShort(size_t offset)
+{
+        if (offset + 2 > size)
+                return 0;
+        const unsigned char* p = tiff + offset;
+        return littleEndian ? (p[0] | (p[1] << 8)) : ((p[0] << 8) | p[1]);
+}
+
+unsigned int ExifReader::readLong(size_t offset)
+{
+        if (offset + 4 > size)
+                return 0;
+        const unsigned char* p = tiff + offset;
+        if (littleEndian)
+                return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+        return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// 0 if the directory doesn't exist, the TIFF header itself is never a directory
+size_t ExifReader::ifdOffset(int ifd)
+{
+        size_t offset = readLong(4);
+        for (int i = 0; i < ifd && offset != 0; i++) {
+                unsigned int entries = readShort(offset);
+                // the offset of the next directory follows the entries
+                offset = readLong(offset + 2 + entries * 12);
+        }
+        return offset < size ? offset : 0;
+}
+
+bool ExifReader::findTag(int ifd, int tag, unsigned int& value)
+{
+        if (tiff == nullptr)
+                return false;
+        size_t offset = ifdOffset(ifd);
+        if (offset == 0)
+                return false;
+
+        unsigned int entries = readShort(offset);
+        for (unsigned int i = 0; i < entries; i++) {
+                // tag (2), type (2), count (4), value or offset (4)
+                size_t entry = offset + 2 + i * 12;
+                if (entry + 12 > size)
+                        return false;
+                if ((int)readShort(entry) != tag)
+                        continue;
+                unsigned int type = readShort(entry + 2);
+                if (readLong(entry + 4) != 1)
+                        return false;
+                if (type == TIFF_SHORT) {
+                        value = readShort(entry + 8);
+                        return true;
+                } else if (type == TIFF_LONG) {
+                        value = readLong(entry + 8);
+                        return true;
+                }
+                return false;
+        }
+        return false;
+}
+
+const char* ExifReader::data(unsigned int offset, unsigned int length)
+{
+        if (tiff == nullptr || (size_t)offset + length > size)
+                return nullptr;
+        return (const char*)tiff + offset;
+}
@@ -0,0 +1,45 @@
+#ifndef __EXIF_H
+#define __EXIF_H
+
+#include <cstddef>
+
+#define EXIF_IFD0               0
+#define EXIF_IFD1               1       // describes the thumbnail
+
+#define EXIF_TAG_COMPRESSION    0x0103
+#define EXIF_TAG_ORIENTATION    0x0112
+#define EXIF_TAG_JPEGOFFSET     0x0201  // JPEGInterchangeFormat
+#define EXIF_TAG_JPEGLENGTH     0x0202  // JPEGInterchangeFormatLength
+
+/*!
+ * Reads tags from the TIFF structure inside an APP1 Exif segment. Only the
+ * image file directories IFD0 and IFD1 are supported, every access is checked
+ * against the segment size.
+ *
+ * http://www.media.mit.edu/pia/Research/deepview/exif.html
+ */
+class ExifReader
+{
+private:
+        const unsigned char* tiff;      // start of the TIFF header, all offsets are relative to it
+        size_t size;
+        bool littleEndian;              // "II" (Intel) or "MM" (Motorola)
+
+        unsigned int readShort(size_t offset);
+        unsigned int readLong(size_t offset);
+        size_t ifdOffset(int ifd);
+
+public:
+        explicit ExifReader() : tiff(nullptr), size(0), littleEndian(false) {}
+
+        // content of the APP1 segment (after the length), false if it isn't Exif
+        bool open(const char* segment, size_t length);
+
+        // value of a SHORT or LONG tag with one value, false if the tag is missing
+        bool findTag(int ifd, int tag, unsigned int& value);
+
+        // offset and length relative to the TIFF header, nullptr if outside of the segment
+        const char* data(unsigned int offset, unsigned int length);
+};
+
+#endif // __EXIF_H
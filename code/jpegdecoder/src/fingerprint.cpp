@@ -0,0 +1,231 @@
+#include "fingerprint.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "convert.h"
+#include "jpegdecoder.h"
+using namespace std;
+
+#define FINGERPRINT_FREQUENCIES 8       // 8x8 frequencies give the 64 bits
+#define DISTANCE_BATCH          4096    // candidates compared per call in findSimilar
+
+// box filter with fractional coverage along one axis, upscaling repeats the source values
+static void resample(const float* source, int length, int step, float* target, int targetStep)
+{
+        float scale = (float)length / FINGERPRINT_SCALE;
+        for (int i = 0; i < FINGERPRINT_SCALE; i++) {
+                float start = i * scale;
+                float end = start + scale;
+                float sum = 0;
+                for (int x = (int)start; x < length && x < end; x++) {
+                        float coverage = min(end, (float)x + 1) - max(start, (float)x);
+                        sum += source[x * step] * coverage;
+                }
+                target[i * targetStep] = sum / scale;
+        }
+}
+
+// luma samples: one per block (DC) or the means of the four quarters (DC and the first AC)
+static void lumaSamples(const LowFrequencyImage& image, vector<float>& luma, int& width, int& height)
+{
+        bool quarters = image.coefficients >= 5;
+        width = image.blocksWide * (quarters ? 2 : 1);
+        height = image.blocksHigh * (quarters ? 2 : 1);
+        luma.resize(width * height);
+
+        // mean of the first 8 point DCT basis function over one half of the block
+        const double pi = 3.14159265358979323846;
+        float half = 0;
+        for (int x = 0; x < 4; x++)
+                half += cos((2 * x + 1) * pi / 16) / 4;
+
+        for (int by = 0; by < image.blocksHigh; by++) {
+                for (int bx = 0; bx < image.blocksWide; bx++) {
+                        const int* values = &image.values[(by * image.blocksWide + bx) * image.coefficients];
+                        float mean = values[0] / 8.0f + 128;
+                        if (!quarters) {
+                                luma[by * width + bx] = mean;
+                                continue;
+                        }
+                        // zigzag 1 = horizontal frequency 1, 2 = vertical frequency 1, 4 = both
+                        for (int qy = 0; qy < 2; qy++) {
+                                for (int qx = 0; qx < 2; qx++) {
+                                        float hx = qx == 0 ? half : -half;
+                                        float hy = qy == 0 ? half : -half;
+                                        luma[(by * 2 + qy) * width + bx * 2 + qx] = mean
+                                                + (values[1] * hx + values[2] * hy) / (4 * (float)sqrt(2.0))
+                                                + values[4] * hx * hy / 4;
+                                }
+                        }
+                }
+        }
+}
+
+unsigned long long fingerprint(const LowFrequencyImage& image)
+{
+        int width, height;
+        vector<float> luma;
+        lumaSamples(image, luma, width, height);
+        if (width == 0 || height == 0)
+                return 0;
+
+        // scale to 32x32: rows first, then columns
+        vector<float> rows(height * FINGERPRINT_SCALE);
+        for (int y = 0; y < height; y++)
+                resample(&luma[y * width], width, 1, &rows[y * FINGERPRINT_SCALE], 1);
+        float scaled[FINGERPRINT_SCALE * FINGERPRINT_SCALE];
+        for (int x = 0; x < FINGERPRINT_SCALE; x++)
+                resample(&rows[x], height, FINGERPRINT_SCALE, &scaled[x], FINGERPRINT_SCALE);
+
+        // the lowest frequencies of the DCT-II, the normalization doesn't change the signs
+        const double pi = 3.14159265358979323846;
+        float basis[FINGERPRINT_FREQUENCIES][FINGERPRINT_SCALE];
+        for (int u = 0; u < FINGERPRINT_FREQUENCIES; u++)
+                for (int x = 0; x < FINGERPRINT_SCALE; x++)
+                        basis[u][x] = cos((2 * x + 1) * u * pi / (2 * FINGERPRINT_SCALE));
+
+        float horizontal[FINGERPRINT_SCALE][FINGERPRINT_FREQUENCIES];
+        for (int y = 0; y < FINGERPRINT_SCALE; y++) {
+                for (int u = 0; u < FINGERPRINT_FREQUENCIES; u++) {
+                        float sum = 0;
+                        for (int x = 0; x < FINGERPRINT_SCALE; x++)
+                                sum += scaled[y * FINGERPRINT_SCALE + x] * basis[u][x];
+                        horizontal[y][u] = sum;
+                }
+        }
+        float frequencies[FINGERPRINT_FREQUENCIES * FINGERPRINT_FREQUENCIES];
+        for (int v = 0; v < FINGERPRINT_FREQUENCIES; v++) {
+                for (int u = 0; u < FINGERPRINT_FREQUENCIES; u++) {
+                        float sum = 0;
+                        for (int y = 0; y < FINGERPRINT_SCALE; y++)
+                                sum += horizontal[y][u] * basis[v][y];
+                        frequencies[v * FINGERPRINT_FREQUENCIES + u] = sum;
+                }
+        }
+
+        // median of the 64 values: mean of the two in the middle
+        const int count = FINGERPRINT_FREQUENCIES * FINGERPRINT_FREQUENCIES;
+        float sorted[count];
+        copy(frequencies, frequencies + count, sorted);
+        nth_element(sorted, sorted + count / 2, sorted + count);
+        float median = (sorted[count / 2] + *max_element(sorted, sorted + count / 2)) / 2;
+
+        unsigned long long hash = 0;
+        for (int i = 0; i < count; i++)
+                hash = (hash << 1) | (frequencies[i] > median ? 1 : 0);
+        return hash;
+}
+
+int fingerprint(JpegDecoder& decoder, unsigned long long& hash, bool useAC)
+{
+        LowFrequencyImage image;
+        image.coefficients = useAC ? 5 : 1;
+        int errcode = decoder.readLowFrequencies(image);
+        if (errcode != 0)
+                return errcode;
+        hash = fingerprint(image);
+        return 0;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("popcnt")))
+static void distancesPopcnt(unsigned long long hash, const unsigned long long* candidates, size_t count,
+                            unsigned char* distances)
+{
+        for (size_t i = 0; i < count; i++)
+                distances[i] = (unsigned char)__builtin_popcountll(hash ^ candidates[i]);
+}
+#endif
+
+void hammingDistances(unsigned long long hash, const unsigned long long* candidates, size_t count,
+                      unsigned char* distances)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        // the default target has no popcount instruction, the builtin is a bit trick then
+        static const bool popcnt = __builtin_cpu_supports("popcnt");
+        if (popcnt) {
+                distancesPopcnt(hash, candidates, count, distances);
+                return;
+        }
+#endif
+        for (size_t i = 0; i < count; i++)
+                distances[i] = (unsigned char)hammingDistance(hash, candidates[i]);
+}
+
+void findSimilar(unsigned long long hash, const unsigned long long* candidates, size_t count,
+                 int maxDistance, vector<size_t>& matches)
+{
+        unsigned char distances[DISTANCE_BATCH];
+        for (size_t start = 0; start < count; start += DISTANCE_BATCH) {
+                size_t n = min((size_t)DISTANCE_BATCH, count - start);
+                hammingDistances(hash, candidates + start, n, distances);
+                for (size_t i = 0; i < n; i++) {
+                        if (distances[i] <= maxDistance)
+                                matches.push_back(start + i);
+                }
+        }
+}
+
+static void usage()
+{
+        cout << "Usage: ./jpgd fingerprint [-a] [-d distance] files/directories..." << endl
+             << "        -a      use the first AC coefficients too (better for small images)" << endl
+             << "        -d      list the pairs which differ in at most distance bits" << endl;
+}
+
+int fingerprintCommand(int argc, char** argv)
+{
+        bool useAC = false;
+        int maxDistance = -1;
+        vector<string> inputs;
+        for (int i = 1; i < argc; i++) {
+                string arg = argv[i];
+                if (arg == "-a") {
+                        useAC = true;
+                } else if (arg == "-d" && i + 1 < argc) {
+                        maxDistance = atoi(argv[++i]);
+                } else if (arg[0] == '-') {
+                        usage();
+                        return -1;
+                } else {
+                        collectInputs(arg, inputs);
+                }
+        }
+        if (inputs.empty()) {
+                usage();
+                return -1;
+        }
+
+        vector<unsigned long long> hashes;
+        vector<string> names;
+        for (auto& input : inputs) {
+                JpegDecoder decoder;
+                unsigned long long hash;
+                int errcode = decoder.read(input) ? fingerprint(decoder, hash, useAC) : -1;
+                if (errcode != 0) {
+                        cout << input << ": error code " << errcode << endl;
+                        continue;
+                }
+                printf("%016llx  %s\n", hash, input.c_str());
+                hashes.push_back(hash);
+                names.push_back(input);
+        }
+
+        if (maxDistance >= 0) {
+                vector<size_t> matches;
+                for (size_t i = 0; i + 1 < hashes.size(); i++) {
+                        matches.clear();
+                        findSimilar(hashes[i], &hashes[i + 1], hashes.size() - i - 1, maxDistance, matches);
+                        for (size_t match : matches) {
+                                size_t j = i + 1 + match;
+                                printf("%2d  %s  %s\n", hammingDistance(hashes[i], hashes[j]),
+                                       names[i].c_str(), names[j].c_str());
+                        }
+                }
+        }
+        return 0;
+}
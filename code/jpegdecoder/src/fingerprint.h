@@ -0,0 +1,45 @@
+#ifndef __FINGERPRINT_H
+#define __FINGERPRINT_H
+
+#include <cstddef>
+#include <vector>
+#include "coefficients.h"
+
+class JpegDecoder;
+
+#define FINGERPRINT_SCALE       32      // the luma is scaled to 32x32 before the DCT
+
+/*!
+ * 64 bit perceptual hash in the style of pHash: the luma is scaled to 32x32, the lowest
+ * 8x8 frequencies of its DCT are compared with their median. Bit 63 belongs to frequency
+ * (0, 0), the following ones row by row. Similar images differ in a few bits only.
+ *
+ * The luma comes straight from the entropy decoded coefficients: the DC value of a block
+ * is its mean, with useAC the first AC coefficients add the means of the four quarters
+ * (better for small images). There is no IDCT, chroma processing or color conversion.
+ */
+int fingerprint(JpegDecoder& decoder, unsigned long long& hash, bool useAC = false);
+
+// from coefficients read by JpegDecoder::readLowFrequencies (with AC if there are at least 5)
+unsigned long long fingerprint(const LowFrequencyImage& image);
+
+inline int hammingDistance(unsigned long long a, unsigned long long b)
+{
+        return __builtin_popcountll(a ^ b);
+}
+
+// distances of hash to all candidates (uses the POPCNT instruction if available)
+void hammingDistances(unsigned long long hash, const unsigned long long* candidates, size_t count,
+                      unsigned char* distances);
+
+// indices of the candidates at most maxDistance bits away from hash, in order
+void findSimilar(unsigned long long hash, const unsigned long long* candidates, size_t count,
+                 int maxDistance, std::vector<size_t>& matches);
+
+/*!
+ * ./jpgd fingerprint [-a] [-d distance] files/directories...: prints the fingerprints
+ * and with -d all pairs of near duplicates. argv[0] is "fingerprint".
+ */
+int fingerprintCommand(int argc, char** argv);
+
+#endif // __FINGERPRINT_H
@@ -0,0 +1,153 @@
+#include "huffmanencoder.h"
+#include <cstring>
+using namespace std;
+
+static const HuffmanSpec standardTables[4] = {
+        // DC luminance
+        { { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+          { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 } },
+        // DC chrominance
+        { { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 },
+          { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 } },
+        // AC luminance
+        { { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D },
+          { 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+            0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+            0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+            0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+            0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+            0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+            0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+            0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+            0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+            0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+            0xF9, 0xFA } },
+        // AC chrominance
+        { { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+          { 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+            0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+            0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+            0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+            0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+            0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+            0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+            0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+            0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+            0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+            0xF9, 0xFA } }
+};
+
+int HuffmanSpec::count() const
+{
+        int n = 0;
+        for (int i = 0; i < 16; i++)
+                n += bits[i];
+        return n;
+}
+
+const HuffmanSpec& standardHuffmanTable(bool ac, int table)
+{
+        return standardTables[(ac ? 2 : 0) + (table != 0 ? 1 : 0)];
+}
+
+void optimalHuffmanTable(const long* frequencies, HuffmanSpec& spec)
+{
+        long freq[257];
+        int codesize[257];
+        int others[257];
+        for (int i = 0; i < 256; i++)
+                freq[i] = frequencies[i];
+        // reserved symbol, makes sure no code consists of 1 bits only
+        freq[256] = 1;
+        for (int i = 0; i < 257; i++) {
+                codesize[i] = 0;
+                others[i] = -1;
+        }
+
+        // huffman's algorithm: merge the two least frequent trees until one is left
+        for (;;) {
+                int c1 = -1, c2 = -1;
+                long v = -1;
+                for (int i = 0; i < 257; i++) {
+                        if (freq[i] != 0 && (v < 0 || freq[i] <= v)) {
+                                v = freq[i];
+                                c1 = i;
+                        }
+                }
+                v = -1;
+                for (int i = 0; i < 257; i++) {
+                        if (freq[i] != 0 && (v < 0 || freq[i] <= v) && i != c1) {
+                                v = freq[i];
+                                c2 = i;
+                        }
+                }
+                if (c2 < 0)
+                        break;
+
+                freq[c1] += freq[c2];
+                freq[c2] = 0;
+                codesize[c1]++;
+                while (others[c1] >= 0) {
+                        c1 = others[c1];
+                        codesize[c1]++;
+                }
+                others[c1] = c2;
+                codesize[c2]++;
+                while (others[c2] >= 0) {
+                        c2 = others[c2];
+                        codesize[c2]++;
+                }
+        }
+
+        int bits[33];
+        memset(bits, 0, sizeof(bits));
+        for (int i = 0; i < 257; i++) {
+                if (codesize[i] != 0)
+                        bits[codesize[i]]++;
+        }
+
+        // limit the code lengths to 16 bits (Figure K.3)
+        for (int i = 32; i > 16; i--) {
+                while (bits[i] > 0) {
+                        int j = i - 2;
+                        while (bits[j] == 0)
+                                j--;
+                        bits[i] -= 2;
+                        bits[i - 1]++;
+                        bits[j + 1] += 2;
+                        bits[j]--;
+                }
+        }
+        // remove the reserved symbol from the longest codes
+        int longest = 16;
+        while (bits[longest] == 0)
+                longest--;
+        bits[longest]--;
+
+        for (int i = 0; i < 16; i++)
+                spec.bits[i] = bits[i + 1];
+        int n = 0;
+        for (int length = 1; length <= 32; length++) {
+                for (int symbol = 0; symbol < 256; symbol++) {
+                        if (codesize[symbol] == length)
+                                spec.values[n++] = symbol;
+                }
+        }
+}
+
+HuffmanEncoder::HuffmanEncoder(const HuffmanSpec& spec)
+{
+        memset(codes, 0, sizeof(codes));
+        memset(lengths, 0, sizeof(lengths));
+
+        // canonical codes, just like the decoder builds its tree
+        unsigned int code = 0;
+        int k = 0;
+        for (int length = 1; length <= 16; length++) {
+                for (int i = 0; i < spec.bits[length - 1]; i++) {
+                        codes[spec.values[k]] = code++;
+                        lengths[spec.values[k++]] = length;
+                }
+                code <<= 1;
+        }
+}
@@ -0,0 +1,33 @@
+#ifndef __HUFFMANENCODER_H
+#define __HUFFMANENCODER_H
+
+#include "bitwriter.h"
+
+// a huffman table as it is stored in a DHT segment
+struct HuffmanSpec
+{
+        unsigned char bits[16];         // number of codes with a length of 1..16 bits
+        unsigned char values[256];      // symbols ordered by code length
+
+        int count() const;              // number of symbols
+};
+
+// the typical tables of ITU-T81 Annex K.3, table 0 = luminance, 1 = chrominance
+const HuffmanSpec& standardHuffmanTable(bool ac, int table);
+
+// optimal table for the given symbol frequencies (Annex K.2), code lengths are limited to 16 bits
+void optimalHuffmanTable(const long* frequencies, HuffmanSpec& spec);
+
+class HuffmanEncoder
+{
+private:
+        unsigned short codes[256];
+        unsigned char lengths[256];
+
+public:
+        explicit HuffmanEncoder(const HuffmanSpec& spec);
+
+        void encode(BitWriter& writer, unsigned char symbol) const { writer.write(codes[symbol], lengths[symbol]); }
+};
+
+#endif // __HUFFMANENCODER_H
@@ -85,7 +85,7 @@ int HuffmanTree::insertNextRow(char* values, unsigned int n)
         return 0;
 }
 
-unsigned char HuffmanTree::getValue(BitStream& stream, int& result) {
+unsigned char HuffmanTree::getValue(BitStream& stream, int& result) const {
         HuffmanNode* node = root;
         result = 0;
         while (node != nullptr) {
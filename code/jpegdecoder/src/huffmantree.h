@@ -36,7 +36,7 @@ public:
         explicit HuffmanTree();
         virtual ~HuffmanTree();
         int insertNextRow(char* values, unsigned int n);
-        unsigned char getValue(BitStream& stream, int& result);
+        unsigned char getValue(BitStream& stream, int& result) const;
 };
 
 #endif // __HUFFMANTREE_H
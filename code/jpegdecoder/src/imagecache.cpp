@@ -0,0 +1,259 @@
+#include "imagecache.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "jpegdecoder.h"
+using namespace std;
+
+// writes the pixels straight into the cached image
+class CacheSink : public RowSink
+{
+private:
+        CachedImage* cached;
+        function<int()> bandDone;       // non zero cancels the decoding
+public:
+        CacheSink(CachedImage* cached, function<int()> bandDone) : cached(cached), bandDone(bandDone) {}
+
+        PixelFormat format() { return PIXEL_XRGB32; }
+        unsigned char* target(int y, int& stride) {
+                stride = cached->stride;
+                return &cached->pixels[(size_t)y * cached->stride];
+        }
+        unsigned char* image(int& stride) {
+                stride = cached->stride;
+                return cached->pixels.data();
+        }
+        int band(int y, int rows, const unsigned char* rgb, int stride) {
+                cached->rows.store(y + rows, memory_order_release);
+                return bandDone();
+        }
+};
+
+// MemAvailable of /proc/meminfo in bytes, SIZE_MAX if unknown
+static size_t availableMemory()
+{
+        FILE* file = fopen("/proc/meminfo", "r");
+        if (file == nullptr)
+                return SIZE_MAX;
+        char line[256];
+        size_t available = SIZE_MAX;
+        while (fgets(line, sizeof(line), file) != nullptr) {
+                unsigned long kilobytes;
+                if (sscanf(line, "MemAvailable: %lu kB", &kilobytes) == 1) {
+                        available = (size_t)kilobytes * 1024;
+                        break;
+                }
+        }
+        fclose(file);
+        return available;
+}
+
+ImageCache::ImageCache(const vector<string>& files, size_t memoryLimit, int ahead)
+        : files(files), memoryLimit(memoryLimit), lowMemory(128 << 20), ahead(ahead), current(0), memory(0),
+          clock(0), stopped(false)
+{
+}
+
+void ImageCache::start(int threads)
+{
+        for (int i = 0; i < max(1, threads); i++)
+                workers.emplace_back(&ImageCache::work, this);
+}
+
+ImageCache::~ImageCache()
+{
+        stop();
+}
+
+void ImageCache::stop()
+{
+        {
+                lock_guard<std::mutex> lock(mutex);
+                stopped.store(true);
+        }
+        wakeup.notify_all();
+        for (auto& worker : workers)
+                worker.join();
+        workers.clear();
+}
+
+size_t ImageCache::getMemory()
+{
+        lock_guard<std::mutex> lock(mutex);
+        return memory;
+}
+
+shared_ptr<CachedImage> ImageCache::show(int index)
+{
+        shared_ptr<CachedImage> image;
+        {
+                lock_guard<std::mutex> lock(mutex);
+                current.store(index);
+                skipped.clear();
+                auto found = images.find(index);
+                if (found != images.end()) {
+                        image = found->second;
+                        image->used = ++clock;
+                }
+        }
+        wakeup.notify_all();
+        return image;
+}
+
+shared_ptr<CachedImage> ImageCache::get(int index)
+{
+        lock_guard<std::mutex> lock(mutex);
+        auto found = images.find(index);
+        return found != images.end() ? found->second : nullptr;
+}
+
+void ImageCache::trim(size_t bytes)
+{
+        lock_guard<std::mutex> lock(mutex);
+        while (memory > bytes) {
+                int victim = -1;
+                unsigned long oldest = ~0ul;
+                for (auto& entry : images) {
+                        if (entry.first != current.load() && decoding.count(entry.first) == 0
+                            && entry.second->used < oldest) {
+                                victim = entry.first;
+                                oldest = entry.second->used;
+                        }
+                }
+                if (victim < 0)
+                        break;
+                drop(victim);
+        }
+}
+
+void ImageCache::drop(int index)
+{
+        auto found = images.find(index);
+        if (found == images.end())
+                return;
+        memory -= found->second->pixels.size();
+        images.erase(found);
+}
+
+// the next image of the window which is neither cached nor decoded, -1 if there is none
+int ImageCache::nextIndex()
+{
+        int center = current.load();
+        for (int distance = 0; distance <= ahead; distance++) {
+                for (int direction = 1; direction >= -1; direction -= 2) {
+                        int index = center + direction * distance;
+                        if (index >= 0 && index < (int)files.size() && images.count(index) == 0
+                            && decoding.count(index) == 0 && skipped.count(index) == 0)
+                                return index;
+                        if (distance == 0)
+                                break;
+                }
+        }
+        return -1;
+}
+
+/*!
+ * Makes room for bytes more pixel memory by dropping the least recently shown images.
+ * Images in the window are only dropped for the current image, which is always decoded.
+ */
+bool ImageCache::reserve(int index, size_t bytes)
+{
+        bool isCurrent = index == current.load();
+        while (memory + bytes > memoryLimit) {
+                int victim = -1;
+                unsigned long oldest = ~0ul;
+                for (auto& entry : images) {
+                        if (entry.first == current.load() || decoding.count(entry.first) != 0
+                            || (!isCurrent && inWindow(entry.first)))
+                                continue;
+                        if (entry.second->used < oldest) {
+                                victim = entry.first;
+                                oldest = entry.second->used;
+                        }
+                }
+                if (victim < 0)
+                        return isCurrent;
+                drop(victim);
+        }
+        return true;
+}
+
+void ImageCache::checkMemory()
+{
+        if (availableMemory() < lowMemory)
+                trim(0);
+}
+
+void ImageCache::work()
+{
+        unique_lock<std::mutex> lock(mutex);
+        while (!stopped.load()) {
+                int index = nextIndex();
+                if (index < 0) {
+                        wakeup.wait(lock);
+                        continue;
+                }
+                decoding.insert(index);
+                bool isCurrent = index == current.load();
+                lock.unlock();
+
+                shared_ptr<CachedImage> image = make_shared<CachedImage>();
+                image->path = files[index];
+                JpegDecoder decoder;
+                // the current image gets all cores, the images ahead one each
+                decoder.setThreads(isCurrent ? 0 : 1);
+                // photos are shown upright
+                decoder.setAutoOrient(true);
+                int errcode = decoder.read(files[index]) ? decoder.probe() : ERROR_CACHEREAD;
+                size_t bytes = 0;
+                if (errcode == 0) {
+                        image->width = decoder.getOutputWidth();
+                        image->height = decoder.getOutputHeight();
+                        image->stride = image->width * 4;
+                        bytes = (size_t)image->stride * image->height;
+                }
+
+                lock.lock();
+                if (errcode == 0 && !reserve(index, bytes)) {
+                        decoding.erase(index);
+                        skipped.insert(index);
+                        continue;
+                }
+                memory += bytes;
+                lock.unlock();
+
+                // the pixels of a cached image never move, the viewer may show them while they are decoded
+                image->pixels.resize(bytes);
+                lock.lock();
+                image->used = ++clock;
+                images[index] = image;
+                lock.unlock();
+
+                if (errcode == 0) {
+                        if (progress)
+                                progress(index);
+                        CacheSink sink(image.get(), [&]() {
+                                if (progress)
+                                        progress(index);
+                                return stopped.load() || !inWindow(index) ? ERROR_DROPPED : 0;
+                        });
+                        decoder.setSink(&sink);
+                        errcode = decoder.decode();
+                }
+
+                lock.lock();
+                decoding.erase(index);
+                if (errcode == ERROR_DROPPED) {
+                        drop(index);
+                        continue;
+                }
+                image->error = errcode;
+                image->complete.store(true, memory_order_release);
+                lock.unlock();
+                if (progress)
+                        progress(index);
+                checkMemory();
+                lock.lock();
+        }
+}
@@ -0,0 +1,109 @@
+#ifndef __IMAGECACHE_H
+#define __IMAGECACHE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define ERROR_DROPPED           0xB0    // the image left the decode-ahead window while it was decoded
+#define ERROR_CACHEREAD         0xB1    // the file couldn't be read
+
+// decoded image of the cache, 32 bit XRGB pixels (cairo FORMAT_RGB24)
+struct CachedImage
+{
+        std::string path;
+        int width;
+        int height;
+        int stride;                     // in bytes
+        std::vector<unsigned char> pixels;
+        std::atomic<int> rows;          // decoded rows so far, written by the worker
+        std::atomic<bool> complete;     // decoding finished (successfully or not)
+        int error;                      // error code of the decoder, valid once complete
+        unsigned long used;             // last access, for the LRU order
+
+        CachedImage() : width(0), height(0), stride(0), rows(0), complete(false), error(0), used(0) {}
+};
+
+/*!
+ * Decoded images of a file list for the viewer. Worker threads decode the current
+ * image first and then the next and previous few (alternating, the next one before
+ * the previous one at the same distance). The images stay in the cache until they
+ * are the least recently shown ones and the memory limit is reached. If the system
+ * is short of memory (MemAvailable below a low water mark) everything but the
+ * current image is dropped. Decodes of images which left the window in the meantime
+ * are cancelled at the next band.
+ *
+ * An image is in the cache from the moment its pixel memory is allocated, the viewer
+ * can show it while it is decoded and gets told about new rows through the progress
+ * callback.
+ */
+class ImageCache
+{
+public:
+        // called from the worker threads when rows of image index were decoded or it is complete
+        typedef std::function<void(int index)> Progress;
+
+private:
+        std::vector<std::string> files;
+        size_t memoryLimit;
+        size_t lowMemory;
+        int ahead;
+        Progress progress;
+
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        std::map<int, std::shared_ptr<CachedImage>> images;
+        std::set<int> decoding;
+        std::set<int> skipped;          // didn't fit into the memory limit, retried after the next show()
+        std::atomic<int> current;
+        size_t memory;                  // pixel memory of the cached images
+        unsigned long clock;
+        std::atomic<bool> stopped;
+        std::vector<std::thread> workers;
+
+        void work();
+        int nextIndex();
+        bool inWindow(int index) { return index >= current.load() - ahead && index <= current.load() + ahead; }
+        bool reserve(int index, size_t bytes);
+        void drop(int index);
+        void checkMemory();
+
+public:
+        /*!
+         * memoryLimit for the decoded pixels in bytes (the current image is always decoded),
+         * ahead images before and after the current one are decoded in the background.
+         */
+        ImageCache(const std::vector<std::string>& files, size_t memoryLimit, int ahead = 2);
+        ~ImageCache();
+        // starts the worker threads, the setters below must be called before
+        void start(int threads = 2);
+        // cancels the running decodes and stops the workers, no progress calls after it returns
+        void stop();
+
+        void setProgress(Progress progress) { this->progress = progress; }
+        // below this much available system memory the cache is trimmed to the current image
+        void setLowMemory(size_t bytes) { lowMemory = bytes; }
+
+        int size() { return (int)files.size(); }
+        const std::string& getPath(int index) { return files[index]; }
+        size_t getMemory();
+
+        /*!
+         * Makes index the current image and moves the decode-ahead window, returns the
+         * image if its decoding has already started, nullptr otherwise (it is decoded next).
+         */
+        std::shared_ptr<CachedImage> show(int index);
+        // the cached image or nullptr, doesn't change the current image
+        std::shared_ptr<CachedImage> get(int index);
+        // drops the least recently shown images (never the current one) until at most bytes are used
+        void trim(size_t bytes);
+};
+
+#endif // __IMAGECACHE_H
@@ -2,13 +2,22 @@
 #include <vector>
 #include <fstream>
 #include <string.h>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <chrono>
 
 #if DEBUG
 #include <iostream>
 #endif
 
 #include "color.h"
+#include "exif.h"
 #include "dct.h"
+#include "upsample.h"
+#include "ringbuffer.h"
+#include "thumbnail.h"
+#include "zigzag.h"
 using namespace std;
 
 #define JFIF_SOI                0xD8    // Start of Image
@@ -17,8 +26,10 @@ using namespace std;
                                         // it also contains the width and height of the image
                                         // and color scheme information (note: only YCbCr sup.)
 #define JFIF_SOF2               0xC2    // progressive dct (not supported)
+#define JFIF_SOF9               0xC9    // sequential dct with arithmetic coding
+#define JFIF_SOF10              0xCA    // progressive dct with arithmetic coding (not supported)
 #define JFIF_DHT                0xC4    // Definition of huffman tables
-#define JFIF_DAC                0xCC    // Definition of arithmetic codec (not supported)
+#define JFIF_DAC                0xCC    // Definition of arithmetic coding conditioning
 #define JFIF_DQT                0xDB    // Definition of quantization tables
 #define JFIF_DRI                0xDD    // Definition for restart interval (optional?)
 #define JFIF_EOI                0xD9    // End of Image
@@ -32,18 +43,21 @@ using namespace std;
 #define ERROR_NOTSUPPORTED      0x12
 #define ERROR_COLORSCHEME       0x13    // only YCbCr is supported
 #define ERROR_DATAPRECISION     0x14    // only 8bit data precision is supported
-#define ERROR_ARITHMETIC        0x15    // contains additional arithmetic
-                                                                        // codecs which aren't supported
+#define ERROR_ARITHMETIC        0x15    // progressive arithmetic coding isn't supported
 #define ERROR_INVALIDDRI        0x16    // invalid DRI/RST segment
 #define ERROR_PDCT              0X17    // progressive dct is not supported
 #define ERROR_DHTOVERFLOW       0x18    // to many entries in the DHT table (max. 256 are allowed)
 #define ERROR_NOEOIMARKER       0x19    // no end of image marker found in image
 #define ERROR_INVALIDQTNR       0x1A    // invalid quantization table number
+#define ERROR_BLOCKOVERFLOW     0x1B    // more than 64 coefficients in a block
+#define ERROR_NOHUFFMANTABLE    0x1C    // the scan uses an undefined huffman table
 
 #define ERROR_HUFFMANPREFIX     0x100   // bitmask added to error codes produced by the huffmantree
                                         // algorithm so that the error codes can be distinguished
 #define ERROR_BITSTREAMPREFIX   0x200   // bitmask added to error codes produced by the bitstream
 
+#define SPECULATIVE_CHUNK       (256 * 1024)    // smallest part of a scan decoded speculatively by one thread
+
 #define CHECK_RANGE(a,b,c)      if ((unsigned int)a+(unsigned int)b >= (unsigned int)c.size()) return ERROR_OUTOFRANGE;
 #define CHECK_ERROR(a)          if (a != 0) return a;
 #define CHECK_ERROR_HUFFMAN(a)  if (a != 0) return a ^ ERROR_HUFFMANPREFIX;
@@ -69,15 +83,46 @@ ostream& operator<<(ostream& stream, const ColorComponent& c) {
 #endif 
 
 
-// numbers in the array for the inverse zigzag algorithm
-static unsigned char zz[64] =   {  0,  1,  8, 16,  9,  2,  3, 10,
-                                  17, 24, 32, 25, 18, 11,  4,  5,
-                                  12, 19, 26, 33, 40, 48, 41, 34,
-                                  27, 20, 13,  6,  7, 14, 21, 28,
-                                  35, 42, 49, 56, 57, 50, 43, 36,
-                                  29, 22, 15, 23, 30, 37, 44, 51,
-                                  58, 59, 52, 45, 38, 31, 39, 46,
-                                  53, 60, 61, 54, 47, 55, 62, 63 };
+// state of the entropy decoder at the beginning of a MCU
+struct SyncPoint
+{
+        unsigned int position;          // in bits, see BitStream
+        int dc[3];                      // DC predictors of the scan components
+};
+
+// bytes of entropy coded data starting at start, up to the next marker (RSTn are skipped)
+static unsigned int scanLength(const string& raw, int start)
+{
+        const char* data = raw.data();
+        const char* end = data + raw.size() - 1;
+        const char* marker = data + start;
+        while ((marker = (const char*)memchr(marker, 0xFF, end - marker)) != nullptr) {
+                unsigned char next = marker[1];
+                if (next != 0x00 && next != 0xFF && (next & 0xF8) != 0xD0)
+                        return marker - data - start;
+                marker++;
+        }
+        return raw.size() - start;
+}
+
+// serial decoding state of a scan between the calls of resumeDecode
+struct JpegDecoder::ScanState
+{
+        BitStream stream;
+        Buffer<int> coefficients;
+        Buffer<unsigned char> band;
+        int previousDC[3];
+        int mcu;
+        int row;
+
+        explicit ScanState(JpegDecoder* decoder)
+                : stream(&decoder->raw[decoder->position], decoder->raw.size() - decoder->position),
+                  coefficients(decoder->allocator, decoder->mcusPerRow * decoder->blocksPerMCU * 64),
+                  band(decoder->allocator, decoder->bandSize()), mcu(0), row(0)
+        {
+                previousDC[0] = previousDC[1] = previousDC[2] = 0;
+        }
+};
 
 JpegDecoder::JpegDecoder()
 {
@@ -86,6 +131,27 @@ JpegDecoder::JpegDecoder()
         height = -1;
         useRST = false;
         restartInterval = -1;
+        threads = 0;
+        speculative = true;
+        sink = &picture;
+        coefficientOutput = nullptr;
+        lowFrequencyOutput = nullptr;
+        planarOutput = nullptr;
+        allocator = defaultAllocator();
+        idctMode = IDCT_FAST;
+        profiler = nullptr;
+        scale = 1;
+        arithmetic = false;
+        dequantize = true;
+        orientation = 1;
+        autoOrient = false;
+        orientedImage = nullptr;
+        orientedStride = 0;
+
+        // used instead of the quantization tables to get the quantized coefficients
+        unitTable = make_shared<QTable>();
+        for (int i = 0; i < 64; i++)
+                unitTable->values[i] = 1;
 }
 
 JpegDecoder::~JpegDecoder()
@@ -101,6 +167,7 @@ bool JpegDecoder::read(std::string path)
         ifstream pictureStream (path.c_str(), ios::in | ios::binary);
 
         if ( pictureStream ) {
+                scanState.reset();
                 pictureStream.seekg(0, ios::end);
                 // tell the string how much it has to store
                 raw.resize(pictureStream.tellg());
@@ -112,6 +179,19 @@ bool JpegDecoder::read(std::string path)
         return false;
 }
 
+void JpegDecoder::setData(std::string&& data)
+{
+        scanState.reset();
+        raw = std::move(data);
+        position = 0;
+}
+
+void JpegDecoder::setAllocator(BufferAllocator* allocator)
+{
+        this->allocator = allocator != nullptr ? allocator : defaultAllocator();
+        picture.setAllocator(allocator);
+}
+
 unsigned char JpegDecoder::seekNextSegment()
 {
         while ((unsigned int)position < raw.size()) {
@@ -127,8 +207,27 @@ unsigned char JpegDecoder::seekNextSegment()
 
 int JpegDecoder::decode()
 {
-        // search for the beginning of the image in the raw data
+        if (profiler == nullptr)
+                return parseSegments();
+
+        profiler->enter(STAGE_MARKERS);
+        int errcode = parseSegments();
+        profiler->stop();
+        return errcode;
+}
+
+int JpegDecoder::parseSegments()
+{
+        int errcode = seekImage();
+        CHECK_ERROR(errcode);
+        return parseUntilScan(false);
+}
+
+// search for the beginning of the image in the raw data
+int JpegDecoder::seekImage()
+{
         unsigned char symbol = 0x00;
+        orientation = 1;
 
         while (symbol != JFIF_SOI) { 
                 symbol = seekNextSegment();
@@ -136,13 +235,34 @@ int JpegDecoder::decode()
                         return ERROR_NOIMAGEDATA;
                 }
         }
-        
+        arithmeticDecoder.conditioning.reset();
+        return 0;
+}
+
+/*!
+ * Parses the segments up to the end of the image. With incremental set, the loop stops
+ * after the header of a scan and returns DECODE_PENDING, the scan is then decoded by
+ * resumeDecode, which continues with the segments behind it.
+ */
+int JpegDecoder::parseUntilScan(bool incremental)
+{
+        unsigned char symbol;
         int errcode = 0;
         while ((symbol = seekNextSegment()) != JFIF_EOI) {
                 switch (symbol) {
                 case JFIF_SOS:
+                        if (incremental) {
+                                errcode = prepareScan();
+                                CHECK_ERROR(errcode);
+                                scanState.reset(new ScanState(this));
+                                return DECODE_PENDING;
+                        }
                         errcode = parseSOS(); break;
                 case JFIF_SOF0:
+                        arithmetic = false;
+                        errcode = parseSOF0(); break;
+                case JFIF_SOF9:
+                        arithmetic = true;
                         errcode = parseSOF0(); break;
                 case JFIF_DHT:
                         errcode = parseDHT(); break;
@@ -151,12 +271,14 @@ int JpegDecoder::decode()
                 case JFIF_DRI:
                         errcode = parseDRI(); break;
                 case JFIF_DAC:
+                        errcode = parseDAC(); break;
+                case JFIF_SOF10:
                         return ERROR_ARITHMETIC;
                 case JFIF_SOF2:
                         return ERROR_PDCT;
                 default:
                         if (symbol >= 0xE0 && symbol <= 0xEF) {
-                                errcode = parseEXIF();
+                                errcode = parseEXIF(symbol);
                         }
                         break;
                 }
@@ -167,6 +289,108 @@ int JpegDecoder::decode()
         return 0;
 }
 
+int JpegDecoder::beginDecode()
+{
+        scanState.reset();
+        position = 0;
+        int errcode = seekImage();
+        CHECK_ERROR(errcode);
+        return parseUntilScan(true);
+}
+
+int JpegDecoder::resumeDecode(int rows, int microseconds)
+{
+        if (scanState == nullptr)
+                return 0;
+
+        ScanState& state = *scanState;
+        auto deadline = chrono::steady_clock::now() + chrono::microseconds(microseconds);
+        for (int decoded = 0; state.row < mcuRows; decoded++) {
+                if ((rows > 0 && decoded >= rows)
+                    || (microseconds > 0 && decoded > 0 && chrono::steady_clock::now() >= deadline))
+                        return DECODE_PENDING;
+                int error = decodeRow(state.stream, state.row, state.mcu, state.previousDC,
+                                      state.coefficients.data(), state.band.data());
+                if (error != 0) {
+                        scanState.reset();
+                        return error;
+                }
+                state.row++;
+        }
+
+        // the scan is complete, continue with the segments behind it
+        scanState.reset();
+        sink->end();
+        int errcode = checkEOI();
+        CHECK_ERROR(errcode);
+        return parseUntilScan(true);
+}
+
+int JpegDecoder::probe()
+{
+        // walk the segments up to the frame header without decoding anything
+        int start = position;
+        int errcode = ERROR_NOIMAGEDATA;
+        position = 0;
+        orientation = 1;
+
+        unsigned char symbol = 0x00;
+        while (symbol != JFIF_SOI && (symbol = seekNextSegment()) != JFIF_EOI);
+
+        while (symbol != JFIF_EOI && (symbol = seekNextSegment()) != JFIF_EOI) {
+                if (symbol == JFIF_SOF0 || symbol == JFIF_SOF9) {
+                        errcode = parseFrameHeader();
+                        break;
+                } else if (symbol == JFIF_SOF2) {
+                        errcode = ERROR_PDCT;
+                        break;
+                } else if (symbol == JFIF_SOS) {
+                        break;
+                } else if (symbol != 0x00 && symbol != 0xFF && (symbol & 0xF8) != 0xD0) {
+                        // every other marker is followed by the length of its segment
+                        if ((unsigned int)position + 2 > raw.size())
+                                break;
+                        int length = parseUShort() - 2;
+                        readOrientation(symbol, length);
+                        position += length;
+                }
+        }
+
+        position = start;
+        return errcode;
+}
+
+int JpegDecoder::getThumbnail(std::string& jpeg)
+{
+        Thumbnail thumbnail;
+        int errcode = findThumbnail(raw, thumbnail);
+        CHECK_ERROR(errcode)
+        if (thumbnail.type != THUMBNAIL_JPEG)
+                return ERROR_THUMBNAILFORMAT;
+        jpeg.assign(raw, thumbnail.offset, thumbnail.size);
+        return 0;
+}
+
+int JpegDecoder::decodeThumbnail(RowSink* sink)
+{
+        Thumbnail thumbnail;
+        int errcode = findThumbnail(raw, thumbnail);
+        CHECK_ERROR(errcode)
+        if (sink == nullptr)
+                sink = &picture;
+        if (thumbnail.type != THUMBNAIL_JPEG)
+                return storeThumbnail(raw, thumbnail, sink);
+
+        // the preview is a complete baseline JPEG file of its own
+        JpegDecoder decoder;
+        decoder.setData(raw.substr(thumbnail.offset, thumbnail.size));
+        decoder.setSink(sink);
+        decoder.setThreads(1);
+        decoder.setIDCT(idctMode);
+        decoder.setAllocator(allocator);
+        return decoder.decode();
+}
+
 unsigned short JpegDecoder::parseUShort()
 {
         unsigned short result = (unsigned short)raw[position++];
@@ -175,17 +399,66 @@ unsigned short JpegDecoder::parseUShort()
         return result;
 }
 
-int JpegDecoder::parseEXIF()
+int JpegDecoder::parseEXIF(unsigned char marker)
 {
         CHECK_RANGE(position, 2, raw)
         unsigned short length = parseUShort() - 2;
-        // skip exif meta-data
         CHECK_RANGE(position, length, raw);
+        readOrientation(marker, length);
+        // skip the rest of the meta-data
         position += length;
         return 0;
 }
 
+// orientation tag of the first Exif APP1 segment, the segment starts at position
+void JpegDecoder::readOrientation(unsigned char marker, size_t length)
+{
+        ExifReader exif;
+        unsigned int value;
+        if (marker != 0xE1 || orientation != 1 || length > raw.size() - position
+            || !exif.open(&raw[position], length))
+                return;
+        if (exif.findTag(EXIF_IFD0, EXIF_TAG_ORIENTATION, value) && value >= 1 && value <= 8)
+                orientation = value;
+}
+
+// memory for the orientations which turn rows into columns or reverse their order
+void JpegDecoder::prepareOrientation()
+{
+        orientedImage = nullptr;
+        orientedBuffer.reset();
+        if (outputOrientation() < 3)
+                return;
+        orientedImage = sink->image(orientedStride);
+        if (orientedImage == nullptr) {
+                orientedStride = getOutputWidth() * pixelSize(sink->format());
+                orientedBuffer.reset(new Buffer<unsigned char>(allocator, (size_t)orientedStride * getOutputHeight()));
+                orientedImage = orientedBuffer->data();
+        }
+}
+
 int JpegDecoder::parseSOF0()
+{
+        int errcode = parseFrameHeader();
+        CHECK_ERROR(errcode);
+
+        // init the picture (or whatever receives the decoded rows)
+        if (decodesPixels()) {
+                errcode = sink->begin(getOutputWidth(), getOutputHeight());
+                CHECK_ERROR(errcode);
+                prepareOrientation();
+        }
+
+#if DEBUG
+        cout << "Width: " << width << endl;
+        cout << "Height: " << height << endl;
+        cout << "YCBCR_Y, " << color_y << "YCBCR_CB, " << color_cb << "YCBCR_CR, " << color_cr;
+#endif
+
+        return 0;
+}
+
+int JpegDecoder::parseFrameHeader()
 {
         // parse segment length and remove two because the size for the length itself is included
         CHECK_RANGE(position, 2, raw)
@@ -210,9 +483,6 @@ int JpegDecoder::parseSOF0()
         CHECK_RANGE(position, 2, raw);
         width = parseUShort();
 
-        // init the picture
-        picture.init(width, height);
-
         // parse color scheme
         CHECK_RANGE(position, 1, raw);
         if (raw[position++] != 0x03) {
@@ -246,13 +516,39 @@ int JpegDecoder::parseSOF0()
                 component->vsf = vsf;
                 component->qt = qt;
         }
+        return 0;
+}
 
-#if DEBUG
-        cout << "Width: " << width << endl;
-        cout << "Height: " << height << endl;
-        cout << "YCBCR_Y, " << color_y << "YCBCR_CB, " << color_cb << "YCBCR_CR, " << color_cr;
-#endif
+int JpegDecoder::parseDAC()
+{
+        CHECK_RANGE(position, 2, raw);
+        int length = parseUShort() - 2;
+        if (length % 2 != 0) {
+                return ERROR_NOTSUPPORTED;
+        }
+        CHECK_RANGE(position, length, raw);
 
+        ArithmeticConditioning& conditioning = arithmeticDecoder.conditioning;
+        for (int i = 0; i < length; i += 2) {
+                unsigned char table = (unsigned char)raw[position++];
+                unsigned char value = (unsigned char)raw[position++];
+                int id = table & 0x0F;
+                if (id > 3) {
+                        return ERROR_NOTSUPPORTED;
+                }
+                if (table >> 4) {
+                        // AC: K
+                        if (value < 1 || value > 63)
+                                return ERROR_NOTSUPPORTED;
+                        conditioning.acK[id] = value;
+                } else {
+                        // DC: U in the upper, L in the lower half
+                        conditioning.dcL[id] = value & 0x0F;
+                        conditioning.dcU[id] = value >> 4;
+                        if (conditioning.dcL[id] > conditioning.dcU[id])
+                                return ERROR_NOTSUPPORTED;
+                }
+        }
         return 0;
 }
 
@@ -266,7 +562,7 @@ int JpegDecoder::parseDRI()
 
         CHECK_RANGE(position, 2, raw);
         restartInterval = parseUShort();
-        useRST = true;
+        useRST = restartInterval != 0;
 
 #if DEBUG
         cout << "UseRST: " << useRST << ", Intervall: " << restartInterval << endl;
@@ -373,118 +669,882 @@ int JpegDecoder::parseDQT()
         return 0;
 }
 
-int JpegDecoder::parseSOS()
+// scan header, tables and the MCU layout of the scan
+int JpegDecoder::prepareScan()
 {
-        int error;
-        // temporary arrays for data
-        ColorComponent components[3];
-        int* coef[3];
-        int coefy[256]; // 4 * 64, maximum amount of values to remember in case of supersampling
-        int coefcb[256];
-        int coefcr[256];
-
         // parse scan header and sort color scheme components
-        error = parseScanHeader(components, coef, coefy, coefcb, coefcr);
+        int error = parseScanHeader(scanComponents, scanOrder);
+        CHECK_ERROR(error);
+
+        // the block decoder uses the tables without checking them
+        for (int cid = 0; cid < 3; cid++) {
+                const ColorComponent& component = scanComponents[cid];
+                if (!arithmetic && (hTablesDC[component.htdc] == nullptr || hTablesAC[component.htac] == nullptr))
+                        return ERROR_NOHUFFMANTABLE;
+                if (component.qt > 3 || qTables[component.qt] == nullptr)
+                        return ERROR_INVALIDQTNR;
+        }
+
+        int vsf_max = scanComponents[0].vsf + scanComponents[1].vsf + scanComponents[2].vsf;
+        int hsf_max = scanComponents[0].hsf + scanComponents[1].hsf + scanComponents[2].hsf;
+
+        vsfMax = vsf_max > 3 ? 2 : 1;
+        hsfMax = hsf_max > 3 ? 2 : 1;
+        mcusPerRow = (width + 8 * hsfMax - 1) / (8 * hsfMax);
+        mcuRows = (height + 8 * vsfMax - 1) / (8 * vsfMax);
+        blocksPerMCU = 0;
+        for (int cid = 0; cid < 3; cid++)
+                blocksPerMCU += scanComponents[cid].hsf * scanComponents[cid].vsf;
+
+        // the arithmetic decoder reads the bytes itself instead of the BitStream
+        if (arithmetic)
+                arithmeticDecoder.start((const unsigned char*)&raw[position], raw.size() - position);
+        return 0;
+}
+
+int JpegDecoder::parseSOS()
+{
+        int error = prepareScan();
         CHECK_ERROR(error);
 
         BitStream stream(&raw[position], (raw.size()-position));
-        int previousDC[3] = { 0, 0, 0};
-        int posx = 0;
-        int posy = 0;
+
+        // the profiler counts the events of the calling thread only
+        int workers = profiler != nullptr ? 1 : (threads > 0 ? threads : (int)thread::hardware_concurrency());
+        if (profiler != nullptr)
+                profiler->enter(STAGE_HUFFMAN);
+        if (coefficientOutput != nullptr) {
+                error = decodeCoefficients(stream);
+                CHECK_ERROR(error);
+        } else if (lowFrequencyOutput != nullptr) {
+                error = decodeLowFrequencies(stream);
+                CHECK_ERROR(error);
+        } else {
+                // without restart markers the entropy decoding can only be split speculatively,
+                // every thread needs a few hundred KB of the scan to make up for the second pass
+                unsigned int scanBytes = scanLength(raw, position);
+                int chunks = min(workers, (int)(scanBytes / SPECULATIVE_CHUNK));
+                if (speculative && !useRST && !arithmetic && chunks > 1 && mcuRows >= 2 * workers) {
+                        error = decodeSpeculative(chunks, workers, scanBytes);
+                } else if (workers > 1 && mcuRows >= 4) {
+                        // the worker threads are not worth starting for a few MCU rows
+                        error = decodePipelined(stream, workers - 1);
+                } else {
+                        error = decodeSerial(stream);
+                }
+                CHECK_ERROR(error);
+                if (decodesPixels())
+                        sink->end();
+        }
+        if (profiler != nullptr)
+                profiler->enter(STAGE_MARKERS);
+
+        return checkEOI();
+}
+
+int JpegDecoder::checkEOI()
+{
+        // check if the last two bytes are FF D9 = EOI
+
+        if ( (unsigned char)raw[raw.size()-2] != 0xFF || (unsigned char)raw[raw.size()-1] != JFIF_EOI) {
+                return ERROR_NOEOIMARKER;
+        }
+
+        return 0;
+}
+
+int JpegDecoder::decodeSerial(BitStream& stream)
+{
+        Buffer<int> coefficients(allocator, mcusPerRow * blocksPerMCU * 64);
+        Buffer<unsigned char> band(allocator, bandSize());
+        int previousDC[3] = { 0, 0, 0 };
+        int mcu = 0;
+
+        for (int row = 0; row < mcuRows; row++) {
+                int error = decodeRow(stream, row, mcu, previousDC, &coefficients[0], &band[0]);
+                CHECK_ERROR(error);
+        }
+        return 0;
+}
+
+// entropy decoding, reconstruction and output of one MCU row
+int JpegDecoder::decodeRow(BitStream& stream, int row, int& mcu, int* previousDC, int* coefficients, unsigned char* band)
+{
+        if (profiler != nullptr)
+                profiler->enter(STAGE_HUFFMAN);
+        int error = decodeMCURow(stream, mcu, previousDC, coefficients);
+        CHECK_ERROR(error);
+        int stride;
+        unsigned char* rows = reconstructMCURow(row, coefficients, band, stride);
+        if (profiler != nullptr)
+                profiler->enter(STAGE_STORE);
+        return emitBand(row, rows, stride);
+}
+
+/*!
+ * The entropy decoding has to be done in order (without restart markers), the rest of the
+ * work for a MCU row only depends on its coefficients. The calling thread decodes the
+ * MCU rows into a pool of coefficient buffers and hands the row numbers to the worker
+ * threads through a lock-free ring buffer, the workers run the IDCT, upsampling, color
+ * conversion and store the pixels. A buffer is reused once its row has been finished.
+ * The finished bands are handed to the sink in order.
+ */
+int JpegDecoder::decodePipelined(BitStream& stream, int workers)
+{
+        int slots = 2 * workers + 2;
+        int rowSize = mcusPerRow * blocksPerMCU * 64;
+        Buffer<int> coefficients(allocator, slots * rowSize);
+        unique_ptr<atomic<bool>[]> busy(new atomic<bool>[slots]);
+        for (int i = 0; i < slots; i++)
+                busy[i].store(false);
+
+        RingBuffer<int> rows(slots);
+        atomic<bool> finished(false);
+        atomic<int> nextBand(0);
+        atomic<int> sinkError(0);
+
+        auto process = [&](int row, unsigned char* scratch) {
+                int slot = row % slots;
+                int stride;
+                unsigned char* band = reconstructMCURow(row, &coefficients[slot * rowSize], scratch, stride);
+                busy[slot].store(false, memory_order_release);
+
+                while (nextBand.load(memory_order_acquire) != row)
+                        this_thread::yield();
+                if (sinkError.load(memory_order_relaxed) == 0) {
+                        int error = emitBand(row, band, stride);
+                        if (error != 0)
+                                sinkError.store(error, memory_order_relaxed);
+                }
+                nextBand.store(row + 1, memory_order_release);
+        };
+
+        vector<thread> pool;
+        for (int i = 0; i < workers; i++) {
+                pool.push_back(thread([&]() {
+                        // allocated by the worker, so it's local to its node
+                        Buffer<unsigned char> band(allocator, bandSize());
+                        int row;
+                        for (;;) {
+                                if (rows.pop(row)) {
+                                        process(row, &band[0]);
+                                } else if (finished.load(memory_order_acquire)) {
+                                        // everything pushed before finished is visible now
+                                        if (!rows.pop(row))
+                                                break;
+                                        process(row, &band[0]);
+                                } else {
+                                        this_thread::yield();
+                                }
+                        }
+                }));
+        }
+
+        int previousDC[3] = { 0, 0, 0 };
+        int mcu = 0;
+        int error = 0;
+        for (int row = 0; row < mcuRows && sinkError.load(memory_order_relaxed) == 0; row++) {
+                int slot = row % slots;
+                while (busy[slot].load(memory_order_acquire))
+                        this_thread::yield();
+
+                error = decodeMCURow(stream, mcu, previousDC, &coefficients[slot * rowSize]);
+                if (error != 0)
+                        break;
+
+                busy[slot].store(true, memory_order_relaxed);
+                while (!rows.push(row))
+                        this_thread::yield();
+        }
+
+        finished.store(true, memory_order_release);
+        for (auto& worker : pool)
+                worker.join();
+
+        return error != 0 ? error : sinkError.load();
+}
+
+/*!
+ * Splits the entropy decoding of a scan without restart markers across the threads.
+ *
+ * The scan is cut into chunks. The thread of a chunk guesses that a MCU starts at the
+ * beginning of its chunk and records the bit position and the DC predictors at every MCU
+ * boundary until it has passed the end of the chunk. A wrong guess decodes garbage at
+ * first (an invalid code restarts the guess at the next byte), but huffman codes
+ * resynchronize within a few symbols, from then on the thread passes the same MCU
+ * boundaries as a decoder which started at the beginning of the scan.
+ *
+ * The chunks are stitched in order: the boundary where the previous chunk ended is
+ * looked up in the boundaries of the next chunk, from a match on its positions are
+ * correct and its DC predictors only differ by a constant, which is corrected. Without a
+ * match the MCUs are decoded serially until a recorded boundary is met again, so a chunk
+ * which never synchronizes costs a serial decode of its part of the scan.
+ *
+ * With the position and the DC predictors at the start of every MCU row the rows are
+ * decoded and reconstructed independently by all threads, the bands are passed to the
+ * sink in order.
+ */
+int JpegDecoder::decodeSpeculative(int chunks, int workers, unsigned int scanBytes)
+{
+        vector<unsigned int> bounds(chunks + 1);
+        for (int c = 0; c <= chunks; c++)
+                bounds[c] = (unsigned int)((unsigned long long)scanBytes * c / chunks) * 8;
+        vector<vector<SyncPoint>> points(chunks);
+
+        auto speculate = [&](int c) {
+                vector<SyncPoint>& list = points[c];
+                vector<int> scratch(blocksPerMCU * 64);
+                BitStream stream(&raw[position], raw.size() - position);
+                // the last MCU ends in the byte in front of the marker (padding < 8 bits)
+                unsigned int limit = c + 1 < chunks ? bounds[c + 1] : bounds[chunks] - 7;
+                list.reserve((size_t)mcuRows * mcusPerRow / chunks + 16);
+
+                unsigned int start = bounds[c];
+                while (start < limit) {
+                        SyncPoint point = { start, { 0, 0, 0 } };
+                        stream.setPosition(start);
+                        list.push_back(point);
+                        int error = 0;
+                        while (point.position < limit) {
+                                error = decodeMCU(stream, point.dc, &scratch[0]);
+                                if (error != 0)
+                                        break;
+                                point.position = stream.getPosition();
+                                list.push_back(point);
+                        }
+                        if (error == 0)
+                                break;
+                        // wrong guess (or corrupt data), start again behind the invalid code
+                        list.clear();
+                        start = (stream.getPosition() / 8 + 1) * 8;
+                }
+        };
+
+        vector<thread> pool;
+        for (int c = 1; c < chunks; c++)
+                pool.push_back(thread(speculate, c));
+        speculate(0);
+        for (auto& worker : pool)
+                worker.join();
+        pool.clear();
+
+        // stitching: state is the true decoder state at the start of MCU number mcu
+        vector<SyncPoint> rowStarts(mcuRows);
+        SyncPoint state = { 0, { 0, 0, 0 } };
+        BitStream stream(&raw[position], raw.size() - position);
+        vector<int> scratch(blocksPerMCU * 64);
+        int lastRowStart = (mcuRows - 1) * mcusPerRow;
+        int chunk = -1;                 // list the state has been found in
+        size_t index = 0;
+        int correction[3];
+        int serialMCUs = 0;
+        int rows = mcuRows;             // number of rows with a known start
+        int error = 0;
+
+        for (int mcu = 0; ; mcu++) {
+                if (mcu % mcusPerRow == 0)
+                        rowStarts[mcu / mcusPerRow] = state;
+                if (mcu == lastRowStart)
+                        break;
+
+                if (chunk >= 0 && index + 1 == points[chunk].size())
+                        chunk = -1;     // end of the chunk, continue in the next one
+                if (chunk < 0) {
+                        int c = upper_bound(bounds.begin(), bounds.begin() + chunks, state.position) - bounds.begin() - 1;
+                        const vector<SyncPoint>& list = points[c];
+                        auto match = lower_bound(list.begin(), list.end(), state.position,
+                                                 [](const SyncPoint& point, unsigned int position) { return point.position < position; });
+                        if (match != list.end() && match->position == state.position) {
+                                chunk = c;
+                                index = match - list.begin();
+                                for (int i = 0; i < 3; i++)
+                                        correction[i] = state.dc[i] - match->dc[i];
+                        }
+                }
+
+                if (chunk >= 0 && index + 1 < points[chunk].size()) {
+                        index++;
+                        const SyncPoint& point = points[chunk][index];
+                        state.position = point.position;
+                        for (int i = 0; i < 3; i++)
+                                state.dc[i] = point.dc[i] + correction[i];
+                        continue;
+                }
+
+                // no synchronization
+                chunk = -1;
+                stream.setPosition(state.position);
+                error = decodeMCU(stream, state.dc, &scratch[0]);
+                if (error != 0) {
+                        // the rows in front of the error are decoded like in the serial decoder
+                        rows = mcu / mcusPerRow + 1;
+                        break;
+                }
+                state.position = stream.getPosition();
+                serialMCUs++;
+        }
+#if DEBUG
+        cout << "speculative decoding: " << chunks << " chunks, " << serialMCUs << " of "
+             << mcuRows * mcusPerRow << " MCUs stitched serially" << endl;
+#endif
+
+        atomic<int> nextRow(0);
+        atomic<int> nextBand(0);
+        atomic<int> failure(0);
+        auto work = [&]() {
+                Buffer<int> coefficients(allocator, mcusPerRow * blocksPerMCU * 64);
+                Buffer<unsigned char> band(allocator, bandSize());
+                BitStream stream(&raw[position], raw.size() - position);
+                int row;
+                while ((row = nextRow.fetch_add(1, memory_order_relaxed)) < rows) {
+                        int mcu = row * mcusPerRow;
+                        stream.setPosition(rowStarts[row].position);
+                        int error = decodeMCURow(stream, mcu, rowStarts[row].dc, &coefficients[0]);
+                        int stride = 0;
+                        unsigned char* pixels = nullptr;
+                        if (error == 0)
+                                pixels = reconstructMCURow(row, &coefficients[0], &band[0], stride);
+
+                        while (nextBand.load(memory_order_acquire) != row)
+                                this_thread::yield();
+                        if (failure.load(memory_order_relaxed) == 0) {
+                                if (error == 0)
+                                        error = emitBand(row, pixels, stride);
+                                if (error != 0)
+                                        failure.store(error, memory_order_relaxed);
+                        }
+                        nextBand.store(row + 1, memory_order_release);
+                }
+        };
+
+        for (int i = 1; i < workers; i++)
+                pool.push_back(thread(work));
+        work();
+        for (auto& worker : pool)
+                worker.join();
+
+        return failure.load() != 0 ? failure.load() : error;
+}
+
+// entropy decoding only, the quantized coefficients are stored in the block grids of the components
+int JpegDecoder::decodeCoefficients(BitStream& stream)
+{
+        CoefficientImage& image = *coefficientOutput;
+        image.width = width;
+        image.height = height;
+
+        ColorComponent* colors[3] = { &color_y, &color_cb, &color_cr };
+        for (int c = 0; c < 3; c++) {
+                ComponentCoefficients& component = image.components[c];
+                component.hsf = colors[c]->hsf;
+                component.vsf = colors[c]->vsf;
+                component.qt = colors[c]->qt;
+                component.blocksWide = mcusPerRow * component.hsf;
+                component.blocksHigh = mcuRows * component.vsf;
+                component.blocks.assign(component.blocksWide * component.blocksHigh * 64, 0);
+        }
+        for (int t = 0; t < 4; t++) {
+                image.hasQTable[t] = qTables[t] != nullptr;
+                for (int i = 0; image.hasQTable[t] && i < 64; i++)
+                        image.qTables[t][zz[i]] = qTables[t]->values[i];
+        }
+
+        vector<int> coefficients(mcusPerRow * blocksPerMCU * 64);
+        int previousDC[3] = { 0, 0, 0 };
         int mcu = 0;
 
-        int vsf_max = components[0].vsf + components[1].vsf + components[2].vsf;
-        int hsf_max = components[0].hsf + components[1].hsf + components[2].hsf;
+        dequantize = false;
+        for (int row = 0; row < mcuRows; row++) {
+                int error = decodeMCURow(stream, mcu, previousDC, &coefficients[0]);
+                if (error != 0) {
+                        dequantize = true;
+                        return error;
+                }
 
-        vsf_max = vsf_max > 3 ? 2 : 1;
-        hsf_max = hsf_max > 3 ? 2 : 1;
+                const int* source = &coefficients[0];
+                for (int x = 0; x < mcusPerRow; x++) {
+                        for (int cid = 0; cid < 3; cid++) {
+                                ComponentCoefficients& component = image.components[scanOrder[cid]];
+                                for (int v = 0; v < component.vsf; v++) {
+                                        for (int h = 0; h < component.hsf; h++) {
+                                                short* block = component.block(x * component.hsf + h, row * component.vsf + v);
+                                                for (int k = 0; k < 64; k++)
+                                                        block[k] = (short)source[k];
+                                                source += 64;
+                                        }
+                                }
+                        }
+                }
+        }
+        dequantize = true;
+        return 0;
+}
+
+int JpegDecoder::readCoefficients(CoefficientImage& image)
+{
+        coefficientOutput = &image;
+        int errcode = decode();
+        coefficientOutput = nullptr;
+        return errcode;
+}
+
+// entropy decoding only, the first coefficients of the luma blocks inside the image are kept
+int JpegDecoder::decodeLowFrequencies(BitStream& stream)
+{
+        LowFrequencyImage& image = *lowFrequencyOutput;
+        int count = max(1, min(64, image.coefficients));
+        int planeWidth, planeHeight;
+        getPlaneSize(0, planeWidth, planeHeight);
+        image.coefficients = count;
+        image.blocksWide = (planeWidth + 7) / 8;
+        image.blocksHigh = (planeHeight + 7) / 8;
+        image.values.assign(image.blocksWide * image.blocksHigh * count, 0);
+
+        // position of the luma in the scan
+        int luma = 0;
+        int lumaBlock = 0;
+        for (int cid = 0; scanOrder[cid] != 0; cid++) {
+                luma = cid + 1;
+                lumaBlock += scanComponents[cid].hsf * scanComponents[cid].vsf;
+        }
+        const ColorComponent& component = scanComponents[luma];
 
-        while ( posy < height) {
+        vector<int> coefficients(mcusPerRow * blocksPerMCU * 64);
+        int previousDC[3] = { 0, 0, 0 };
+        int mcu = 0;
+        for (int row = 0; row < mcuRows; row++) {
+                int error = decodeMCURow(stream, mcu, previousDC, &coefficients[0]);
+                CHECK_ERROR(error);
+
+                for (int x = 0; x < mcusPerRow; x++) {
+                        const int* block = &coefficients[(x * blocksPerMCU + lumaBlock) * 64];
+                        for (int v = 0; v < component.vsf; v++) {
+                                for (int h = 0; h < component.hsf; h++, block += 64) {
+                                        int bx = x * component.hsf + h;
+                                        int by = row * component.vsf + v;
+                                        if (bx >= image.blocksWide || by >= image.blocksHigh)
+                                                continue;
+                                        int* values = &image.values[(by * image.blocksWide + bx) * count];
+                                        for (int k = 0; k < count; k++)
+                                                values[k] = block[zz[k]];
+                                }
+                        }
+                }
+        }
+        return 0;
+}
+
+int JpegDecoder::readLowFrequencies(LowFrequencyImage& image)
+{
+        lowFrequencyOutput = &image;
+        int errcode = decode();
+        lowFrequencyOutput = nullptr;
+        return errcode;
+}
+
+// entropy decoding of one MCU, the blocks are stored in scan order
+inline int JpegDecoder::decodeMCU(BitStream& stream, int* previousDC, int* coefficients)
+{
+        for (int cid = 0; cid < 3; cid++) {
+                const ColorComponent& component = scanComponents[cid];
+                for (int b = 0; b < component.vsf * component.hsf; b++) {
+                        int error;
+                        if (arithmetic) {
+                                error = arithmeticDecoder.decodeBlock(cid, component.htdc, component.htac,
+                                                                      dequantize ? qTables[component.qt]->values : unitTable->values,
+                                                                      previousDC[cid], coefficients);
+                                CHECK_ERROR(error);
+                                coefficients += 64;
+                                continue;
+                        }
+                        error = parseBlock(stream, *hTablesDC[component.htdc], *hTablesAC[component.htac],
+                                               dequantize ? *qTables[component.qt] : *unitTable, previousDC[cid],
+                                               coefficients);
+                        CHECK_ERROR(error);
+                        coefficients += 64;
+                }
+        }
+        return 0;
+}
+
+// entropy decoding of one MCU row, the blocks are stored in scan order
+int JpegDecoder::decodeMCURow(BitStream& stream, int& mcu, int* previousDC, int* coefficients)
+{
+        int error;
+        for (int x = 0; x < mcusPerRow; x++) {
                 // reset previousDC array after #-MCU's (amount of MCU's defined by DRI-marker)
                 if (useRST && mcu % restartInterval == 0) {
                         previousDC[0] = previousDC[1] = previousDC[2] = 0;
                 }
 
+                error = decodeMCU(stream, previousDC, coefficients);
+                CHECK_ERROR(error);
+                coefficients += blocksPerMCU * 64;
 
+                mcu++;
+                // a RSTn marker follows the last MCU of every restart interval
+                if (useRST && mcu % restartInterval == 0) {
+                        if (arithmetic)
+                                arithmeticDecoder.restart();
+                        else
+                                skipRST(stream);
+                }
+        }
+        return 0;
+}
+
+// converts the upsampled values of one MCU into the band, clipped to the image size
+template<PixelFormat format>
+static inline unsigned char* storePixel(unsigned char* pixel, int y, int cb, int cr)
+{
+        int red = Color::toRed(y, cb, cr);
+        int green = Color::toGreen(y, cb, cr);
+        int blue = Color::toBlue(y, cb, cr);
+        red = CLIP(red);
+        green = CLIP(green);
+        blue = CLIP(blue);
+        if (format == PIXEL_XRGB32) {
+                *(unsigned int*)pixel = (red << 16) | (green << 8) | blue;
+                return pixel + 4;
+        }
+        pixel[0] = red;
+        pixel[1] = green;
+        pixel[2] = blue;
+        return pixel + 3;
+}
+
+// output address of the decoded pixel (x, y): origin + x * stepX + y * stepY (in bytes)
+struct PixelMapping
+{
+        unsigned char* origin;
+        ptrdiff_t stepX;
+        ptrdiff_t stepY;
+};
+
+// the mapping of an image of width x height pixels into memory with the given stride
+static PixelMapping orientationMapping(int orientation, unsigned char* memory, int stride, int width, int height, int size)
+{
+        ptrdiff_t right = (ptrdiff_t)(width - 1) * size;
+        ptrdiff_t bottom = (ptrdiff_t)(height - 1) * size;
+        switch (orientation) {
+        case 2:         // mirrored horizontally
+                return { memory + right, -size, stride };
+        case 3:         // rotated by 180 degrees
+                return { memory + (ptrdiff_t)(height - 1) * stride + right, -size, -stride };
+        case 4:         // mirrored vertically
+                return { memory + (ptrdiff_t)(height - 1) * stride, size, -stride };
+        case 5:         // transposed
+                return { memory, stride, size };
+        case 6:         // rotated by 90 degrees clockwise
+                return { memory + bottom, stride, -size };
+        case 7:         // transversed
+                return { memory + (ptrdiff_t)(width - 1) * stride + bottom, -stride, -size };
+        case 8:         // rotated by 90 degrees counterclockwise
+                return { memory + (ptrdiff_t)(width - 1) * stride, -stride, size };
+        default:
+                return { memory, size, stride };
+        }
+}
+
+template<PixelFormat format>
+static inline void storeMCU(unsigned char* band, int stride, int posx, int width, int rows,
+                            int hsfMax, int vsfMax, const int* coefy, const int* coefcb, const int* coefcr)
+{
+        for (int v = 0; v < vsfMax; v++) {
+                int ymax = min(8, rows - v * 8);
+                for (int h = 0; h < hsfMax; h++) {
+                        int x0 = posx + h * 8;
+                        int xmax = min(8, width - x0);
+                        for (int ky = 0; ky < ymax; ky++) {
+                                unsigned char* pixel = band + (v * 8 + ky) * stride + x0 * pixelSize(format);
+                                int index = (v * 128 + h * 64) + ky * 8;
+                                for (int kx = 0; kx < xmax; kx++, index++)
+                                        pixel = storePixel<format>(pixel, coefy[index], coefcb[index], coefcr[index]);
+                        }
+                }
+        }
+}
+
+// storeMCU for oriented output, the rows of the MCU start at mapping.origin
+template<PixelFormat format>
+static inline void storeMCUOriented(const PixelMapping& mapping, int posx, int width, int rows,
+                                    int hsfMax, int vsfMax, const int* coefy, const int* coefcb, const int* coefcr)
+{
+        for (int v = 0; v < vsfMax; v++) {
+                int ymax = min(8, rows - v * 8);
+                for (int h = 0; h < hsfMax; h++) {
+                        int x0 = posx + h * 8;
+                        int xmax = min(8, width - x0);
+                        for (int ky = 0; ky < ymax; ky++) {
+                                unsigned char* pixel = mapping.origin + x0 * mapping.stepX + (v * 8 + ky) * mapping.stepY;
+                                int index = (v * 128 + h * 64) + ky * 8;
+                                for (int kx = 0; kx < xmax; kx++, index++, pixel += mapping.stepX)
+                                        storePixel<format>(pixel, coefy[index], coefcb[index], coefcr[index]);
+                        }
+                }
+        }
+}
+
+/*!
+ * Memory and mapping for the MCU row starting at pixel row posy (of the scaled image)
+ * with auto orientation. Mirrored rows go to the memory of the sink or the scratch
+ * band like unoriented ones, the other orientations into the whole oriented image.
+ */
+unsigned char* JpegDecoder::orientedBand(int posy, unsigned char* scratch, int& stride, PixelMapping& mapping)
+{
+        int size = pixelSize(sink->format());
+        if (orientedImage != nullptr) {
+                stride = orientedStride;
+                mapping = orientationMapping(outputOrientation(), orientedImage, stride, getScaledWidth(), getScaledHeight(), size);
+                mapping.origin += posy * mapping.stepY;
+                return orientedImage;
+        }
+        unsigned char* band = sink->target(posy, stride);
+        if (band == nullptr) {
+                band = scratch;
+                stride = bandStride();
+        }
+        mapping = orientationMapping(outputOrientation(), band, stride, getScaledWidth(), 1, size);
+        return band;
+}
+
+// IDCT, upsampling and color conversion of one MCU row, the pixels are written into
+// the memory of the sink if it provides some and into the scratch band otherwise
+unsigned char* JpegDecoder::reconstructMCURow(int row, int* coefficients, unsigned char* scratch, int& stride)
+{
+        // temporary arrays for data
+        int coefy[256]; // 4 * 64, maximum amount of values to remember in case of supersampling
+        int coefcb[256];
+        int coefcr[256];
+        int* buffers[3] = { coefy, coefcb, coefcr };
+        int* coef[3];
+        for (int cid = 0; cid < 3; cid++)
+                coef[cid] = buffers[scanOrder[cid]];
+
+        if (planarOutput != nullptr) {
+                if (profiler != nullptr)
+                        profiler->enter(STAGE_IDCT);
+                reconstructPlanar(row, coefficients);
+                stride = 0;
+                return nullptr;
+        }
+
+        if (scale > 1)
+                return reconstructScaled(row, coefficients, scratch, stride);
+
+        // the profiler needs the IDCT of the whole row in one piece, otherwise it is done
+        // MCU by MCU while the values are in the cache
+        bool transformed = profiler != nullptr;
+        if (transformed) {
+                profiler->enter(STAGE_IDCT);
+                for (int i = 0; i < mcusPerRow * blocksPerMCU; i++)
+                        DCT::inverse((IDCTMode)idctMode, coefficients + i * 64);
+                profiler->enter(STAGE_COLOR);
+        }
+
+        int posy = row * 8 * vsfMax;
+        int rows = min(8 * vsfMax, height - posy);
+        PixelMapping mapping;
+        bool oriented = outputOrientation() != 1;
+        unsigned char* band = oriented ? orientedBand(posy, scratch, stride, mapping) : sink->target(posy, stride);
+        if (band == nullptr) {
+                band = scratch;
+                stride = bandStride();
+        }
+        PixelFormat format = sink->format();
+
+        for (int posx = 0; posx < width; posx += 8 * hsfMax) {
                 for (int cid = 0; cid < 3; cid++) {
-                        for (int v = 0; v < components[cid].vsf; v++) { 
-                                for (int h = 0; h < components[cid].hsf; h++) {
-                                        error = parseBlock(stream, hTablesDC[components[cid].htdc],
-                                                   hTablesAC[components[cid].htac],
-                                                   qTables[components[cid].qt], previousDC[cid],
-                                                   coef[cid] + (128 * v + 64 * h));
-                                        CHECK_ERROR(error);
-                
+                        const ColorComponent& component = scanComponents[cid];
+                        for (int v = 0; v < component.vsf; v++) {
+                                for (int h = 0; h < component.hsf; h++) {
+                                        int* block = coef[cid] + (128 * v + 64 * h);
+                                        memcpy(block, coefficients, 64 * sizeof(int));
+                                        coefficients += 64;
+
                                         // apply IDCT onto values
-                                        // DCT::transform(coef[cid] + (128 * v + 64 * h));
-                                        DCT::fastTransform(coef[cid] + (128 * v + 64 * h));
-                                        // check for reset-marker and skip those two bytes
-                                        skipRST(stream);
+                                        if (!transformed)
+                                                DCT::inverse((IDCTMode)idctMode, block);
                                 }
                         }
                         // scale
-                        scaleHorizontal(hsf_max, vsf_max, components[cid].hsf, components[cid].vsf, coef[cid]);
-                        scaleVertical(hsf_max, vsf_max, components[cid].hsf, components[cid].vsf, coef[cid]);
+                        Upsample::horizontal(hsfMax, component.hsf, component.vsf, coef[cid]);
+                        Upsample::vertical(hsfMax, vsfMax, component.vsf, coef[cid]);
                 }
-                
+
                 // store pixel-data
-                for (int v = 0; v < vsf_max; v++) {
-                        for (int h = 0; h < hsf_max; h++) {
-                                for (int k = 0; k < 64; k++) {
-                                        int index = (v * 128 + h * 64) + k;
-                                        int red = Color::toRed(coefy[index], coefcb[index], coefcr[index]);
-                                        int green = Color::toGreen(coefy[index], coefcb[index], coefcr[index]);
-                                        int blue = Color::toBlue(coefy[index], coefcb[index], coefcr[index]);
-                                        int x = posx + h * 8 + (k % 8);
-                                        int y = posy + v * 8 + (k / 8);
-                                        picture.setPixel(x, y, red, green, blue);
+                if (oriented) {
+                        if (format == PIXEL_XRGB32)
+                                storeMCUOriented<PIXEL_XRGB32>(mapping, posx, width, rows, hsfMax, vsfMax, coefy, coefcb, coefcr);
+                        else
+                                storeMCUOriented<PIXEL_RGB>(mapping, posx, width, rows, hsfMax, vsfMax, coefy, coefcb, coefcr);
+                } else if (format == PIXEL_XRGB32) {
+                        storeMCU<PIXEL_XRGB32>(band, stride, posx, width, rows, hsfMax, vsfMax, coefy, coefcb, coefcr);
+                } else {
+                        storeMCU<PIXEL_RGB>(band, stride, posx, width, rows, hsfMax, vsfMax, coefy, coefcb, coefcr);
+                }
+        }
+        return band;
+}
+
+// stores the samples of a scaled MCU row (n x n per block), subsampled components are replicated
+template<PixelFormat format>
+static inline void storeScaled(const PixelMapping& mapping, int width, int rows, int blocksPerMCU, int n,
+                               int hsfMax, int vsfMax, const ColorComponent* components, const int* order,
+                               const int* coefficients)
+{
+        // first block and sampling factors of Y, Cb and Cr inside a MCU
+        int offsets[3];
+        int hsf[3];
+        int vsf[3];
+        for (int cid = 0, offset = 0; cid < 3; cid++) {
+                offsets[order[cid]] = offset;
+                hsf[order[cid]] = components[cid].hsf;
+                vsf[order[cid]] = components[cid].vsf;
+                offset += components[cid].hsf * components[cid].vsf * 64;
+        }
+
+        int mcuWidth = n * hsfMax;
+        for (int posx = 0; posx < width; posx += mcuWidth) {
+                const int* mcu = coefficients + (posx / mcuWidth) * blocksPerMCU * 64;
+                int xmax = min(mcuWidth, width - posx);
+                for (int y = 0; y < rows; y++) {
+                        unsigned char* pixel = mapping.origin + y * mapping.stepY + posx * mapping.stepX;
+                        const int* lines[3];
+                        for (int c = 0; c < 3; c++) {
+                                int cy = y * vsf[c] / vsfMax;
+                                lines[c] = mcu + offsets[c] + (cy / n) * hsf[c] * 64 + (cy % n) * n;
+                        }
+                        for (int x = 0; x < xmax; x++) {
+                                int samples[3];
+                                for (int c = 0; c < 3; c++) {
+                                        int cx = x * hsf[c] / hsfMax;
+                                        samples[c] = lines[c][(cx / n) * 64 + cx % n];
                                 }
+                                storePixel<format>(pixel, samples[0], samples[1], samples[2]);
+                                pixel += mapping.stepX;
                         }
                 }
+        }
+}
 
-                mcu++;
-                posx += 8 * hsf_max;
-                if (posx >= width) { posx = 0; posy += 8 * vsf_max; }
+// the pixels at 1/scale: reduced IDCT of every block, then upsampling and color conversion
+unsigned char* JpegDecoder::reconstructScaled(int row, int* coefficients, unsigned char* scratch, int& stride)
+{
+        int n = 8 / scale;
+        int posy = row * 8 * vsfMax / scale;
+        int rows = min(n * vsfMax, getScaledHeight() - posy);
+        PixelMapping mapping;
+        unsigned char* band;
+        if (outputOrientation() != 1) {
+                band = orientedBand(posy, scratch, stride, mapping);
+        } else {
+                band = sink->target(posy, stride);
+                if (band == nullptr) {
+                        band = scratch;
+                        stride = bandStride();
+                }
+                mapping = orientationMapping(1, band, stride, getScaledWidth(), rows, pixelSize(sink->format()));
         }
 
-        // check if the last two bytes are FF D9 = EOI
+        if (profiler != nullptr)
+                profiler->enter(STAGE_IDCT);
+        for (int i = 0; i < mcusPerRow * blocksPerMCU; i++)
+                DCT::scaledInverse(coefficients + i * 64, n);
+        if (profiler != nullptr)
+                profiler->enter(STAGE_COLOR);
 
-        if ( (unsigned char)raw[raw.size()-2] != 0xFF || (unsigned char)raw[raw.size()-1] != JFIF_EOI) {
-                return ERROR_NOEOIMARKER;
+        if (sink->format() == PIXEL_XRGB32) {
+                storeScaled<PIXEL_XRGB32>(mapping, getScaledWidth(), rows, blocksPerMCU, n, hsfMax, vsfMax,
+                                          scanComponents, scanOrder, coefficients);
+        } else {
+                storeScaled<PIXEL_RGB>(mapping, getScaledWidth(), rows, blocksPerMCU, n, hsfMax, vsfMax,
+                                       scanComponents, scanOrder, coefficients);
         }
-
-        return 0;
+        return band;
 }
 
-void JpegDecoder::scaleHorizontal(int hsf_max, int vsf_max, int hsf, int vsf, int* values)
+// IDCT only, every block is stored at its position in the plane of its component
+void JpegDecoder::reconstructPlanar(int row, int* coefficients)
 {
-        if (hsf_max == hsf)
-                return;
-        for (int j = 0; j < 2; ++j) {
-                for (int i = 63; i >= 0; --i) {
-                        values[2 * i] = values[i];
-                        values[2 * i + 1] = values[i];
+        int planeWidths[3], planeHeights[3];
+        for (int c = 0; c < 3; c++)
+                getPlaneSize(c, planeWidths[c], planeHeights[c]);
+
+        int block[64];
+        for (int mcu = 0; mcu < mcusPerRow; mcu++) {
+                for (int cid = 0; cid < 3; cid++) {
+                        const ColorComponent& component = scanComponents[cid];
+                        int c = scanOrder[cid];
+                        unsigned char* plane = planarOutput->planes[c];
+                        int stride = planarOutput->strides[c];
+
+                        for (int v = 0; v < component.vsf; v++) {
+                                for (int h = 0; h < component.hsf; h++) {
+                                        memcpy(block, coefficients, 64 * sizeof(int));
+                                        coefficients += 64;
+
+                                        int x0 = (mcu * component.hsf + h) * 8;
+                                        int y0 = (row * component.vsf + v) * 8;
+                                        // blocks in the padding of the last MCU are skipped
+                                        if (x0 >= planeWidths[c] || y0 >= planeHeights[c])
+                                                continue;
+                                        DCT::inverse((IDCTMode)idctMode, block);
+
+                                        int columns = min(8, planeWidths[c] - x0);
+                                        int rows = min(8, planeHeights[c] - y0);
+                                        for (int y = 0; y < rows; y++) {
+                                                unsigned char* out = plane + (size_t)(y0 + y) * stride + x0;
+                                                for (int x = 0; x < columns; x++)
+                                                        out[x] = (unsigned char)block[y * 8 + x];
+                                        }
+                                }
+                        }
                 }
-                if (vsf_max != vsf)
-                        return;
-                else
-                        values += 128;
         }
 }
 
-void JpegDecoder::scaleVertical(int hsf_max, int vsf_max, int hsf, int vsf, int* values)
+void JpegDecoder::getPlaneSize(int component, int& planeWidth, int& planeHeight)
 {
-        if (vsf_max == vsf)
-                return;
-        for (int v = 7; v >= 0; --v) {
-                for (int h = 0; h < 16; ++h) {
-                        values [v * 2 * 16 + h] = values[v * 16 + h];
-                        values [(v * 2 + 1) * 16 + h] = values [v * 16 + h];
+        const ColorComponent* colors[3] = { &color_y, &color_cb, &color_cr };
+        int hsf = max(color_y.hsf, max(color_cb.hsf, color_cr.hsf));
+        int vsf = max(color_y.vsf, max(color_cb.vsf, color_cr.vsf));
+        // A.1.1: x = ceil(X * H / Hmax)
+        planeWidth = (width * colors[component]->hsf + hsf - 1) / hsf;
+        planeHeight = (height * colors[component]->vsf + vsf - 1) / vsf;
+}
+
+int JpegDecoder::decodePlanar(const PlanarImage& image)
+{
+        planarOutput = &image;
+        int errcode = decode();
+        planarOutput = nullptr;
+        return errcode;
+}
+
+int JpegDecoder::emitBand(int row, const unsigned char* band, int stride)
+{
+        if (planarOutput != nullptr)
+                return 0;
+
+        int bandRows = 8 * vsfMax / scale;
+        if (orientedImage != nullptr) {
+                // every row of the oriented image is complete once the last MCU row is stored
+                if (row != mcuRows - 1)
+                        return 0;
+                for (int y = 0; y < getOutputHeight(); y += bandRows) {
+                        int error = sink->band(y, min(bandRows, getOutputHeight() - y), orientedImage + (size_t)y * orientedStride,
+                                               orientedStride);
+                        CHECK_ERROR(error);
                 }
+                return 0;
         }
+        int y = row * bandRows;
+        int rows = min(bandRows, getScaledHeight() - y);
+        return sink->band(y, rows, band, stride);
 }
 
-inline int JpegDecoder::parseScanHeader(ColorComponent* components, int** coef, int* cy, int* ccb, int* ccr)
+inline int JpegDecoder::parseScanHeader(ColorComponent* components, int* order)
 {
         // parsing scan header
         CHECK_RANGE(position, 12, raw)
@@ -499,29 +1559,31 @@ inline int JpegDecoder::parseScanHeader(ColorComponent* components, int** coef,
         // parse order of components and the number of the according AC and DC huffman tables
         // 2 bytes per component
 
-        coef[0] = coef[1] = coef[2] = nullptr;
-
         for(int i = 0; i < 3; i++) {
                 unsigned char componentnr = (unsigned char)raw[position++];
-                if (coef[i] != nullptr)
-                        return ERROR_COLORSCHEME;
                 switch(componentnr) {
                 case 0x01:
-                        components[i] = color_y; coef[i] = cy; break;
+                        components[i] = color_y; order[i] = 0; break;
                 case 0x02:
-                        components[i] = color_cb; coef[i] = ccb; break;
+                        components[i] = color_cb; order[i] = 1; break;
                 case 0x03:
-                        components[i] = color_cr; coef[i] = ccr; break;
+                        components[i] = color_cr; order[i] = 2; break;
                 default:
                         return ERROR_COLORSCHEME;
                 }
+                for (int j = 0; j < i; j++) {
+                        if (order[j] == order[i])
+                                return ERROR_COLORSCHEME;
+                }
                 unsigned char numbers = (unsigned char)raw[position++];
 #if DEBUG
                 cout << "Scan-Header: ComponentNr: " << (int)componentnr << ", htac: " << (numbers & 0x0F) << ", htdc: " << (numbers >> 4) << endl;
 #endif
                 components[i].htac = numbers & 0x0F;
                 components[i].htdc = numbers >> 4;
-                if (!(components[i].htac == 0 || components[i].htdc == 1) || !(components[i].htdc == 0 || components[i].htdc == 1)) {
+                // baseline huffman tables 0 and 1, arithmetic conditioning tables 0..3
+                int maxTable = arithmetic ? 3 : 1;
+                if (components[i].htac > maxTable || components[i].htdc > maxTable) {
                         return ERROR_INVALIDQTNR;
                 }
         }
@@ -536,8 +1598,8 @@ inline int JpegDecoder::parseScanHeader(ColorComponent* components, int** coef,
         return 0;
 }
 
-inline int JpegDecoder::parseBlock(BitStream& stream, shared_ptr<HuffmanTree> dcTable, shared_ptr<HuffmanTree> acTable,
-                                   shared_ptr<QTable> qTable, int& previousDC, int* values)
+inline int JpegDecoder::parseBlock(BitStream& stream, const HuffmanTree& dcTable, const HuffmanTree& acTable,
+                                   const QTable& qTable, int& previousDC, int* values)
 {
         int error = 0;
         int zzpos = 0;
@@ -545,9 +1607,9 @@ inline int JpegDecoder::parseBlock(BitStream& stream, shared_ptr<HuffmanTree> dc
         for(int i = 0; i < 64; i++) {
                 unsigned char len;
                 if (i == 0)
-                        len = dcTable->getValue(stream, error);
+                        len = dcTable.getValue(stream, error);
                 else
-                        len = acTable->getValue(stream, error);
+                        len = acTable.getValue(stream, error);
                 CHECK_ERROR_HUFFMAN(error);
 
                 if (len == 0x00 && i != 0) {
@@ -559,6 +1621,8 @@ inline int JpegDecoder::parseBlock(BitStream& stream, shared_ptr<HuffmanTree> dc
 
                 if (i != 0) // preceding zeros
                         i += (len >> 4);
+                if (i > 63)
+                        return ERROR_BLOCKOVERFLOW;
                 int value = stream.next(len & 0x0F, error);
                 CHECK_ERROR_BITSTREAM(error);
 
@@ -571,7 +1635,7 @@ inline int JpegDecoder::parseBlock(BitStream& stream, shared_ptr<HuffmanTree> dc
                         values[zzpos] += previousDC;
                         previousDC = values[zzpos];
                 }
-                values[zzpos] *= qTable->values[zzpos];
+                values[zzpos] *= qTable.values[i];     // the table is stored in zigzag order
         }
         return 0;
 }
@@ -580,14 +1644,12 @@ inline void JpegDecoder::skipRST(BitStream& stream)
 {
         stream.remember();
         stream.skipRest();
+        stream.skipStuffing();
         if (!stream.isEnd() && stream.available(16)) {
             unsigned char byte0 = stream.nextByte(false);
             unsigned char byte1 = stream.nextByte(false);
-            if (!(byte0 == 0xFF && (byte1 & 0xF0) == 0xD0)) {
+            if (!(byte0 == 0xFF && (byte1 & 0xF0) == 0xD0))
                 stream.rewind();
-            } else {
-                stream.forget();
-            }
 
         } else {
             stream.rewind();
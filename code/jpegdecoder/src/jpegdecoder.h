@@ -16,8 +16,13 @@
 #include <memory>
 #include <string>
 #include "picture.h"
+#include "coefficients.h"
 
+#include "arithmetic.h"
 #include "huffmantree.h"
+#include "profiler.h"
+
+#define DECODE_PENDING          -1      // beginDecode/resumeDecode: there are rows left
 
 struct ColorComponent
 {
@@ -36,6 +41,15 @@ struct QTable
         
 };
 
+// caller memory for JpegDecoder::decodePlanar
+struct PlanarImage
+{
+        unsigned char* planes[3];       // Y, Cb, Cr
+        int strides[3];                 // in bytes
+};
+
+struct PixelMapping;
+
 class JpegDecoder
 {
 private:
@@ -58,25 +72,84 @@ private:
 
         std::shared_ptr<HuffmanTree> hTablesDC[3];      // used to store the huffman tables
         std::shared_ptr<HuffmanTree> hTablesAC[3];
+        bool arithmetic;                // SOF9: the scans are arithmetic coded
+        ArithmeticDecoder arithmeticDecoder;    // statistics and conditioning (DAC)
 
         Picture picture;                // final picture data
+        RowSink* sink;                  // receives the decoded rows, &picture by default
+
+        // layout of the current scan, set by parseSOS
+        ColorComponent scanComponents[3];       // components in the order of the scan
+        int scanOrder[3];               // 0 = Y, 1 = Cb, 2 = Cr for each scan component
+        int hsfMax;
+        int vsfMax;
+        int mcusPerRow;
+        int mcuRows;
+        int blocksPerMCU;
+
+        int threads;                    // threads used for decoding, 0 = one per core
+        bool speculative;               // split the entropy decoding of scans without RST markers
+
+        CoefficientImage* coefficientOutput;    // set by readCoefficients
+        LowFrequencyImage* lowFrequencyOutput;  // set by readLowFrequencies
+        bool dequantize;                // false while reading the quantized coefficients
+        std::shared_ptr<QTable> unitTable;      // all values 1
+        const PlanarImage* planarOutput;        // set by decodePlanar
+        BufferAllocator* allocator;     // coefficient rows and bands
+        int idctMode;                   // IDCTMode of dct.h
+        StageProfiler* profiler;        // nullptr if not profiling
+        int scale;                      // 1, 2, 4 or 8: the pixels are decoded at 1/scale
+        int orientation;                // EXIF orientation 1..8, 1 if there is none
+        bool autoOrient;                // the pixels are stored in the EXIF orientation
+        unsigned char* orientedImage;   // whole output for the orientations 3..8, nullptr otherwise
+        int orientedStride;
+        std::unique_ptr<Buffer<unsigned char>> orientedBuffer;  // orientedImage if the sink has none
+        struct ScanState;
+        std::unique_ptr<ScanState> scanState;   // scan decoded by resumeDecode
+
+        // false if the sink doesn't receive anything
+        bool decodesPixels() { return coefficientOutput == nullptr && lowFrequencyOutput == nullptr && planarOutput == nullptr; }
+        // orientation the pixels are stored in, 1 = as they are decoded
+        int outputOrientation() { return autoOrient && decodesPixels() ? orientation : 1; }
         
         // private methods for parser
         unsigned char seekNextSegment();
+        int parseSegments();
+        int seekImage();
+        int parseUntilScan(bool incremental);
+        int checkEOI();
         int parseSOF0();                // parse the parameters for the baseline dct algorithm
+        int parseFrameHeader();         // SOF0 without initializing the sink
         int parseDRI();
+        int parseDAC();                 // arithmetic coding conditioning
         int parseDHT();                 // parse huffman table
         int parseDQT();                 // parse quantization table
-        int parseEXIF();                // will just read the length and skip the EXIF content
+        int parseEXIF(unsigned char marker);    // reads the orientation of an Exif APP1 segment, skips the others
+        void readOrientation(unsigned char marker, size_t length);
+        void prepareOrientation();
         int parseSOS();                 // parsing of image data
-
-        int parseBlock(BitStream& stream, std::shared_ptr<HuffmanTree> dcTable, std::shared_ptr<HuffmanTree> acTable,
-                       std::shared_ptr<QTable> qTable, int& previousDC, int* values);
-        int parseScanHeader(ColorComponent* components, int** coef,
-                            int* cy, int* ccb, int* ccr);
+        int prepareScan();
+
+        // the tables are only borrowed, no reference counting per block
+        int parseBlock(BitStream& stream, const HuffmanTree& dcTable, const HuffmanTree& acTable,
+                       const QTable& qTable, int& previousDC, int* values);
+        int parseScanHeader(ColorComponent* components, int* order);
+        int decodeSerial(BitStream& stream);
+        int decodeRow(BitStream& stream, int row, int& mcu, int* previousDC, int* coefficients, unsigned char* band);
+        int decodeCoefficients(BitStream& stream);
+        int decodeLowFrequencies(BitStream& stream);
+        int decodePipelined(BitStream& stream, int workers);
+        int decodeSpeculative(int chunks, int workers, unsigned int scanBytes);
+        int decodeMCURow(BitStream& stream, int& mcu, int* previousDC, int* coefficients);
+        int decodeMCU(BitStream& stream, int* previousDC, int* coefficients);
+        unsigned char* reconstructMCURow(int row, int* coefficients, unsigned char* scratch, int& stride);
+        unsigned char* reconstructScaled(int row, int* coefficients, unsigned char* scratch, int& stride);
+        void reconstructPlanar(int row, int* coefficients);
+        int emitBand(int row, const unsigned char* band, int stride);
+        unsigned char* orientedBand(int posy, unsigned char* scratch, int& stride, PixelMapping& mapping);
+        int bandStride() { return mcusPerRow * 8 * hsfMax / scale * pixelSize(sink->format()); }
+        int bandSize() { return bandStride() * 8 * vsfMax / scale; }
         void skipRST(BitStream& stream);
-        void scaleHorizontal(int hsf_max, int vsf_max, int hsf, int vsf, int* values);
-        void scaleVertical(int hsf_max, int vsf_max, int hsf, int vsf, int* values);
 
         // general parsing methods
         unsigned short parseUShort();
@@ -85,8 +158,81 @@ public:
         explicit JpegDecoder();
         virtual ~JpegDecoder();
         bool read(std::string path);
+        // use a file which has already been read into memory
+        void setData(std::string&& data);
         int decode();
+        /*!
+         * Decoding in steps on the calling thread, e.g. from an event loop (see decodetask.h):
+         * beginDecode parses the segments up to the first scan, every resumeDecode call then
+         * decodes at most rows MCU rows or stops after the given time (0 = no limit, at least
+         * one row is decoded). Both return DECODE_PENDING while rows are left, otherwise 0 or
+         * the error code of decode(). The threads setting isn't used.
+         */
+        int beginDecode();
+        int resumeDecode(int rows, int microseconds);
+        // entropy decoding only: the quantized DCT coefficients and quantization tables
+        // (used for lossless transformations), no pixels are produced
+        int readCoefficients(CoefficientImage& image);
+        // entropy decoding only, keeps the first image.coefficients of every luma block
+        int readLowFrequencies(LowFrequencyImage& image);
+        /*!
+         * Stores the Y, Cb and Cr planes at their sampled resolution (e.g. I420 for 4:2:0)
+         * without upsampling and color conversion, the sink isn't used. The planes need
+         * the size returned by getPlaneSize after probe().
+         */
+        int decodePlanar(const PlanarImage& image);
+        // the embedded EXIF/JFIF preview as JPEG data (ERROR_THUMBNAILFORMAT if it is
+        // stored uncompressed, ERROR_NOTHUMBNAIL if there is none), the image isn't decoded
+        int getThumbnail(std::string& jpeg);
+        // decodes the embedded preview (of any type) into the sink, nullptr = the picture
+        int decodeThumbnail(RowSink* sink);
+        // reads just the frame header (getWidth/getHeight/getPlaneSize), 0 on success
+        int probe();
+        // size of a plane (0 = Y, 1 = Cb, 2 = Cr) at its sampled resolution, ceil(width * hsf / hsfMax)
+        void getPlaneSize(int component, int& planeWidth, int& planeHeight);
+        // number of threads used by decode(), 0 uses one thread per core and 1 decodes
+        // without starting any worker thread
+        void setThreads(int threads) { this->threads = threads; }
+        // true (default): the entropy decoding of large scans without restart markers is split
+        // speculatively across the threads, false: only the reconstruction runs in parallel
+        void setSpeculative(bool enabled) { speculative = enabled; }
+        // accuracy of the inverse DCT: IDCT_FAST (default), IDCT_ACCURATE or IDCT_FLOAT (dct.h)
+        void setIDCT(int mode) { idctMode = mode; }
+        // memory for the picture and the internal buffers, nullptr = defaultAllocator(),
+        // the allocator has to live as long as the decoder
+        void setAllocator(BufferAllocator* allocator);
+        // attributes the work of decode() to the stages of the profiler (nullptr = off),
+        // a profiled image is decoded with one thread
+        void setProfiler(StageProfiler* profiler) { this->profiler = profiler; }
+        // decodes the pixels at 1/2, 1/4 or 1/8 of the size in the IDCT (1 = full size), which is
+        // a lot faster than scaling afterwards. decodePlanar and the coefficients aren't scaled.
+        void setScale(int denominator) { scale = denominator == 2 || denominator == 4 || denominator == 8 ? denominator : 1; }
+        // size of the decoded pixels, ceil(size / scale)
+        int getScaledWidth() { return (width + scale - 1) / scale; }
+        int getScaledHeight() { return (height + scale - 1) / scale; }
+        // EXIF orientation (EXIF_TAG_ORIENTATION of exif.h, 1 = upright, 6 = rotated by 90
+        // degrees clockwise to be shown upright, ...), known after probe() or decode()
+        int getOrientation() { return orientation; }
+        /*!
+         * Stores the decoded pixels rotated and mirrored so the image is upright: every MCU
+         * is written straight to its final position, there is no pass over the image
+         * afterwards. Mirrored images (orientation 2) are passed to the sink in bands as
+         * usual, for the other orientations the rows are only complete once the last MCU
+         * row is decoded, they are stored in the memory of the sink (RowSink::image) or in
+         * a buffer of the decoder and passed to band() after the last MCU row.
+         * decodePlanar and the coefficients aren't oriented.
+         */
+        void setAutoOrient(bool enabled) { autoOrient = enabled; }
+        // size of the image the sink receives: the scaled size, transposed for the
+        // orientations 5..8 with auto orientation
+        int getOutputWidth() { return outputOrientation() >= 5 ? getScaledHeight() : getScaledWidth(); }
+        int getOutputHeight() { return outputOrientation() >= 5 ? getScaledWidth() : getScaledHeight(); }
         Picture& getPicture() { return picture; }
+        int getWidth() { return width; }
+        int getHeight() { return height; }
+        // decode into the given sink instead of the picture (no picture memory is allocated),
+        // nullptr switches back to the picture
+        void setSink(RowSink* sink) { this->sink = sink != nullptr ? sink : &picture; }
 };
 
 #endif // __JPEGDECODER_H
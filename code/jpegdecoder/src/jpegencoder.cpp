@@ -0,0 +1,239 @@
+#include "jpegencoder.h"
+#include <algorithm>
+#include "color.h"
+#include "dct.h"
+using namespace std;
+
+// ITU-T81 Annex K.1, natural order
+static const unsigned char luminanceTable[64] = {
+        16,  11,  10,  16,  24,  40,  51,  61,
+        12,  12,  14,  19,  26,  58,  60,  55,
+        14,  13,  16,  24,  40,  57,  69,  56,
+        14,  17,  22,  29,  51,  87,  80,  62,
+        18,  22,  37,  56,  68, 109, 103,  77,
+        24,  35,  55,  64,  81, 104, 113,  92,
+        49,  64,  78,  87, 103, 121, 120, 101,
+        72,  92,  95,  98, 112, 100, 103,  99 };
+
+static const unsigned char chrominanceTable[64] = {
+        17,  18,  24,  47,  99,  99,  99,  99,
+        18,  21,  26,  66,  99,  99,  99,  99,
+        24,  26,  56,  99,  99,  99,  99,  99,
+        47,  66,  99,  99,  99,  99,  99,  99,
+        99,  99,  99,  99,  99,  99,  99,  99,
+        99,  99,  99,  99,  99,  99,  99,  99,
+        99,  99,  99,  99,  99,  99,  99,  99,
+        99,  99,  99,  99,  99,  99,  99,  99 };
+
+JpegEncoder::JpegEncoder()
+{
+        hsf = 2;
+        vsf = 2;
+        optimize = false;
+        output = nullptr;
+        pendingRows = 0;
+        encodedRows = 0;
+        error = 0;
+        setQuality(75);
+}
+
+void JpegEncoder::setQuality(int quality)
+{
+        this->quality = max(1, min(100, quality));
+        int scale = this->quality < 50 ? 5000 / this->quality : 200 - 2 * this->quality;
+
+        for (int t = 0; t < 2; t++) {
+                const unsigned char* base = t == 0 ? luminanceTable : chrominanceTable;
+                image.hasQTable[t] = true;
+                image.hasQTable[t + 2] = false;
+                for (int i = 0; i < 64; i++) {
+                        int value = max(1, min(255, (base[i] * scale + 50) / 100));
+                        image.qTables[t][i] = value;
+                        reciprocals[t][i] = 1.0f / (8 * value);
+                }
+        }
+}
+
+void JpegEncoder::setSubsampling(int hsf, int vsf)
+{
+        this->hsf = max(1, min(2, hsf));
+        this->vsf = max(1, min(2, vsf));
+}
+
+// allocates the blocks and writes the headers unless the whole image is needed first
+int JpegEncoder::start(int width, int height, string& out)
+{
+        image.width = width;
+        image.height = height;
+        int mcusPerRow = (width + 8 * hsf - 1) / (8 * hsf);
+        int mcuRows = optimize ? (height + 8 * vsf - 1) / (8 * vsf) : 1;
+        for (int c = 0; c < 3; c++) {
+                ComponentCoefficients& component = image.components[c];
+                component.hsf = c == 0 ? hsf : 1;
+                component.vsf = c == 0 ? vsf : 1;
+                component.qt = c == 0 ? 0 : 1;
+                component.blocksWide = mcusPerRow * component.hsf;
+                component.blocksHigh = mcuRows * component.vsf;
+                component.blocks.resize(component.blocksWide * component.blocksHigh * 64);
+        }
+        encodedRows = 0;
+        return optimize ? 0 : writer.begin(image, out);
+}
+
+// forward DCT and quantization of one block, the samples are level shifted already
+static inline void quantizeBlock(int* samples, const float* reciprocals, short* block)
+{
+        DCT::forwardTransform(samples);
+        for (int i = 0; i < 64; i++) {
+                float value = samples[i] * reciprocals[i];
+                int quantized = (int)(value < 0 ? value - 0.5f : value + 0.5f);
+                block[i] = (short)max(-1023, min(1023, quantized));
+        }
+}
+
+/*!
+ * Encodes the pixel rows [row * 8 * vsf, +rows) which start at pixels. Missing columns
+ * and rows at the right and bottom edge repeat the last pixel.
+ */
+void JpegEncoder::encodeMCURow(int row, const unsigned char* pixels, int stride, int rows, int bytesPerPixel)
+{
+        const int mcuWidth = 8 * hsf;
+        const int mcuHeight = 8 * vsf;
+        const int mcusPerRow = image.components[0].blocksWide / hsf;
+        // offsets of red, green and blue inside a pixel
+        const int r = bytesPerPixel == 4 ? 2 : 0;
+        const int g = 1;
+        const int b = bytesPerPixel == 4 ? 0 : 2;
+
+        int y[256], cb[256], cr[256];   // one MCU, at most 16x16 samples
+        int samples[64];
+
+        for (int mx = 0; mx < mcusPerRow; mx++) {
+                for (int py = 0; py < mcuHeight; py++) {
+                        const unsigned char* line = pixels + min(py, rows - 1) * stride;
+                        for (int px = 0; px < mcuWidth; px++) {
+                                const unsigned char* p = line + min(mx * mcuWidth + px, image.width - 1) * bytesPerPixel;
+                                int i = py * 16 + px;
+                                y[i] = Color::toY(p[r], p[g], p[b]) - 128;
+                                cb[i] = Color::toCb(p[r], p[g], p[b]) - 128;
+                                cr[i] = Color::toCr(p[r], p[g], p[b]) - 128;
+                        }
+                }
+
+                ComponentCoefficients& luminance = image.components[0];
+                for (int v = 0; v < vsf; v++) {
+                        for (int h = 0; h < hsf; h++) {
+                                for (int i = 0; i < 64; i++)
+                                        samples[i] = y[(v * 8 + i / 8) * 16 + h * 8 + i % 8];
+                                quantizeBlock(samples, reciprocals[0], luminance.block(mx * hsf + h, row * vsf + v));
+                        }
+                }
+
+                // the chrominance is the average of hsf x vsf samples
+                int* planes[2] = { cb, cr };
+                const int n = hsf * vsf;
+                for (int c = 0; c < 2; c++) {
+                        int* plane = planes[c];
+                        for (int i = 0; i < 64; i++) {
+                                int sx = (i % 8) * hsf;
+                                int sy = (i / 8) * vsf;
+                                int sum = 0;
+                                for (int v = 0; v < vsf; v++) {
+                                        for (int h = 0; h < hsf; h++)
+                                                sum += plane[(sy + v) * 16 + sx + h];
+                                }
+                                // rounded, the level shifted samples may be negative
+                                samples[i] = (sum + (sum >= 0 ? n / 2 : -n / 2)) / n;
+                        }
+                        quantizeBlock(samples, reciprocals[1], image.components[c + 1].block(mx, row));
+                }
+        }
+}
+
+// the next MCU row, stored at its position or written right away
+void JpegEncoder::addMCURow(const unsigned char* pixels, int stride, int rows, int bytesPerPixel, string& out)
+{
+        if (optimize) {
+                encodeMCURow(encodedRows, pixels, stride, rows, bytesPerPixel);
+        } else {
+                encodeMCURow(0, pixels, stride, rows, bytesPerPixel);
+                writer.writeRows(image, 1, out);
+        }
+        encodedRows++;
+}
+
+int JpegEncoder::finish(string& out)
+{
+        if (optimize)
+                return writer.write(image, out);
+        writer.end(out);
+        return 0;
+}
+
+int JpegEncoder::encode(const unsigned char* pixels, int width, int height, int stride, PixelFormat format, string& out)
+{
+        if (width <= 0 || height <= 0 || width > 0xFFFF || height > 0xFFFF)
+                return ERROR_WRITER_SIZE;
+        int errcode = start(width, height, out);
+        if (errcode != 0)
+                return errcode;
+
+        int mcuHeight = 8 * vsf;
+        int mcuRows = (height + mcuHeight - 1) / mcuHeight;
+        for (int row = 0; row < mcuRows; row++) {
+                int rows = min(mcuHeight, height - row * mcuHeight);
+                addMCURow(pixels + (size_t)row * mcuHeight * stride, stride, rows, pixelSize(format), out);
+        }
+        return finish(out);
+}
+
+int JpegEncoder::begin(int width, int height)
+{
+        error = output == nullptr ? ERROR_ENCODER_NOOUTPUT : 0;
+        if (error != 0)
+                return error;
+        if (width <= 0 || height <= 0 || width > 0xFFFF || height > 0xFFFF) {
+                error = ERROR_WRITER_SIZE;
+                return error;
+        }
+        error = start(width, height, *output);
+        if (error != 0)
+                return error;
+        pending.resize((size_t)width * 3 * 8 * vsf);
+        pendingRows = 0;
+        return 0;
+}
+
+int JpegEncoder::band(int y, int rows, const unsigned char* rgb, int stride)
+{
+        const int mcuHeight = 8 * vsf;
+        const int rowSize = image.width * 3;
+
+        for (int i = 0; i < rows; ) {
+                // whole MCU rows are encoded straight from the band
+                if (pendingRows == 0 && rows - i >= mcuHeight) {
+                        addMCURow(rgb + i * stride, stride, mcuHeight, 3, *output);
+                        i += mcuHeight;
+                        continue;
+                }
+                copy(rgb + i * stride, rgb + i * stride + rowSize, &pending[pendingRows * rowSize]);
+                pendingRows++;
+                i++;
+                if (pendingRows == mcuHeight) {
+                        addMCURow(&pending[0], rowSize, mcuHeight, 3, *output);
+                        pendingRows = 0;
+                }
+        }
+        return 0;
+}
+
+void JpegEncoder::end()
+{
+        if (error != 0)
+                return;
+        if (pendingRows > 0) {
+                addMCURow(&pending[0], image.width * 3, pendingRows, 3, *output);
+                pendingRows = 0;
+        }
+        error = finish(*output);
+}
@@ -0,0 +1,74 @@
+#ifndef __JPEGENCODER_H
+#define __JPEGENCODER_H
+
+#include <string>
+#include <vector>
+#include "coefficients.h"
+#include "jpegwriter.h"
+#include "rowsink.h"
+
+#define ERROR_ENCODER_NOOUTPUT  0x74    // used as sink without setOutput
+
+/*!
+ * Baseline JPEG encoder: color conversion, chroma subsampling (box filter), forward
+ * DCT and quantization of one MCU row after the other, which the JpegWriter huffman
+ * codes right away. Only optimized huffman tables need the symbols of the whole image
+ * first, then all MCU rows are kept in a CoefficientImage and written at the end.
+ *
+ * The pixels either come from a caller buffer (encode) or the encoder is used as
+ * the RowSink of a JpegDecoder, then every decoded band is encoded right away:
+ *
+ *      encoder.setOutput(&jpeg);
+ *      decoder.setSink(&encoder);
+ *      decoder.decode();               // jpeg holds the new file afterwards
+ */
+class JpegEncoder : public RowSink
+{
+private:
+        int quality;
+        int hsf;                        // sampling factors of the luminance
+        int vsf;
+        bool optimize;
+        JpegWriter writer;
+
+        CoefficientImage image;         // the current MCU row, all of them with optimize
+        float reciprocals[2][64];       // 1 / (8 * quantization value), natural order
+
+        // sink state: rows which don't fill a whole MCU row yet
+        std::string* output;
+        std::vector<unsigned char> pending;
+        int pendingRows;
+        int encodedRows;
+        int error;
+
+        int start(int width, int height, std::string& out);
+        void encodeMCURow(int row, const unsigned char* pixels, int stride, int rows, int bytesPerPixel);
+        void addMCURow(const unsigned char* pixels, int stride, int rows, int bytesPerPixel, std::string& out);
+        int finish(std::string& out);
+
+public:
+        explicit JpegEncoder();
+
+        // 1..100 scaling of the tables of Annex K.1 like the IJG libjpeg, default 75
+        void setQuality(int quality);
+        // luminance sampling factors: 1x1 = 4:4:4, 2x1 = 4:2:2, 2x2 = 4:2:0 (default)
+        void setSubsampling(int hsf, int vsf);
+        void setOptimizeHuffman(bool optimize)
+        {
+                this->optimize = optimize;
+                writer.setOptimizeHuffman(optimize);
+        }
+
+        // appends the encoded pixels (PIXEL_RGB or PIXEL_XRGB32, stride in bytes) to out
+        int encode(const unsigned char* pixels, int width, int height, int stride, PixelFormat format, std::string& out);
+
+        // target of the file written when used as sink, the result of end() is returned by getError()
+        void setOutput(std::string* output) { this->output = output; }
+        int getError() { return error; }
+
+        int begin(int width, int height);
+        int band(int y, int rows, const unsigned char* rgb, int stride);
+        void end();
+};
+
+#endif // __JPEGENCODER_H
@@ -0,0 +1,337 @@
+#include "jpegwriter.h"
+#include <algorithm>
+#include <cstring>
+#include "arithmetic.h"
+#include "huffmanencoder.h"
+#include "zigzag.h"
+using namespace std;
+
+// number of bits needed for the magnitude of value
+static inline int magnitudeBits(int value)
+{
+        if (value < 0)
+                value = -value;
+        int bits = 0;
+        while (value != 0) {
+                bits++;
+                value >>= 1;
+        }
+        return bits;
+}
+
+// counts the symbols for optimized tables
+struct SymbolCounter
+{
+        long* dc;
+        long* ac;
+
+        void dcSymbol(int symbol, int value, int bits) { dc[symbol]++; }
+        void acSymbol(int symbol, int value, int bits) { ac[symbol]++; }
+};
+
+struct SymbolWriter
+{
+        BitWriter* writer;
+        const HuffmanEncoder* dc;
+        const HuffmanEncoder* ac;
+
+        void dcSymbol(int symbol, int value, int bits)
+        {
+                dc->encode(*writer, symbol);
+                if (bits != 0)
+                        writer->write(value, bits);
+        }
+        void acSymbol(int symbol, int value, int bits)
+        {
+                ac->encode(*writer, symbol);
+                if (bits != 0)
+                        writer->write(value, bits);
+        }
+};
+
+// huffman symbols of one block (F.1.2), the block is stored in natural order
+template<typename Output>
+static inline void codeBlock(Output& output, const short* block, int& previousDC)
+{
+        int diff = block[0] - previousDC;
+        previousDC = block[0];
+        int bits = magnitudeBits(diff);
+        // negative values are stored as value - 1 in ones' complement
+        output.dcSymbol(bits, diff < 0 ? diff - 1 : diff, bits);
+
+        int run = 0;
+        for (int i = 1; i < 64; i++) {
+                int value = block[zz[i]];
+                if (value == 0) {
+                        run++;
+                        continue;
+                }
+                while (run > 15) {
+                        output.acSymbol(0xF0, 0, 0);
+                        run -= 16;
+                }
+                bits = magnitudeBits(value);
+                output.acSymbol((run << 4) | bits, value < 0 ? value - 1 : value, bits);
+                run = 0;
+        }
+        if (run > 0)
+                output.acSymbol(0x00, 0, 0);
+}
+
+// all blocks of the first mcuRows MCU rows in the order of the interleaved scan
+template<typename Output>
+static void codeScan(const CoefficientImage& image, int mcusPerRow, int mcuRows, Output* outputs, int* previousDC)
+{
+        for (int my = 0; my < mcuRows; my++) {
+                for (int mx = 0; mx < mcusPerRow; mx++) {
+                        for (int c = 0; c < 3; c++) {
+                                const ComponentCoefficients& component = image.components[c];
+                                for (int v = 0; v < component.vsf; v++) {
+                                        for (int h = 0; h < component.hsf; h++) {
+                                                codeBlock(outputs[c], component.block(mx * component.hsf + h, my * component.vsf + v),
+                                                          previousDC[c]);
+                                        }
+                                }
+                        }
+                }
+        }
+}
+
+// the same order with the QM-coder, the chrominance uses the conditioning tables 1
+static void codeArithmeticScan(const CoefficientImage& image, int mcusPerRow, int mcuRows, ArithmeticEncoder& encoder)
+{
+        int previousDC[3] = { 0, 0, 0 };
+        for (int my = 0; my < mcuRows; my++) {
+                for (int mx = 0; mx < mcusPerRow; mx++) {
+                        for (int c = 0; c < 3; c++) {
+                                const ComponentCoefficients& component = image.components[c];
+                                int table = c == 0 ? 0 : 1;
+                                for (int v = 0; v < component.vsf; v++) {
+                                        for (int h = 0; h < component.hsf; h++) {
+                                                encoder.encodeBlock(c, table, table,
+                                                                    component.block(mx * component.hsf + h, my * component.vsf + v),
+                                                                    previousDC[c]);
+                                        }
+                                }
+                        }
+                }
+        }
+        encoder.flush();
+}
+
+static void putShort(string& out, int value)
+{
+        out += (char)(value >> 8);
+        out += (char)(value & 0xFF);
+}
+
+static void putMarker(string& out, unsigned char marker)
+{
+        out += (char)0xFF;
+        out += (char)marker;
+}
+
+static void putHuffmanTable(string& out, int tableClass, int id, const HuffmanSpec& spec)
+{
+        out += (char)((tableClass << 4) | id);
+        for (int i = 0; i < 16; i++)
+                out += (char)spec.bits[i];
+        for (int i = 0; i < spec.count(); i++)
+                out += (char)spec.values[i];
+}
+
+// the sampling factors and quantization tables must be valid, the block grid must cover
+// mcuRows MCU rows (all of the image if mcuRows is 0, which returns their number)
+static int checkImage(const CoefficientImage& image, int& mcusPerRow, int& mcuRows)
+{
+        if (image.width <= 0 || image.height <= 0 || image.width > 0xFFFF || image.height > 0xFFFF)
+                return ERROR_WRITER_SIZE;
+
+        int hsfMax = 0, vsfMax = 0;
+        for (int c = 0; c < 3; c++) {
+                const ComponentCoefficients& component = image.components[c];
+                if (component.hsf < 1 || component.hsf > 2 || component.vsf < 1 || component.vsf > 2)
+                        return ERROR_WRITER_SAMPLING;
+                if (component.qt > 3 || !image.hasQTable[component.qt])
+                        return ERROR_WRITER_QTABLE;
+                hsfMax = max(hsfMax, (int)component.hsf);
+                vsfMax = max(vsfMax, (int)component.vsf);
+        }
+        mcusPerRow = (image.width + 8 * hsfMax - 1) / (8 * hsfMax);
+        if (mcuRows == 0)
+                mcuRows = (image.height + 8 * vsfMax - 1) / (8 * vsfMax);
+        for (int c = 0; c < 3; c++) {
+                const ComponentCoefficients& component = image.components[c];
+                if (hsfMax % component.hsf != 0 || vsfMax % component.vsf != 0)
+                        return ERROR_WRITER_SAMPLING;
+                if (component.blocksWide < mcusPerRow * component.hsf || component.blocksHigh < mcuRows * component.vsf
+                    || component.blocks.size() < (size_t)component.blocksWide * component.blocksHigh * 64)
+                        return ERROR_WRITER_BLOCKS;
+        }
+        return 0;
+}
+
+// SOI up to the SOS of the interleaved scan, the DHT only without arithmetic coding
+static void putHeaders(const CoefficientImage& image, bool arithmetic, const HuffmanSpec* dcSpecs,
+                       const HuffmanSpec* acSpecs, string& out)
+{
+        putMarker(out, 0xD8);
+
+        // JFIF 1.01, no density, no thumbnail
+        putMarker(out, 0xE0);
+        putShort(out, 16);
+        out.append("JFIF\0", 5);
+        out += (char)1;
+        out += (char)1;
+        out += (char)0;
+        putShort(out, 1);
+        putShort(out, 1);
+        out += (char)0;
+        out += (char)0;
+
+        for (int t = 0; t < 4; t++) {
+                if (!image.hasQTable[t])
+                        continue;
+                bool wide = false;
+                for (int i = 0; i < 64; i++)
+                        wide = wide || image.qTables[t][i] > 255;
+                putMarker(out, 0xDB);
+                putShort(out, 2 + 1 + 64 * (wide ? 2 : 1));
+                out += (char)((wide ? 0x10 : 0x00) | t);
+                for (int i = 0; i < 64; i++) {
+                        if (wide)
+                                putShort(out, image.qTables[t][zz[i]]);
+                        else
+                                out += (char)image.qTables[t][zz[i]];
+                }
+        }
+
+        putMarker(out, arithmetic ? 0xC9 : 0xC0);
+        putShort(out, 8 + 3 * 3);
+        out += (char)8;
+        putShort(out, image.height);
+        putShort(out, image.width);
+        out += (char)3;
+        for (int c = 0; c < 3; c++) {
+                const ComponentCoefficients& component = image.components[c];
+                out += (char)(c + 1);
+                out += (char)((component.hsf << 4) | component.vsf);
+                out += (char)component.qt;
+        }
+
+        if (!arithmetic) {
+                putMarker(out, 0xC4);
+                int length = 2;
+                for (int t = 0; t < 2; t++)
+                        length += 2 * 17 + dcSpecs[t].count() + acSpecs[t].count();
+                putShort(out, length);
+                for (int t = 0; t < 2; t++) {
+                        putHuffmanTable(out, 0, t, dcSpecs[t]);
+                        putHuffmanTable(out, 1, t, acSpecs[t]);
+                }
+        }
+
+        putMarker(out, 0xDA);
+        putShort(out, 6 + 2 * 3);
+        out += (char)3;
+        for (int c = 0; c < 3; c++) {
+                out += (char)(c + 1);
+                out += (char)(c == 0 ? 0x00 : 0x11);
+        }
+        out += (char)0;         // spectral selection 0..63, no successive approximation
+        out += (char)63;
+        out += (char)0;
+}
+
+int JpegWriter::write(const CoefficientImage& image, string& out)
+{
+        int mcusPerRow, mcuRows = 0;
+        int errcode = checkImage(image, mcusPerRow, mcuRows);
+        if (errcode != 0)
+                return errcode;
+
+        // huffman tables: 0 = luminance, 1 = chrominance
+        HuffmanSpec dcSpecs[2] = { standardHuffmanTable(false, 0), standardHuffmanTable(false, 1) };
+        HuffmanSpec acSpecs[2] = { standardHuffmanTable(true, 0), standardHuffmanTable(true, 1) };
+        if (optimize && !arithmetic) {
+                long dcCount[2][256];
+                long acCount[2][256];
+                memset(dcCount, 0, sizeof(dcCount));
+                memset(acCount, 0, sizeof(acCount));
+                SymbolCounter counters[3] = {
+                        { dcCount[0], acCount[0] }, { dcCount[1], acCount[1] }, { dcCount[1], acCount[1] }
+                };
+                int previousDC[3] = { 0, 0, 0 };
+                codeScan(image, mcusPerRow, mcuRows, counters, previousDC);
+                for (int t = 0; t < 2; t++) {
+                        optimalHuffmanTable(dcCount[t], dcSpecs[t]);
+                        optimalHuffmanTable(acCount[t], acSpecs[t]);
+                }
+        }
+
+        putHeaders(image, arithmetic, dcSpecs, acSpecs, out);
+
+        if (arithmetic) {
+                ArithmeticEncoder encoder(out);
+                codeArithmeticScan(image, mcusPerRow, mcuRows, encoder);
+                putMarker(out, 0xD9);
+                return 0;
+        }
+
+        BitWriter writer(out);
+        HuffmanEncoder dcEncoders[2] = { HuffmanEncoder(dcSpecs[0]), HuffmanEncoder(dcSpecs[1]) };
+        HuffmanEncoder acEncoders[2] = { HuffmanEncoder(acSpecs[0]), HuffmanEncoder(acSpecs[1]) };
+        SymbolWriter writers[3] = {
+                { &writer, &dcEncoders[0], &acEncoders[0] },
+                { &writer, &dcEncoders[1], &acEncoders[1] },
+                { &writer, &dcEncoders[1], &acEncoders[1] }
+        };
+        int previousDC[3] = { 0, 0, 0 };
+        codeScan(image, mcusPerRow, mcuRows, writers, previousDC);
+        writer.flush();
+
+        putMarker(out, 0xD9);
+        return 0;
+}
+
+int JpegWriter::begin(const CoefficientImage& image, string& out)
+{
+        int mcuRows = 1;
+        int errcode = checkImage(image, mcusPerRow, mcuRows);
+        if (errcode != 0)
+                return errcode;
+        HuffmanSpec dcSpecs[2] = { standardHuffmanTable(false, 0), standardHuffmanTable(false, 1) };
+        HuffmanSpec acSpecs[2] = { standardHuffmanTable(true, 0), standardHuffmanTable(true, 1) };
+        putHeaders(image, false, dcSpecs, acSpecs, out);
+        previousDC[0] = previousDC[1] = previousDC[2] = 0;
+        partialBits = 0;
+        partialCount = 0;
+        return 0;
+}
+
+void JpegWriter::writeRows(const CoefficientImage& image, int rows, string& out)
+{
+        static const HuffmanEncoder dcEncoders[2] = {
+                HuffmanEncoder(standardHuffmanTable(false, 0)), HuffmanEncoder(standardHuffmanTable(false, 1))
+        };
+        static const HuffmanEncoder acEncoders[2] = {
+                HuffmanEncoder(standardHuffmanTable(true, 0)), HuffmanEncoder(standardHuffmanTable(true, 1))
+        };
+        BitWriter writer(out);
+        writer.resume(partialBits, partialCount);
+        SymbolWriter writers[3] = {
+                { &writer, &dcEncoders[0], &acEncoders[0] },
+                { &writer, &dcEncoders[1], &acEncoders[1] },
+                { &writer, &dcEncoders[1], &acEncoders[1] }
+        };
+        codeScan(image, mcusPerRow, rows, writers, previousDC);
+        partialCount = writer.partial(partialBits);
+}
+
+void JpegWriter::end(string& out)
+{
+        BitWriter writer(out);
+        writer.resume(partialBits, partialCount);
+        writer.flush();
+        putMarker(out, 0xD9);
+}
@@ -0,0 +1,49 @@
+#ifndef __JPEGWRITER_H
+#define __JPEGWRITER_H
+
+#include <string>
+#include "coefficients.h"
+
+#define ERROR_WRITER_SAMPLING   0x70    // sampling factors not between 1 and 2 or no full MCUs
+#define ERROR_WRITER_QTABLE     0x71    // a component uses a missing quantization table
+#define ERROR_WRITER_SIZE       0x72    // image size 0 or larger than 65535
+#define ERROR_WRITER_BLOCKS     0x73    // block grid of a component smaller than the image
+
+/*!
+ * Writes quantized DCT coefficients as a baseline JFIF file: SOI, APP0, DQT, SOF0,
+ * DHT, one interleaved scan and EOI. Luminance uses the huffman tables 0, the
+ * chrominance components share the tables 1. With arithmetic coding SOF9 is
+ * written instead and the DHT is left out (default conditioning, no DAC).
+ */
+class JpegWriter
+{
+private:
+        bool optimize;                  // build optimal huffman tables (two passes over the data)
+        bool arithmetic;                // QM-coder instead of huffman coding
+
+        // state of the streamed scan between the calls of writeRows
+        int mcusPerRow;
+        int previousDC[3];
+        unsigned int partialBits;       // of the last byte, see BitWriter::partial
+        int partialCount;
+
+public:
+        explicit JpegWriter() : optimize(false), arithmetic(false), mcusPerRow(0), partialBits(0), partialCount(0) {}
+
+        // false (default) uses the standard tables of Annex K.3
+        void setOptimizeHuffman(bool optimize) { this->optimize = optimize; }
+        // sequential arithmetic coding (SOF9), usually some percent smaller than optimized huffman tables
+        void setArithmetic(bool arithmetic) { this->arithmetic = arithmetic; }
+
+        // appends the file to out, 0 on success
+        int write(const CoefficientImage& image, std::string& out);
+
+        // streaming with the standard huffman tables (optimized tables and arithmetic coding need
+        // the whole image): begin appends the headers, every writeRows the next MCU rows, which are
+        // held in the blocks of image from block row 0 on, and end the rest of the file
+        int begin(const CoefficientImage& image, std::string& out);
+        void writeRows(const CoefficientImage& image, int rows, std::string& out);
+        void end(std::string& out);
+};
+
+#endif // __JPEGWRITER_H
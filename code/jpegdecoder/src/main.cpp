@@ -6,6 +6,16 @@
 #include <gtkmm.h>
 #include <sys/time.h>
 #include "jpegdecoder.h"
+#include "convert.h"
+#include "transform.h"
+#include "thumbnail.h"
+#include "fingerprint.h"
+#include "pyramid.h"
+#include "imagecache.h"
+#include "recompress.h"
+#include "decodeserver.h"
+#include <atomic>
+#include <functional>
 #include <iostream>
 using namespace std;
 using namespace Cairo;
@@ -30,40 +40,148 @@ public:
                 start();
                 return currentTime - oldTime;
         }
+        long elapsed() {
+                struct timeval tv;
+                gettimeofday(&tv, nullptr);
+                return static_cast<long>(tv.tv_sec*1000 + (tv.tv_usec / 1000)) - currentTime;
+        }
 
         
 };
 
+#define CACHE_MEMORY            (512ul << 20)   // decoded pixels kept by the viewer
+#define CACHE_AHEAD             2               // images decoded before and after the current one
+
+/*!
+ * Shows the images of a file list, Right/Space/Page Down switches to the next one and
+ * Left/BackSpace/Page Up to the previous one. The images are decoded by the workers of
+ * an ImageCache (the neighbours in the background), which announce completed rows of
+ * the current image through a Glib::Dispatcher. The GUI thread then marks just the new
+ * rows as dirty and redraws them.
+ */
 class JPEGViewer : public Gtk::DrawingArea
 {
 private:
-        RefPtr<ImageSurface> surface;
-        RefPtr<Context> context;
+        ImageCache& cache;
+        Gtk::Window& window;
+        atomic<int> index;              // current image, read by the worker threads
+        shared_ptr<CachedImage> image;  // nullptr until its decoding has started
+        RefPtr<ImageSurface> surface;   // wraps the pixels of image
+        Glib::Dispatcher dispatcher;
+        int drawnRows;                  // only used by the GUI thread
+        bool finished;
+
+        void attach(shared_ptr<CachedImage> image);
+        void onRowsDecoded();
 protected:
         bool on_draw(const Cairo::RefPtr<Cairo::Context>& cr);
 public:
-        JPEGViewer(Picture& picture) {
-                Pixel* p;
-                surface = ImageSurface::create(Format::FORMAT_RGB24, picture.getWidth(), picture.getHeight());
-                context = Context::create(surface);
-               
-                for (int y = 0; y < picture.getHeight(); y++) {
-                        for(int x = 0; x < picture.getWidth(); x++) {
-                                
-                                p = picture.getNextPixel();
-                                context->set_source_rgb(p->red/255.0, p->green/255.0, p->blue/255.0);
-                                context->rectangle(x, y, 1, 1);
-                                context->fill();
-                        }
-                }
-                picture.resetPosition();
+        JPEGViewer(ImageCache& cache, Gtk::Window& window) : cache(cache), window(window), index(0), drawnRows(0),
+                finished(false) {
+                dispatcher.connect(sigc::mem_fun(*this, &JPEGViewer::onRowsDecoded));
+        }
+        void showImage(int index);
+        bool onKey(GdkEventKey* event);
+        // may be called from any thread
+        void imageProgress(int index) {
+                if (index == this->index.load())
+                        dispatcher.emit();
         }
 };
 
+void JPEGViewer::showImage(int index)
+{
+        this->index.store(index);
+        Timer::get().start();
+        image = nullptr;
+        surface.clear();
+        drawnRows = 0;
+        finished = false;
+
+        string path = cache.getPath(index);
+        window.set_title("JPEG Decoder - " + path.substr(path.find_last_of('/') + 1) + " ("
+                         + to_string(index + 1) + "/" + to_string(cache.size()) + ")");
+        shared_ptr<CachedImage> cached = cache.show(index);
+        if (cached)
+                attach(cached);
+        else
+                queue_draw();
+}
+
+void JPEGViewer::attach(shared_ptr<CachedImage> image)
+{
+        this->image = image;
+        if (!image->pixels.empty()) {
+                surface = ImageSurface::create(image->pixels.data(), Format::FORMAT_RGB24, image->width,
+                                               image->height, image->stride);
+                set_size_request(image->width, image->height);
+        }
+        queue_draw();
+        onRowsDecoded();
+}
+
+void JPEGViewer::onRowsDecoded()
+{
+        if (!image) {
+                shared_ptr<CachedImage> cached = cache.get(index.load());
+                if (cached)
+                        attach(cached);
+                return;
+        }
+
+        bool complete = image->complete.load(memory_order_acquire);
+        int rows = image->rows.load(memory_order_acquire);
+        if (surface && rows > drawnRows) {
+                if (drawnRows == 0 && !complete)
+                        cout << "First rows visible after " << Timer::get().elapsed() << "ms." << endl;
+                surface->mark_dirty(0, drawnRows, image->width, rows - drawnRows);
+                queue_draw_area(0, drawnRows, image->width, rows - drawnRows);
+                drawnRows = rows;
+        }
+        if (complete && !finished) {
+                finished = true;
+                if (image->error != 0)
+                        cout << image->path << ": could not process raw data, error code " << image->error << endl;
+                else
+                        cout << "Shown after " << Timer::get().elapsed() << "ms." << endl;
+        }
+}
+
+bool JPEGViewer::onKey(GdkEventKey* event)
+{
+        int next = index.load();
+        switch (event->keyval) {
+        case GDK_KEY_Right:
+        case GDK_KEY_space:
+        case GDK_KEY_Page_Down:
+                next++;
+                break;
+        case GDK_KEY_Left:
+        case GDK_KEY_BackSpace:
+        case GDK_KEY_Page_Up:
+                next--;
+                break;
+        case GDK_KEY_Home:
+                next = 0;
+                break;
+        case GDK_KEY_End:
+                next = cache.size() - 1;
+                break;
+        default:
+                return false;
+        }
+        if (next >= 0 && next < cache.size() && next != index.load())
+                showImage(next);
+        return true;
+}
+
 bool JPEGViewer::on_draw(const Cairo::RefPtr<Cairo::Context>& cr)
 {
+        // rows which aren't decoded yet are still black
+        if (!surface)
+                return true;
         cr->set_source(surface, 0, 0);
-        cr->rectangle(0, 0, surface->get_width(), surface->get_height());
+        cr->rectangle(0, 0, image->width, image->height);
         cr->fill();
 
         return true;
@@ -71,48 +189,71 @@ bool JPEGViewer::on_draw(const Cairo::RefPtr<Cairo::Context>& cr)
 
 int main(int argc, char** argv)
 {
-        if (argc != 2) {
-                cout << "Usage: ./jpegdecode filename" << endl;
-                return -1;
+        if (argc >= 2 && string(argv[1]) == "convert") {
+                return convert(argc - 1, argv + 1);
+        }
+        if (argc >= 2 && string(argv[1]) == "transform") {
+                return transformCommand(argc - 1, argv + 1);
+        }
+        if (argc >= 2 && string(argv[1]) == "thumbnail") {
+                return thumbnailCommand(argc - 1, argv + 1);
+        }
+        if (argc >= 2 && string(argv[1]) == "fingerprint") {
+                return fingerprintCommand(argc - 1, argv + 1);
+        }
+        if (argc >= 2 && string(argv[1]) == "pyramid") {
+                return pyramidCommand(argc - 1, argv + 1);
+        }
+        if (argc >= 2 && (string(argv[1]) == "pack" || string(argv[1]) == "unpack")) {
+                return packCommand(argc - 1, argv + 1);
+        }
+        if (argc >= 2 && string(argv[1]) == "serve") {
+                return serveCommand(argc - 1, argv + 1);
         }
 
-        JpegDecoder jpegDecoder;
-
-        if (!jpegDecoder.read(argv[1]))
-        {
-                cout << "Could not read file!" << endl;
+        if (argc < 2) {
+                cout << "Usage: ./jpegdecode files/directories..." << endl
+                     << "       ./jpegdecode convert [options] files/directories..." << endl
+                     << "       ./jpegdecode transform [options] input.jpg output.jpg" << endl
+                     << "       ./jpegdecode thumbnail input.jpg output" << endl
+                     << "       ./jpegdecode fingerprint [options] files/directories..." << endl
+                     << "       ./jpegdecode pyramid [options] input.jpg base" << endl
+                     << "       ./jpegdecode pack|unpack input output" << endl
+                     << "       ./jpegdecode serve [-s socket] [-t threads]" << endl;
                 return -1;
         }
-        Timer::get().start();
-        int errcode = jpegDecoder.decode();
-        if (errcode != 0) {
-                cout << "Could not process raw data!" << endl << "Error code:" << errcode << endl;
-                return errcode;
-        }
-        cout << "Decoding took " << Timer::get().stop() << "ms." << endl;
 
-        Picture& picture = jpegDecoder.getPicture();
+        vector<string> files;
+        for (int i = 1; i < argc; i++)
+                collectInputs(argv[i], files);
+        if (files.empty()) {
+                cout << "No JPEG files found!" << endl;
+                return -1;
+        }
 
-        // Show GTK Window
+        // Show GTK Window, the images are decoded in the background
         Gtk::Main main;
         Gtk::Window window;
         Gtk::ScrolledWindow scrolledWindow;
 
-        Timer::get().start();
-        JPEGViewer viewer(picture);
-        cout << "Converting to cairo surface took " << Timer::get().stop() << "ms." << endl;
+        ImageCache cache(files, CACHE_MEMORY, CACHE_AHEAD);
+        JPEGViewer viewer(cache, window);
+        cache.setProgress([&viewer](int index) { viewer.imageProgress(index); });
+        cache.start();
+        window.signal_key_press_event().connect(sigc::mem_fun(viewer, &JPEGViewer::onKey), false);
 
         window.set_size_request(640, 480);
         scrolledWindow.set_size_request(640, 480);
-        viewer.set_size_request(picture.getWidth(), picture.getHeight());
 
-        window.set_title("JPEG Decoder");
         scrolledWindow.add(viewer);
         window.add(scrolledWindow);
+        viewer.showImage(0);
         viewer.show();
         scrolledWindow.show();
         Gtk::Main::run(window);
 
+        // window closed, stop decoding at the next MCU row
+        cache.stop();
+
         return 0;
 }
-
@@ -5,22 +5,53 @@ using namespace std;
 Picture::Picture()
 {
         data = nullptr;
+        allocator = defaultAllocator();
+        width = 0;
+        height = 0;
         position = 0;
 }
 
 Picture::~Picture()
 {
-        if (data != nullptr)
-        {
-                delete[] data;
-        }
+        allocator->release(data, (size_t)width * height * sizeof(Pixel));
+}
+
+void Picture::setAllocator(BufferAllocator* allocator)
+{
+        this->allocator->release(data, (size_t)width * height * sizeof(Pixel));
+        data = nullptr;
+        width = 0;
+        height = 0;
+        this->allocator = allocator != nullptr ? allocator : defaultAllocator();
 }
 
 void Picture::init(int width, int height)
 {
+        // no initialization, the pages are faulted in by the threads which store the rows
+        allocator->release(data, (size_t)this->width * this->height * sizeof(Pixel));
         this->width = width;
         this->height = height;
+        data = (Pixel*)allocator->allocate((size_t)width * height * sizeof(Pixel));
+}
 
-        data = new Pixel[width * height];
+int Picture::begin(int width, int height)
+{
+        init(width, height);
+        return 0;
+}
+
+int Picture::band(int y, int rows, const unsigned char* rgb, int stride)
+{
+        for (int row = 0; row < rows; row++) {
+                Pixel* pixel = &data[(y + row) * width];
+                const unsigned char* source = rgb + row * stride;
+                for (int x = 0; x < width; x++) {
+                        pixel[x].red = source[0];
+                        pixel[x].green = source[1];
+                        pixel[x].blue = source[2];
+                        source += 3;
+                }
+        }
+        return 0;
 }
 
@@ -1,6 +1,9 @@
 #ifndef __PICTURE_H
 #define __PICTURE_H
 
+#include "allocator.h"
+#include "rowsink.h"
+
 struct Pixel
 {
         int red;
@@ -8,10 +11,12 @@ struct Pixel
         int blue;
 };
 
-class Picture
+// default output of the decoder, stores the whole image
+class Picture : public RowSink
 {
 private:
         Pixel* data;
+        BufferAllocator* allocator;
         int width;
         int height;
         int position;
@@ -19,12 +24,16 @@ public:
         explicit Picture();
         virtual ~Picture();
         void init(int width, int height);
+        // used for the pixel memory from the next init on, nullptr = defaultAllocator()
+        void setAllocator(BufferAllocator* allocator);
+        int begin(int width, int height);
+        int band(int y, int rows, const unsigned char* rgb, int stride);
         int getWidth() { return width; }
         int getHeight() { return height; }
         inline void setPixel(int x, int y, int red, int green, int blue)
         {
                 if ( x >= 0 && x < width && y >= 0 && y < height) {
-                        register int pos = y*width+x;
+                        int pos = y*width+x;
                         data[pos].red = red;
                         data[pos].green = green;
                         data[pos].blue = blue;
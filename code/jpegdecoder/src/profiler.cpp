@@ -0,0 +1,173 @@
+#include "profiler.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+using namespace std;
+
+static const char* stageNames[STAGE_COUNT] = { "markers", "huffman", "idct", "upsample+color", "store" };
+static const char* counterNames[COUNTER_COUNT] = { "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses" };
+
+void Profile::clear()
+{
+        for (int s = 0; s < STAGE_COUNT; s++) {
+                milliseconds[s] = 0;
+                for (int c = 0; c < COUNTER_COUNT; c++)
+                        counts[s][c] = 0;
+        }
+}
+
+void Profile::add(const Profile& profile)
+{
+        for (int s = 0; s < STAGE_COUNT; s++) {
+                milliseconds[s] += profile.milliseconds[s];
+                for (int c = 0; c < COUNTER_COUNT; c++)
+                        counts[s][c] += profile.counts[s][c];
+        }
+}
+
+#ifdef __linux__
+static int openCounter(unsigned int type, unsigned long long config, int group)
+{
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = group < 0 ? 1 : 0;      // the group starts with its leader
+        attr.exclude_kernel = 1;                // allowed with perf_event_paranoid <= 2
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+StageProfiler::StageProfiler()
+{
+        opened = 0;
+        stage = -1;
+        lastTime = 0;
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+                descriptors[c] = -1;
+                last[c] = 0;
+        }
+
+#ifdef __linux__
+        const unsigned long long l1dRead = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const unsigned int types[COUNTER_COUNT] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                                                    PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE };
+        const unsigned long long configs[COUNTER_COUNT] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                            PERF_COUNT_HW_BRANCH_MISSES, l1dRead,
+                                                            PERF_COUNT_HW_CACHE_MISSES };
+        // the cycles lead the group, all counters are read at once
+        descriptors[0] = openCounter(types[0], configs[0], -1);
+        if (descriptors[0] < 0) {
+                error = string("no hardware counters: perf_event_open failed (") + strerror(errno) + ")";
+                return;
+        }
+        order[opened++] = 0;
+        for (int c = 1; c < COUNTER_COUNT; c++) {
+                descriptors[c] = openCounter(types[c], configs[c], descriptors[0]);
+                if (descriptors[c] >= 0) {
+                        order[opened++] = c;
+                } else {
+                        error += string(error.empty() ? "" : ", ") + counterNames[c] + " not available ("
+                                + strerror(errno) + ")";
+                }
+        }
+        ioctl(descriptors[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(descriptors[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+        error = "no hardware counters: perf_event_open needs Linux";
+#endif
+}
+
+StageProfiler::~StageProfiler()
+{
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+                if (descriptors[c] >= 0)
+                        close(descriptors[c]);
+        }
+}
+
+void StageProfiler::sample(unsigned long long* values, double& time)
+{
+        time = chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+        if (opened == 0)
+                return;
+
+        // PERF_FORMAT_GROUP: number of values, then the values in the order the counters were opened
+        unsigned long long buffer[1 + COUNTER_COUNT];
+        if (read(descriptors[0], buffer, sizeof(buffer)) < (ssize_t)((1 + opened) * sizeof(unsigned long long)))
+                return;
+        for (int i = 0; i < opened; i++)
+                values[order[i]] = buffer[1 + i];
+}
+
+void StageProfiler::enter(ProfileStage next)
+{
+        unsigned long long values[COUNTER_COUNT];
+        for (int c = 0; c < COUNTER_COUNT; c++)
+                values[c] = last[c];
+        double time;
+        sample(values, time);
+
+        if (stage >= 0) {
+                profile.milliseconds[stage] += time - lastTime;
+                for (int c = 0; c < COUNTER_COUNT; c++)
+                        profile.counts[stage][c] += values[c] - last[c];
+        }
+        for (int c = 0; c < COUNTER_COUNT; c++)
+                last[c] = values[c];
+        lastTime = time;
+        stage = next;
+}
+
+void StageProfiler::stop()
+{
+        enter(STAGE_MARKERS);
+        stage = -1;
+}
+
+void StageProfiler::print(ostream& out, const Profile& profile)
+{
+        char line[256];
+        int length = snprintf(line, sizeof(line), "  %-16s %10s", "stage", "ms");
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+                if (hasCounter(c))
+                        length += snprintf(line + length, sizeof(line) - length, " %14s", counterNames[c]);
+        }
+        if (hasCounter(COUNTER_CYCLES) && hasCounter(COUNTER_INSTRUCTIONS))
+                snprintf(line + length, sizeof(line) - length, " %6s", "IPC");
+        out << line << "\n";
+
+        for (int s = 0; s <= STAGE_COUNT; s++) {
+                // the last line is the sum of all stages
+                const char* name = s < STAGE_COUNT ? stageNames[s] : "total";
+                double milliseconds = 0;
+                unsigned long long counts[COUNTER_COUNT] = { 0 };
+                for (int i = s < STAGE_COUNT ? s : 0; i < (s < STAGE_COUNT ? s + 1 : STAGE_COUNT); i++) {
+                        milliseconds += profile.milliseconds[i];
+                        for (int c = 0; c < COUNTER_COUNT; c++)
+                                counts[c] += profile.counts[i][c];
+                }
+
+                length = snprintf(line, sizeof(line), "  %-16s %10.3f", name, milliseconds);
+                for (int c = 0; c < COUNTER_COUNT; c++) {
+                        if (hasCounter(c))
+                                length += snprintf(line + length, sizeof(line) - length, " %14llu", counts[c]);
+                }
+                if (hasCounter(COUNTER_CYCLES) && hasCounter(COUNTER_INSTRUCTIONS))
+                        snprintf(line + length, sizeof(line) - length, " %6.2f",
+                                 counts[COUNTER_CYCLES] > 0 ? (double)counts[COUNTER_INSTRUCTIONS] / counts[COUNTER_CYCLES] : 0.0);
+                out << line << "\n";
+        }
+}
@@ -0,0 +1,79 @@
+#ifndef __PROFILER_H
+#define __PROFILER_H
+
+#include <ostream>
+#include <string>
+
+enum ProfileStage
+{
+        STAGE_MARKERS,                  // segments outside of the scan
+        STAGE_HUFFMAN,                  // entropy decoding and dequantization
+        STAGE_IDCT,
+        STAGE_COLOR,                    // upsampling and color conversion
+        STAGE_STORE,                    // the sink (picture, file, encoder)
+        STAGE_COUNT
+};
+
+enum ProfileCounter
+{
+        COUNTER_CYCLES,
+        COUNTER_INSTRUCTIONS,
+        COUNTER_BRANCH_MISSES,
+        COUNTER_L1D_MISSES,             // read misses
+        COUNTER_LLC_MISSES,
+        COUNTER_COUNT
+};
+
+struct Profile
+{
+        double milliseconds[STAGE_COUNT];
+        unsigned long long counts[STAGE_COUNT][COUNTER_COUNT];
+
+        Profile() { clear(); }
+        void clear();
+        void add(const Profile& profile);
+};
+
+/*!
+ * Attributes time and hardware performance counters (Linux perf_event_open, user space
+ * only) to the decoding stages of the calling thread. The decoder switches the stage
+ * once per MCU row, so JpegDecoder::setProfiler makes it decode with a single thread.
+ *
+ * If the counters can't be opened (perf_event_paranoid, seccomp, no PMU in a virtual
+ * machine, no Linux) only the time is measured, a single missing counter is reported
+ * as such and the others are still used.
+ */
+class StageProfiler
+{
+private:
+        int descriptors[COUNTER_COUNT];         // -1 if the counter isn't available
+        int order[COUNTER_COUNT];               // counter of the n-th value of a group read
+        int opened;
+        std::string error;
+        int stage;                              // -1 while stopped
+        unsigned long long last[COUNTER_COUNT];
+        double lastTime;
+        Profile profile;
+
+        void sample(unsigned long long* values, double& time);
+public:
+        StageProfiler();
+        ~StageProfiler();
+        StageProfiler(const StageProfiler&) = delete;
+        StageProfiler& operator=(const StageProfiler&) = delete;
+
+        // the counts from now on belong to stage (the previous one is closed)
+        void enter(ProfileStage stage);
+        void stop();
+
+        bool hasCounter(int counter) { return descriptors[counter] >= 0; }
+        // why counters are missing, empty if all are available
+        const std::string& getError() { return error; }
+        const Profile& getProfile() { return profile; }
+        void reset() { profile.clear(); }
+
+        // table with a line per stage and the total, counters that aren't available are left out
+        void print(std::ostream& out, const Profile& profile);
+};
+
+#endif // __PROFILER_H
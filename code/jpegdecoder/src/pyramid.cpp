@@ -0,0 +1,212 @@
+#include "pyramid.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+
+#include "jpegdecoder.h"
+#include "jpegencoder.h"
+using namespace std;
+
+PyramidSink::PyramidSink(TileWriter* writer, int tileSize)
+{
+        this->writer = writer;
+        this->tileSize = tileSize;
+}
+
+int PyramidSink::begin(int width, int height)
+{
+        // level 0 is 1x1, ceil(log2(max(width, height))) + 1 levels
+        int count = 1;
+        while ((1 << (count - 1)) < max(width, height))
+                count++;
+
+        levels.clear();
+        levels.resize(count);
+        for (int l = count - 1; l >= 0; l--) {
+                Level& level = levels[l];
+                level.width = width;
+                level.height = height;
+                level.received = 0;
+                level.tileRow = 0;
+                level.stripRows = 0;
+                level.strip.resize((size_t)tileSize * width * 3);
+                level.pending.resize(width * 3);
+                level.half.resize((width + 1) / 2 * 3);
+                width = (width + 1) / 2;
+                height = (height + 1) / 2;
+        }
+        return writer->begin(levels.back().width, levels.back().height, count, tileSize);
+}
+
+int PyramidSink::band(int y, int rows, const unsigned char* rgb, int stride)
+{
+        for (int row = 0; row < rows; row++) {
+                int errcode = pushRow((int)levels.size() - 1, rgb + row * stride);
+                if (errcode != 0)
+                        return errcode;
+        }
+        return 0;
+}
+
+// adds the next row to the strip of the level and the pair of rows to the level below
+int PyramidSink::pushRow(int index, const unsigned char* rgb)
+{
+        Level& level = levels[index];
+        memcpy(&level.strip[(size_t)level.stripRows * level.width * 3], rgb, level.width * 3);
+        level.stripRows++;
+        level.received++;
+        bool last = level.received == level.height;
+        if (level.stripRows == tileSize || last) {
+                int errcode = flushStrip(index);
+                if (errcode != 0)
+                        return errcode;
+        }
+
+        if (index == 0)
+                return 0;
+        if (level.received % 2 == 1) {
+                // an odd height repeats the last row
+                if (last)
+                        return downsample(index, rgb, rgb);
+                memcpy(level.pending.data(), rgb, level.width * 3);
+                return 0;
+        }
+        return downsample(index, level.pending.data(), rgb);
+}
+
+// 2x2 average, an odd width repeats the last column
+int PyramidSink::downsample(int index, const unsigned char* upper, const unsigned char* lower)
+{
+        Level& level = levels[index];
+        unsigned char* half = level.half.data();
+        int pairs = level.width / 2;
+        for (int x = 0; x < pairs; x++) {
+                for (int c = 0; c < 3; c++) {
+                        half[3 * x + c] = (upper[6 * x + c] + upper[6 * x + 3 + c]
+                                           + lower[6 * x + c] + lower[6 * x + 3 + c] + 2) >> 2;
+                }
+        }
+        if (level.width % 2 == 1) {
+                int x = level.width - 1;
+                for (int c = 0; c < 3; c++)
+                        half[3 * pairs + c] = (upper[3 * x + c] + lower[3 * x + c] + 1) >> 1;
+        }
+        return pushRow(index - 1, half);
+}
+
+// hands a complete row of tiles to the writer
+int PyramidSink::flushStrip(int index)
+{
+        Level& level = levels[index];
+        int stride = level.width * 3;
+        for (int column = 0; column * tileSize < level.width; column++) {
+                int width = min(tileSize, level.width - column * tileSize);
+                int errcode = writer->tile(index, column, level.tileRow, &level.strip[column * tileSize * 3],
+                                           width, level.stripRows, stride);
+                if (errcode != 0)
+                        return errcode;
+        }
+        level.tileRow++;
+        level.stripRows = 0;
+        return 0;
+}
+
+DziWriter::DziWriter(const string& base, bool jpeg, int quality)
+{
+        this->base = base;
+        this->jpeg = jpeg;
+        this->quality = quality;
+        tiles = 0;
+}
+
+int DziWriter::begin(int width, int height, int levels, int tileSize)
+{
+        ofstream descriptor((base + ".dzi").c_str());
+        descriptor << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                   << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\""
+                   << (jpeg ? "jpg" : "ppm") << "\" Overlap=\"0\" TileSize=\"" << tileSize << "\">\n"
+                   << "  <Size Width=\"" << width << "\" Height=\"" << height << "\"/>\n"
+                   << "</Image>\n";
+        if (!descriptor)
+                return ERROR_TILEWRITE;
+
+        string directory = base + "_files";
+        mkdir(directory.c_str(), 0755);
+        for (int level = 0; level < levels; level++)
+                mkdir((directory + "/" + to_string(level)).c_str(), 0755);
+        tiles = 0;
+        return 0;
+}
+
+int DziWriter::tile(int level, int column, int row, const unsigned char* rgb, int width, int height, int stride)
+{
+        string path = base + "_files/" + to_string(level) + "/" + to_string(column) + "_" + to_string(row);
+        string data;
+        if (jpeg) {
+                JpegEncoder encoder;
+                encoder.setQuality(quality);
+                int errcode = encoder.encode(rgb, width, height, stride, PIXEL_RGB, data);
+                if (errcode != 0)
+                        return errcode;
+                path += ".jpg";
+        } else {
+                data = "P6\n" + to_string(width) + " " + to_string(height) + "\n255\n";
+                for (int y = 0; y < height; y++)
+                        data.append((const char*)rgb + y * stride, width * 3);
+                path += ".ppm";
+        }
+
+        ofstream file(path.c_str(), ios::binary);
+        file.write(data.data(), data.size());
+        if (!file)
+                return ERROR_TILEWRITE;
+        tiles++;
+        return 0;
+}
+
+int pyramidCommand(int argc, char** argv)
+{
+        bool jpeg = true;
+        int quality = 75;
+        int tileSize = 256;
+        int i = 1;
+        for (; i + 2 < argc; i++) {
+                string arg = argv[i];
+                if (arg == "-f" && i + 3 < argc) {
+                        jpeg = string(argv[++i]) != "ppm";
+                } else if (arg == "-q" && i + 3 < argc) {
+                        quality = atoi(argv[++i]);
+                } else if (arg == "-s" && i + 3 < argc) {
+                        tileSize = max(16, atoi(argv[++i]));
+                } else {
+                        break;
+                }
+        }
+        if (i + 2 != argc) {
+                cout << "Usage: ./jpgd pyramid [-f jpg|ppm] [-q quality] [-s tilesize] input.jpg base" << endl
+                     << "        writes base.dzi and the tiles of all levels to base_files/ (default 256x256 jpg)" << endl;
+                return -1;
+        }
+
+        JpegDecoder decoder;
+        if (!decoder.read(argv[i])) {
+                cout << "Could not read " << argv[i] << endl;
+                return 1;
+        }
+
+        auto start = chrono::steady_clock::now();
+        DziWriter writer(argv[i + 1], jpeg, quality);
+        PyramidSink pyramid(&writer, tileSize);
+        decoder.setSink(&pyramid);
+        int errcode = decoder.decode();
+        if (errcode != 0) {
+                cout << argv[i] << ": error code " << errcode << endl;
+                return 1;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << writer.getTiles() << " tiles in " << pyramid.getLevels() << " levels, " << seconds << " s" << endl;
+        return 0;
+}
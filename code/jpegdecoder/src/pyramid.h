@@ -0,0 +1,87 @@
+#ifndef __PYRAMID_H
+#define __PYRAMID_H
+
+#include <string>
+#include <vector>
+#include "rowsink.h"
+
+#define ERROR_TILEWRITE         0xA0    // a tile or the descriptor couldn't be written
+
+// receives the tiles of a PyramidSink
+class TileWriter
+{
+public:
+        virtual ~TileWriter() {}
+        // called once before the first tile, level levels - 1 is the full image, level 0 is 1x1
+        virtual int begin(int width, int height, int levels, int tileSize) { return 0; }
+        // RGB pixels of the tile at column, row (in tiles) of the level, stride in bytes
+        virtual int tile(int level, int column, int row, const unsigned char* rgb, int width, int height, int stride) = 0;
+};
+
+/*!
+ * Builds a deep zoom tile pyramid (DZI levels: every level halves the size of the
+ * one above, rounded up, down to 1x1) while the image is decoded. The decoded rows
+ * are cut into tiles as soon as a row of tiles is complete and are averaged 2x2
+ * into the next smaller level at the same time, so the image is decoded once and
+ * only one row of tiles and one pending row per level are kept in memory.
+ */
+class PyramidSink : public RowSink
+{
+private:
+        struct Level
+        {
+                int width;
+                int height;
+                int received;                           // rows of the level so far
+                int tileRow;                            // of the strip
+                int stripRows;
+                std::vector<unsigned char> strip;       // one row of tiles
+                std::vector<unsigned char> pending;     // even row waiting for its odd partner
+                std::vector<unsigned char> half;        // averaged row for the next level
+        };
+
+        TileWriter* writer;
+        int tileSize;
+        std::vector<Level> levels;
+
+        int pushRow(int level, const unsigned char* rgb);
+        int flushStrip(int level);
+        int downsample(int level, const unsigned char* upper, const unsigned char* lower);
+
+public:
+        explicit PyramidSink(TileWriter* writer, int tileSize = 256);
+
+        int getLevels() { return (int)levels.size(); }
+
+        virtual int begin(int width, int height);
+        virtual int band(int y, int rows, const unsigned char* rgb, int stride);
+};
+
+/*!
+ * Writes a DZI pyramid: base.dzi and the tiles as base_files/level/column_row.jpg
+ * (re-encoded with the JpegEncoder) or .ppm.
+ */
+class DziWriter : public TileWriter
+{
+private:
+        std::string base;
+        bool jpeg;
+        int quality;
+        int tiles;
+
+public:
+        DziWriter(const std::string& base, bool jpeg, int quality);
+
+        int getTiles() { return tiles; }
+
+        virtual int begin(int width, int height, int levels, int tileSize);
+        virtual int tile(int level, int column, int row, const unsigned char* rgb, int width, int height, int stride);
+};
+
+/*!
+ * ./jpgd pyramid [-f jpg|ppm] [-q quality] [-s tilesize] input.jpg base: writes
+ * base.dzi and base_files/, argv[0] is "pyramid".
+ */
+int pyramidCommand(int argc, char** argv);
+
+#endif // __PYRAMID_H
@@ -0,0 +1,864 @@
+#include "recompress.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bitwriter.h"
+#include "huffmanencoder.h"
+#include "jpegdecoder.h"
+#include "zigzag.h"
+using namespace std;
+
+#define PACK_STORED             0       // the original file follows
+#define PACK_CODED              1       // header, trailer, padding and the range coded coefficients
+
+#define PROBABILITY_BITS        12
+#define ADAPTATION_SHIFT        5
+
+static const char packMagic[4] = { 'J', 'P', 'Z', 1 };   // the last byte is the version
+
+// the scan of a supported file, parsed from the segments in front of it
+struct ScanLayout
+{
+        int width;
+        int height;
+        int mcusPerRow;
+        int mcuRows;
+        int restartInterval;
+        struct Component
+        {
+                int index;              // in the CoefficientImage (component id - 1)
+                int hsf;
+                int vsf;
+                int dcTable;
+                int acTable;
+        } components[3];                // in scan order
+        HuffmanSpec dc[4];
+        HuffmanSpec ac[4];
+        bool hasDC[4];
+        bool hasAC[4];
+        size_t scanStart;               // first byte of the entropy coded data
+};
+
+/*!
+ * Walks the segments up to the first SOS. Only files the scan of which can be coded
+ * again are accepted: one baseline frame (SOF0) with three components in a single
+ * interleaved scan, every table the scan refers to defined before it.
+ */
+static bool parseLayout(const unsigned char* data, size_t length, ScanLayout& layout)
+{
+        if (length < 4 || data[0] != 0xFF || data[1] != 0xD8)
+                return false;
+
+        int hsf[3] = { 0, 0, 0 };
+        int vsf[3] = { 0, 0, 0 };
+        bool frame = false;
+        layout.restartInterval = 0;
+        for (int t = 0; t < 4; t++)
+                layout.hasDC[t] = layout.hasAC[t] = false;
+
+        size_t position = 2;
+        while (true) {
+                if (position + 4 > length || data[position] != 0xFF)
+                        return false;
+                unsigned char marker = data[position + 1];
+                if (marker == 0xFF) {   // fill byte
+                        position++;
+                        continue;
+                }
+                size_t segment = (data[position + 2] << 8) | data[position + 3];
+                if (segment < 2 || position + 2 + segment > length)
+                        return false;
+                const unsigned char* p = data + position + 4;
+                size_t n = segment - 2;
+
+                if (marker == 0xC0) {
+                        if (n < 15 || p[0] != 8 || p[5] != 3)
+                                return false;
+                        layout.height = (p[1] << 8) | p[2];
+                        layout.width = (p[3] << 8) | p[4];
+                        for (int i = 0; i < 3; i++) {
+                                int id = p[6 + 3 * i];
+                                if (id < 1 || id > 3)
+                                        return false;
+                                hsf[id - 1] = p[7 + 3 * i] >> 4;
+                                vsf[id - 1] = p[7 + 3 * i] & 0x0F;
+                                if (hsf[id - 1] < 1 || hsf[id - 1] > 4 || vsf[id - 1] < 1 || vsf[id - 1] > 4)
+                                        return false;
+                        }
+                        frame = layout.width > 0 && layout.height > 0;
+                } else if (marker == 0xC4) {
+                        while (n > 0) {
+                                int type = p[0] >> 4;
+                                int table = p[0] & 0x0F;
+                                if (type > 1 || table > 3 || n < 17)
+                                        return false;
+                                HuffmanSpec& spec = type == 0 ? layout.dc[table] : layout.ac[table];
+                                int count = 0;
+                                for (int i = 0; i < 16; i++) {
+                                        spec.bits[i] = p[1 + i];
+                                        count += spec.bits[i];
+                                }
+                                if (count > 256 || n < 17 + (size_t)count)
+                                        return false;
+                                memcpy(spec.values, p + 17, count);
+                                (type == 0 ? layout.hasDC : layout.hasAC)[table] = true;
+                                p += 17 + count;
+                                n -= 17 + count;
+                        }
+                } else if (marker == 0xDD) {
+                        if (n < 2)
+                                return false;
+                        layout.restartInterval = (p[0] << 8) | p[1];
+                } else if (marker == 0xDA) {
+                        if (!frame || n != 10 || p[0] != 3 || p[7] != 0 || p[8] != 63 || p[9] != 0)
+                                return false;
+                        for (int i = 0; i < 3; i++) {
+                                ScanLayout::Component& component = layout.components[i];
+                                int id = p[1 + 2 * i];
+                                if (id < 1 || id > 3 || hsf[id - 1] == 0)
+                                        return false;
+                                for (int j = 0; j < i; j++) {
+                                        if (layout.components[j].index == id - 1)
+                                                return false;
+                                }
+                                component.index = id - 1;
+                                component.hsf = hsf[id - 1];
+                                component.vsf = vsf[id - 1];
+                                component.dcTable = p[2 + 2 * i] >> 4;
+                                component.acTable = p[2 + 2 * i] & 0x0F;
+                                if (component.dcTable > 3 || component.acTable > 3
+                                    || !layout.hasDC[component.dcTable] || !layout.hasAC[component.acTable])
+                                        return false;
+                        }
+                        int hmax = max(hsf[0], max(hsf[1], hsf[2]));
+                        int vmax = max(vsf[0], max(vsf[1], vsf[2]));
+                        layout.mcusPerRow = (layout.width + 8 * hmax - 1) / (8 * hmax);
+                        layout.mcuRows = (layout.height + 8 * vmax - 1) / (8 * vmax);
+                        layout.scanStart = position + 2 + segment;
+                        return true;
+                } else if (marker >= 0xC1 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+                        return false;   // progressive, lossless, arithmetic ...
+                } else if (marker == 0xD9) {
+                        return false;
+                }
+                position += 2 + segment;
+        }
+}
+
+// first marker after the entropy coded data which isn't a restart marker
+static size_t findScanEnd(const unsigned char* data, size_t length, size_t position)
+{
+        for (; position + 1 < length; position++) {
+                unsigned char next = data[position + 1];
+                if (data[position] == 0xFF && next != 0x00 && (next < 0xD0 || next > 0xD7))
+                        return position;
+        }
+        return length;
+}
+
+static inline int magnitudeBits(int value)
+{
+        return value == 0 ? 0 : 32 - __builtin_clz((unsigned int)abs(value));
+}
+
+// adaptive probability of a 0 bit in units of 2^-PROBABILITY_BITS
+struct Bit
+{
+        unsigned short p;
+        Bit() : p(1 << (PROBABILITY_BITS - 1)) {}
+};
+
+// binary range coder with carry propagation (as in LZMA), 4 bytes of state are flushed at the end
+class RangeEncoder
+{
+private:
+        string& out;
+        uint64_t low;
+        uint32_t range;
+        unsigned char cache;            // last byte, may still receive a carry
+        size_t pending;                 // cache and the 0xFF bytes behind it
+
+        void shiftLow()
+        {
+                if ((uint32_t)low < 0xFF000000u || (low >> 32) != 0) {
+                        unsigned char carry = (unsigned char)(low >> 32);
+                        unsigned char byte = cache;
+                        do {
+                                out += (char)(unsigned char)(byte + carry);
+                                byte = 0xFF;
+                        } while (--pending != 0);
+                        cache = (unsigned char)(low >> 24);
+                }
+                pending++;
+                low = (low & 0x00FFFFFF) << 8;
+        }
+
+public:
+        static const bool decoding = false;
+
+        explicit RangeEncoder(string& out) : out(out), low(0), range(0xFFFFFFFF), cache(0), pending(1) {}
+
+        inline int code(int bit, Bit& probability)
+        {
+                uint32_t bound = (range >> PROBABILITY_BITS) * probability.p;
+                if (bit == 0) {
+                        range = bound;
+                        probability.p += ((1 << PROBABILITY_BITS) - probability.p) >> ADAPTATION_SHIFT;
+                } else {
+                        low += bound;
+                        range -= bound;
+                        probability.p -= probability.p >> ADAPTATION_SHIFT;
+                }
+                while (range < (1u << 24)) {
+                        range <<= 8;
+                        shiftLow();
+                }
+                return bit;
+        }
+
+        // bit with probability 1/2, no statistics
+        inline int direct(int bit)
+        {
+                range >>= 1;
+                if (bit != 0)
+                        low += range;
+                while (range < (1u << 24)) {
+                        range <<= 8;
+                        shiftLow();
+                }
+                return bit;
+        }
+
+        void flush()
+        {
+                for (int i = 0; i < 5; i++)
+                        shiftLow();
+        }
+};
+
+class RangeDecoder
+{
+private:
+        const unsigned char* data;
+        const unsigned char* end;
+        uint32_t range;
+        uint32_t value;
+
+        // zeros behind the end, damaged data only produces wrong coefficients
+        unsigned char next() { return data < end ? *data++ : 0; }
+
+public:
+        static const bool decoding = true;
+
+        RangeDecoder(const unsigned char* data, size_t length) : data(data), end(data + length), range(0xFFFFFFFF), value(0)
+        {
+                for (int i = 0; i < 5; i++)
+                        value = (value << 8) | next();
+        }
+
+        // the bit argument is ignored, the model calls the encoder and the decoder the same way
+        inline int code(int, Bit& probability)
+        {
+                uint32_t bound = (range >> PROBABILITY_BITS) * probability.p;
+                int bit;
+                if (value < bound) {
+                        range = bound;
+                        probability.p += ((1 << PROBABILITY_BITS) - probability.p) >> ADAPTATION_SHIFT;
+                        bit = 0;
+                } else {
+                        value -= bound;
+                        range -= bound;
+                        probability.p -= probability.p >> ADAPTATION_SHIFT;
+                        bit = 1;
+                }
+                while (range < (1u << 24)) {
+                        range <<= 8;
+                        value = (value << 8) | next();
+                }
+                return bit;
+        }
+
+        inline int direct(int)
+        {
+                range >>= 1;
+                int bit = value >= range;
+                if (bit != 0)
+                        value -= range;
+                while (range < (1u << 24)) {
+                        range <<= 8;
+                        value = (value << 8) | next();
+                }
+                return bit;
+        }
+};
+
+// frequency bands of the zigzag positions, the statistics of a band are shared
+static const unsigned char bands[64] = {
+        0, 1, 1, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7,
+        7, 7, 7, 7, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9
+};
+
+/*!
+ * Statistics of the coefficients, [0] luminance, [1] chrominance. A block is coded as
+ * the DC difference to the MED prediction from the blocks above, left and above left,
+ * the number of nonzero AC coefficients (context: the counts of the neighbours) and
+ * then zero flags in zigzag order until all nonzero coefficients are found (context:
+ * position, nonzero coefficients left and the magnitudes of the neighbours at the same
+ * position). Values are coded as unary exponent, mantissa bits and sign.
+ */
+struct CoefficientModel
+{
+        Bit nonzeros[2][8][64];                 // binary tree of the count
+        Bit zero[2][64][8][8];                  // [position][nonzeros left][neighbours]
+        Bit exponent[2][10][8][15];             // [band][neighbours][unary bit]
+        Bit mantissa[2][15][15];                // [exponent][bit]
+        Bit sign[2][10][9];                     // [band][signs of the neighbours]
+        Bit dcZero[2][12];                      // [activity of the neighbours]
+        Bit dcExponent[2][12][15];
+        Bit dcMantissa[2][15][15];
+        Bit dcSign[2][12];
+};
+
+// 0..7, the number of bits of the value
+static inline int bucket(int value)
+{
+        return min(magnitudeBits(value), 7);
+}
+
+// value != 0, at most 15 bits
+template<typename Coder>
+static inline int codeValue(Coder& coder, Bit* exponent, Bit (*mantissa)[15], Bit& sign, int value)
+{
+        int magnitude = abs(value);
+        int bits = magnitudeBits(magnitude);
+        int n = 1;
+        while (n < 15 && coder.code(n < bits, exponent[n - 1]))
+                n++;
+        // the two bits below the leading one are modelled, the lower ones are close to random
+        int result = 1;
+        for (int i = n - 2; i >= 0; i--) {
+                int bit = (magnitude >> i) & 1;
+                result = (result << 1) | (i >= n - 3 ? coder.code(bit, mantissa[n - 1][i]) : coder.direct(bit));
+        }
+        return coder.code(value < 0, sign) ? -result : result;
+}
+
+// number of nonzero AC coefficients of a block in natural order
+static inline int countNonzeros(const short* block)
+{
+        int nonzeros = 0;
+        for (int k = 1; k < 64; k++)
+                nonzeros += block[k] != 0;
+        return nonzeros;
+}
+
+static inline int sgn(int value)
+{
+        return (value > 0) - (value < 0);
+}
+
+/*!
+ * Codes one block in natural order. The decoder gets a zeroed block, above, left and
+ * aboveLeft are nullptr outside of the component, count receives the number of nonzero
+ * AC coefficients.
+ */
+template<typename Coder>
+static void codeBlock(Coder& coder, CoefficientModel& model, int type, short* block, const short* above,
+                      const short* left, const short* aboveLeft, int countAbove, int countLeft, unsigned char& count)
+{
+        // DC
+        int predicted = 0;
+        int activity = 11;
+        if (above != nullptr && left != nullptr) {
+                int a = above[0], l = left[0], c = aboveLeft[0];
+                if (c >= max(a, l))
+                        predicted = min(a, l);
+                else if (c <= min(a, l))
+                        predicted = max(a, l);
+                else
+                        predicted = a + l - c;
+                activity = min(magnitudeBits(a - l), 10);
+        } else if (above != nullptr) {
+                predicted = above[0];
+        } else if (left != nullptr) {
+                predicted = left[0];
+        }
+        int diff = block[0] - predicted;
+        if (coder.code(diff != 0, model.dcZero[type][activity]))
+                diff = codeValue(coder, model.dcExponent[type][activity], model.dcMantissa[type], model.dcSign[type][activity], diff);
+        else
+                diff = 0;
+        block[0] = (short)(predicted + diff);
+
+        // number of nonzero AC coefficients
+        int nonzeros = Coder::decoding ? 0 : countNonzeros(block);
+        int expected = 0;
+        if (above != nullptr && left != nullptr)
+                expected = (countAbove + countLeft + 1) >> 1;
+        else if (above != nullptr)
+                expected = countAbove;
+        else if (left != nullptr)
+                expected = countLeft;
+        Bit* tree = model.nonzeros[type][bucket(expected)];
+        int node = 1;
+        for (int bit = 5; bit >= 0; bit--)
+                node = (node << 1) | coder.code((nonzeros >> bit) & 1, tree[node]);
+        nonzeros = node - 64;
+        count = (unsigned char)nonzeros;
+
+        // AC in zigzag order
+        int remaining = nonzeros;
+        for (int k = 1; k < 64 && remaining > 0; k++) {
+                int position = zz[k];
+                int a = above != nullptr ? above[position] : 0;
+                int l = left != nullptr ? left[position] : 0;
+                int neighbours = (above != nullptr && left != nullptr) ? abs(a) + abs(l) : 2 * (abs(a) + abs(l));
+                int context = bucket(neighbours);
+                int value = block[position];
+                // the rest of the positions are all nonzero
+                if (remaining < 64 - k && !coder.code(value != 0, model.zero[type][k][min(remaining, 8) - 1][context]))
+                        continue;
+                int band = bands[k];
+                block[position] = (short)codeValue(coder, model.exponent[type][band][context], model.mantissa[type],
+                                                   model.sign[type][band][(sgn(a) + 1) * 3 + sgn(l) + 1], value);
+                remaining--;
+        }
+}
+
+// the block rows of a component the model needs: the current and the previous MCU row
+struct BlockRows
+{
+        int blocksWide;
+        int rows;
+        vector<short> coefficients;
+        vector<unsigned char> counts;
+
+        void init(int blocksWide, int vsf)
+        {
+                this->blocksWide = blocksWide;
+                rows = 2 * vsf;
+                coefficients.assign((size_t)blocksWide * rows * 64, 0);
+                counts.assign((size_t)blocksWide * rows, 0);
+        }
+        short* block(int x, int y) { return &coefficients[((size_t)(y % rows) * blocksWide + x) * 64]; }
+        unsigned char& count(int x, int y) { return counts[(y % rows) * blocksWide + x]; }
+};
+
+// state of the huffman coded scan in front of the first MCU of a segment
+struct SegmentStart
+{
+        int bits;                       // bits of the byte which isn't complete yet
+        unsigned int partial;           // their values
+        int previousDC[3];
+};
+
+// huffman codes the blocks again, like the original encoder did
+class ScanWriter
+{
+private:
+        string& out;
+        BitWriter writer;
+        const ScanLayout& layout;
+        HuffmanEncoder dc[3];
+        HuffmanEncoder ac[3];
+        bool ones;                      // padding bits in front of markers
+        int previousDC[3];
+        int mcu;
+
+        void write(const HuffmanEncoder& encoder, int symbol, int value, int bits)
+        {
+                encoder.encode(writer, (unsigned char)symbol);
+                if (bits != 0)
+                        writer.write(value, bits);
+        }
+
+public:
+        ScanWriter(string& out, const ScanLayout& layout, bool ones, int mcu, const SegmentStart& start)
+                : out(out), writer(out), layout(layout),
+                  dc { HuffmanEncoder(layout.dc[layout.components[0].dcTable]), HuffmanEncoder(layout.dc[layout.components[1].dcTable]),
+                       HuffmanEncoder(layout.dc[layout.components[2].dcTable]) },
+                  ac { HuffmanEncoder(layout.ac[layout.components[0].acTable]), HuffmanEncoder(layout.ac[layout.components[1].acTable]),
+                       HuffmanEncoder(layout.ac[layout.components[2].acTable]) },
+                  ones(ones), mcu(mcu)
+        {
+                writer.resume(start.partial, start.bits);
+                for (int i = 0; i < 3; i++)
+                        previousDC[i] = start.previousDC[i];
+        }
+
+        void state(SegmentStart& start)
+        {
+                start.bits = writer.partial(start.partial);
+                for (int i = 0; i < 3; i++)
+                        start.previousDC[i] = previousDC[i];
+        }
+
+        // called in front of every MCU, writes the restart markers
+        void startMCU()
+        {
+                if (layout.restartInterval != 0 && mcu != 0 && mcu % layout.restartInterval == 0) {
+                        writer.flush(ones);
+                        out += (char)0xFF;
+                        out += (char)(0xD0 + (mcu / layout.restartInterval - 1) % 8);
+                        for (int i = 0; i < 3; i++)
+                                previousDC[i] = 0;
+                }
+                mcu++;
+        }
+
+        // block of the i-th component of the scan in natural order with nonzeros nonzero AC coefficients
+        void block(int i, const short* block, int nonzeros)
+        {
+                int diff = block[0] - previousDC[i];
+                previousDC[i] = block[0];
+                int bits = magnitudeBits(diff);
+                write(dc[i], bits, diff < 0 ? diff - 1 : diff, bits);
+
+                int run = 0;
+                for (int k = 1; nonzeros > 0; k++) {
+                        int value = block[zz[k]];
+                        if (value == 0) {
+                                run++;
+                                continue;
+                        }
+                        while (run > 15) {
+                                write(ac[i], 0xF0, 0, 0);
+                                run -= 16;
+                        }
+                        bits = magnitudeBits(value);
+                        write(ac[i], (run << 4) | bits, value < 0 ? value - 1 : value, bits);
+                        run = 0;
+                        nonzeros--;
+                }
+                if (block[zz[63]] == 0)
+                        write(ac[i], 0x00, 0, 0);
+        }
+
+        // writes the complete bytes, the end of the scan is padded
+        void finish(bool last)
+        {
+                unsigned int bits;
+                if (last)
+                        writer.flush(ones);
+                else
+                        writer.partial(bits);
+        }
+};
+
+/*!
+ * The huffman coded scan of the coefficients, the state at the start of every
+ * segment of rowsPerSegment MCU rows is stored in starts.
+ */
+static void writeScan(const ScanLayout& layout, const CoefficientImage& image, bool ones, int rowsPerSegment,
+                      string& out, vector<SegmentStart>& starts)
+{
+        SegmentStart start = { 0, 0, { 0, 0, 0 } };
+        ScanWriter writer(out, layout, ones, 0, start);
+        starts.clear();
+        for (int my = 0; my < layout.mcuRows; my++) {
+                if (my % rowsPerSegment == 0) {
+                        writer.state(start);
+                        starts.push_back(start);
+                }
+                for (int mx = 0; mx < layout.mcusPerRow; mx++) {
+                        writer.startMCU();
+                        for (int i = 0; i < 3; i++) {
+                                const ScanLayout::Component& component = layout.components[i];
+                                const ComponentCoefficients& coefficients = image.components[component.index];
+                                for (int v = 0; v < component.vsf; v++) {
+                                        for (int h = 0; h < component.hsf; h++) {
+                                                const short* block = coefficients.block(mx * component.hsf + h, my * component.vsf + v);
+                                                writer.block(i, block, countNonzeros(block));
+                                        }
+                                }
+                        }
+                }
+        }
+        writer.finish(true);
+}
+
+/*!
+ * All blocks of the MCU rows [firstRow, lastRow) in the order of the scan, every
+ * segment starts with fresh statistics and without the blocks above. Packing takes
+ * the blocks from source, unpacking decodes them and passes them to the writer.
+ */
+template<typename Coder>
+static void codeSegment(Coder& coder, const ScanLayout& layout, int firstRow, int lastRow,
+                        const CoefficientImage* source, ScanWriter* writer)
+{
+        unique_ptr<CoefficientModel> model(new CoefficientModel());
+        BlockRows rows[3];
+        for (int i = 0; i < 3; i++)
+                rows[i].init(layout.mcusPerRow * layout.components[i].hsf, layout.components[i].vsf);
+
+        for (int my = firstRow; my < lastRow; my++) {
+                for (int mx = 0; mx < layout.mcusPerRow; mx++) {
+                        if (writer != nullptr)
+                                writer->startMCU();
+                        for (int i = 0; i < 3; i++) {
+                                const ScanLayout::Component& component = layout.components[i];
+                                BlockRows& plane = rows[i];
+                                int type = component.index == 0 ? 0 : 1;
+                                int top = firstRow * component.vsf;
+                                for (int v = 0; v < component.vsf; v++) {
+                                        for (int h = 0; h < component.hsf; h++) {
+                                                int x = mx * component.hsf + h;
+                                                int y = my * component.vsf + v;
+                                                short* block = plane.block(x, y);
+                                                if (source != nullptr)
+                                                        memcpy(block, source->components[component.index].block(x, y), 64 * sizeof(short));
+                                                else
+                                                        memset(block, 0, 64 * sizeof(short));
+                                                codeBlock(coder, *model, type, block,
+                                                          y > top ? plane.block(x, y - 1) : nullptr,
+                                                          x > 0 ? plane.block(x - 1, y) : nullptr,
+                                                          x > 0 && y > top ? plane.block(x - 1, y - 1) : nullptr,
+                                                          y > top ? plane.count(x, y - 1) : 0,
+                                                          x > 0 ? plane.count(x - 1, y) : 0, plane.count(x, y));
+                                                if (writer != nullptr)
+                                                        writer->block(i, block, plane.count(x, y));
+                                        }
+                                }
+                        }
+                }
+        }
+}
+
+// runs function(0) .. function(count - 1) on up to threads threads, 0 = one per core
+template<typename F>
+static void parallelFor(int count, int threads, F function)
+{
+        if (threads <= 0)
+                threads = max(1, (int)thread::hardware_concurrency());
+        threads = min(threads, count);
+        if (threads <= 1) {
+                for (int i = 0; i < count; i++)
+                        function(i);
+                return;
+        }
+        atomic<int> next(0);
+        vector<thread> pool;
+        for (int t = 0; t < threads; t++) {
+                pool.emplace_back([&]() {
+                        for (int i = next++; i < count; i = next++)
+                                function(i);
+                });
+        }
+        for (auto& worker : pool)
+                worker.join();
+}
+
+static void appendNumber(string& out, size_t value, int bytes)
+{
+        for (int shift = 8 * (bytes - 1); shift >= 0; shift -= 8)
+                out += (char)(unsigned char)(value >> shift);
+}
+
+static bool readNumber(const string& data, size_t& position, int bytes, size_t& value)
+{
+        if (position + bytes > data.size())
+                return false;
+        value = 0;
+        for (int i = 0; i < bytes; i++)
+                value = (value << 8) | (unsigned char)data[position++];
+        return true;
+}
+
+/*!
+ * The coded representation with the given padding bits: header, trailer, padding,
+ * segment size, then per segment the length of its range coded data and its start
+ * state, then the data of all segments. Empty if the file isn't reproduced.
+ */
+static string packCoded(const string& jpeg, const ScanLayout& layout, const CoefficientImage& image, size_t scanEnd,
+                        bool ones, int threads)
+{
+        // the segments are coded and decoded in parallel, at least 32 MCU rows keep the statistics useful
+        int rowsPerSegment = max(32, (layout.mcuRows + 15) / 16);
+        int segments = (layout.mcuRows + rowsPerSegment - 1) / rowsPerSegment;
+
+        string scan;
+        vector<SegmentStart> starts;
+        writeScan(layout, image, ones, rowsPerSegment, scan, starts);
+        if (scan.size() != scanEnd - layout.scanStart || jpeg.compare(layout.scanStart, scan.size(), scan) != 0)
+                return string();
+
+        vector<string> coded(segments);
+        parallelFor(segments, threads, [&](int s) {
+                RangeEncoder encoder(coded[s]);
+                codeSegment(encoder, layout, s * rowsPerSegment, min(layout.mcuRows, (s + 1) * rowsPerSegment), &image, nullptr);
+                encoder.flush();
+        });
+
+        string packed(packMagic, 4);
+        packed += (char)PACK_CODED;
+        appendNumber(packed, layout.scanStart, 4);
+        packed.append(jpeg, 0, layout.scanStart);
+        appendNumber(packed, jpeg.size() - scanEnd, 4);
+        packed.append(jpeg, scanEnd, string::npos);
+        packed += (char)(ones ? 1 : 0);
+        appendNumber(packed, rowsPerSegment, 2);
+        for (int s = 0; s < segments; s++) {
+                appendNumber(packed, coded[s].size(), 4);
+                appendNumber(packed, starts[s].bits, 1);
+                appendNumber(packed, starts[s].partial, 1);
+                for (int i = 0; i < 3; i++)
+                        appendNumber(packed, (unsigned short)starts[s].previousDC[i], 2);
+        }
+        for (int s = 0; s < segments; s++)
+                packed += coded[s];
+
+        string check;
+        if (unpackJpeg(packed, check, threads) != 0 || check != jpeg)
+                return string();
+        return packed;
+}
+
+int packJpeg(const string& jpeg, string& out, int threads)
+{
+        ScanLayout layout;
+        const unsigned char* data = (const unsigned char*)jpeg.data();
+        if (parseLayout(data, jpeg.size(), layout)) {
+                JpegDecoder decoder;
+                decoder.setThreads(threads);
+                decoder.setData(string(jpeg));
+                CoefficientImage image;
+                if (decoder.readCoefficients(image) == 0) {
+                        size_t scanEnd = findScanEnd(data, jpeg.size(), layout.scanStart);
+                        // most encoders pad with 1 bits, some with 0 bits
+                        for (int ones = 1; ones >= 0; ones--) {
+                                string packed = packCoded(jpeg, layout, image, scanEnd, ones != 0, threads);
+                                if (packed.empty())
+                                        continue;
+                                // the headers of the coded form outweigh the gain on tiny files
+                                if (packed.size() >= sizeof(packMagic) + 1 + jpeg.size())
+                                        break;
+                                out += packed;
+                                return 0;
+                        }
+                }
+        }
+
+        out.append(packMagic, 4);
+        out += (char)PACK_STORED;
+        out += jpeg;
+        return 0;
+}
+
+int unpackJpeg(const string& packed, string& out, int threads)
+{
+        if (packed.size() < 5 || packed.compare(0, 4, packMagic, 4) != 0)
+                return ERROR_PACKFORMAT;
+        if (packed[4] == PACK_STORED) {
+                out.append(packed, 5, string::npos);
+                return 0;
+        }
+        if (packed[4] != PACK_CODED)
+                return ERROR_PACKFORMAT;
+
+        size_t position = 5;
+        size_t headerLength, trailerLength, ones, rowsPerSegment;
+        if (!readNumber(packed, position, 4, headerLength) || position + headerLength > packed.size())
+                return ERROR_PACKFORMAT;
+        size_t header = position;
+        position += headerLength;
+        if (!readNumber(packed, position, 4, trailerLength) || position + trailerLength > packed.size())
+                return ERROR_PACKFORMAT;
+        size_t trailer = position;
+        position += trailerLength;
+        if (!readNumber(packed, position, 1, ones) || !readNumber(packed, position, 2, rowsPerSegment) || rowsPerSegment == 0)
+                return ERROR_PACKFORMAT;
+
+        ScanLayout layout;
+        if (!parseLayout((const unsigned char*)packed.data() + header, headerLength, layout)
+            || layout.scanStart != headerLength)
+                return ERROR_PACKFORMAT;
+
+        int segments = (layout.mcuRows + (int)rowsPerSegment - 1) / (int)rowsPerSegment;
+        vector<SegmentStart> starts(segments);
+        vector<size_t> offsets(segments + 1);
+        for (int s = 0; s < segments; s++) {
+                size_t length, bits, partial, dc;
+                if (!readNumber(packed, position, 4, length) || !readNumber(packed, position, 1, bits)
+                    || !readNumber(packed, position, 1, partial) || bits > 7)
+                        return ERROR_PACKFORMAT;
+                starts[s].bits = (int)bits;
+                starts[s].partial = (unsigned int)partial;
+                for (int i = 0; i < 3; i++) {
+                        if (!readNumber(packed, position, 2, dc))
+                                return ERROR_PACKFORMAT;
+                        starts[s].previousDC[i] = (short)dc;
+                }
+                offsets[s + 1] = offsets[s] + length;
+        }
+        if (position + offsets[segments] > packed.size())
+                return ERROR_PACKFORMAT;
+
+        // every segment writes the complete bytes of its part of the scan, the incomplete last
+        // byte is written by the next segment, which starts with the same bits
+        vector<string> scans(segments);
+        const unsigned char* data = (const unsigned char*)packed.data() + position;
+        parallelFor(segments, threads, [&](int s) {
+                RangeDecoder decoder(data + offsets[s], offsets[s + 1] - offsets[s]);
+                int firstRow = s * (int)rowsPerSegment;
+                ScanWriter writer(scans[s], layout, ones != 0, firstRow * layout.mcusPerRow, starts[s]);
+                codeSegment(decoder, layout, firstRow, min(layout.mcuRows, firstRow + (int)rowsPerSegment), nullptr, &writer);
+                writer.finish(s == segments - 1);
+        });
+
+        out.append(packed, header, headerLength);
+        for (auto& scan : scans)
+                out += scan;
+        out.append(packed, trailer, trailerLength);
+        return 0;
+}
+
+static bool readFile(const string& path, string& data)
+{
+        ifstream file(path.c_str(), ios::binary);
+        if (!file)
+                return false;
+        data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        return true;
+}
+
+int packCommand(int argc, char** argv)
+{
+        bool pack = string(argv[0]) == "pack";
+        if (argc != 3) {
+                cout << "Usage: ./jpgd pack input.jpg output.jpz" << endl
+                     << "       ./jpgd unpack input.jpz output.jpg" << endl;
+                return -1;
+        }
+
+        string input;
+        if (!readFile(argv[1], input)) {
+                cout << "Could not read " << argv[1] << endl;
+                return 1;
+        }
+        string output;
+        int errcode = pack ? packJpeg(input, output, 0) : unpackJpeg(input, output, 0);
+        if (errcode != 0) {
+                cout << argv[1] << ": error code " << errcode << endl;
+                return 1;
+        }
+
+        ofstream file(argv[2], ios::binary);
+        file.write(output.data(), output.size());
+        if (!file) {
+                cout << "Could not write " << argv[2] << endl;
+                return 1;
+        }
+        if (pack) {
+                cout << input.size() << " -> " << output.size() << " bytes ("
+                     << (output[4] == PACK_STORED ? "stored" : "coded") << ", "
+                     << 100.0 * output.size() / input.size() << "%)" << endl;
+        }
+        return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef __RECOMPRESS_H
+#define __RECOMPRESS_H
+
+#include <string>
+
+#define ERROR_PACKFORMAT        0xC0    // not a packed JPEG or the packed data is damaged
+
+/*!
+ * Lossless recompression of baseline JPEGs for storage (in the spirit of packJPG and
+ * Lepton). The huffman coded scan is replaced by an adaptive binary range coder over
+ * the quantized coefficients, modelled with the neighbouring blocks above and to the
+ * left (count of nonzero coefficients, magnitudes at the same frequency, predicted DC).
+ * The segments in front of the scan and everything after it are kept unchanged, so
+ * unpackJpeg rebuilds the original file byte for byte: the scan is huffman coded again
+ * with the tables, restart interval and padding bits of the original.
+ *
+ * The scan is cut into segments of MCU rows with their own statistics, which are coded
+ * and decoded by up to threads threads (0 = one per core); each segment carries the
+ * huffman bit position and DC predictions at its start, so the huffman coded parts
+ * can be written in parallel and simply be concatenated.
+ *
+ * packJpeg checks the round trip, files which can't be reproduced exactly (progressive
+ * or multi scan files, encoders with unusual symbol choices, damaged data) are stored
+ * as they are, and so are files the coded form wouldn't make smaller (tiny images),
+ * the output is never more than 5 bytes larger than the input. Both functions append
+ * to out.
+ */
+int packJpeg(const std::string& jpeg, std::string& out, int threads = 0);
+int unpackJpeg(const std::string& packed, std::string& out, int threads = 0);
+
+/*!
+ * ./jpgd pack input.jpg output.jpz and ./jpgd unpack input.jpz output.jpg, argv[0] is
+ * "pack" or "unpack".
+ */
+int packCommand(int argc, char** argv);
+
+#endif // __RECOMPRESS_H
@@ -0,0 +1,97 @@
+#ifndef __RINGBUFFER_H
+#define __RINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/*!
+ * Bounded lock-free ring buffer for multiple producers and consumers.
+ *
+ * Every cell carries a sequence number which tells if the cell is ready to be
+ * written (sequence == position) or to be read (sequence == position + 1), so
+ * producers and consumers only synchronize on the cell they are using.
+ *
+ * Bounded MPMC queue, Dmitry Vyukov,
+ * http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ */
+template<typename T>
+class RingBuffer
+{
+private:
+        struct Cell
+        {
+                std::atomic<size_t> sequence;
+                T data;
+        };
+
+        std::unique_ptr<Cell[]> cells;
+        size_t mask;
+        // keep both positions on their own cache line, one is written by the
+        // producers and the other one by the consumers
+        alignas(64) std::atomic<size_t> enqueuePosition;
+        alignas(64) std::atomic<size_t> dequeuePosition;
+
+public:
+        // the capacity is rounded up to the next power of two
+        explicit RingBuffer(size_t capacity)
+        {
+                size_t size = 1;
+                while (size < capacity)
+                        size <<= 1;
+                cells.reset(new Cell[size]);
+                mask = size - 1;
+                for (size_t i = 0; i < size; i++)
+                        cells[i].sequence.store(i, std::memory_order_relaxed);
+                enqueuePosition.store(0, std::memory_order_relaxed);
+                dequeuePosition.store(0, std::memory_order_relaxed);
+        }
+
+        // returns false if the buffer is full
+        bool push(const T& data)
+        {
+                size_t position = enqueuePosition.load(std::memory_order_relaxed);
+                Cell* cell;
+                for (;;) {
+                        cell = &cells[position & mask];
+                        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                        long diff = (long)sequence - (long)position;
+                        if (diff == 0) {
+                                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                                        break;
+                        } else if (diff < 0) {
+                                return false;
+                        } else {
+                                position = enqueuePosition.load(std::memory_order_relaxed);
+                        }
+                }
+                cell->data = data;
+                cell->sequence.store(position + 1, std::memory_order_release);
+                return true;
+        }
+
+        // returns false if the buffer is empty
+        bool pop(T& data)
+        {
+                size_t position = dequeuePosition.load(std::memory_order_relaxed);
+                Cell* cell;
+                for (;;) {
+                        cell = &cells[position & mask];
+                        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                        long diff = (long)sequence - (long)(position + 1);
+                        if (diff == 0) {
+                                if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                                        break;
+                        } else if (diff < 0) {
+                                return false;
+                        } else {
+                                position = dequeuePosition.load(std::memory_order_relaxed);
+                        }
+                }
+                data = cell->data;
+                cell->sequence.store(position + mask + 1, std::memory_order_release);
+                return true;
+        }
+};
+
+#endif // __RINGBUFFER_H
@@ -0,0 +1,52 @@
+#ifndef __ROWSINK_H
+#define __ROWSINK_H
+
+enum PixelFormat
+{
+        PIXEL_RGB,              // 3 bytes per pixel: red, green, blue
+        PIXEL_XRGB32            // 32 bit native endian 0x00RRGGBB (cairo FORMAT_RGB24)
+};
+
+inline int pixelSize(PixelFormat format) { return format == PIXEL_XRGB32 ? 4 : 3; }
+
+/*!
+ * Receives the decoded image in bands of rows.
+ *
+ * The decoder calls band() once for every MCU row (8 or 16 pixel rows, less for
+ * the last one) from top to bottom. The calls are never made concurrently, even
+ * if the decoder uses multiple threads. The rgb data is only valid during the
+ * call, so a sink which streams the image somewhere else (file, resizer, network)
+ * keeps the memory usage of the decoder independent of the image height.
+ *
+ * A sink which owns the final pixel memory (e.g. an image surface) can return it
+ * from target(), the decoder then converts the pixels straight into it.
+ */
+class RowSink
+{
+public:
+        virtual ~RowSink() {}
+
+        // called once the frame header has been parsed, a non zero return value aborts decoding
+        virtual int begin(int width, int height) { return 0; }
+
+        // pixel layout of the rows passed to band() and written into target()
+        virtual PixelFormat format() { return PIXEL_RGB; }
+
+        // memory for the rows starting at y (stride in bytes), nullptr lets the decoder
+        // use its own band buffer. May be called from several decoder threads at once.
+        virtual unsigned char* target(int y, int& stride) { return nullptr; }
+
+        // memory for the whole image (all rows, stride in bytes) or nullptr. Only asked for
+        // by JpegDecoder::setAutoOrient for rotated images, whose MCU rows end up in columns
+        // of the output, the decoder then stores every pixel at its final position.
+        virtual unsigned char* image(int& stride) { return nullptr; }
+
+        // rows [y, y + rows) in the pixel format of the sink, stride in bytes,
+        // a non zero return value aborts decoding and is returned by JpegDecoder::decode
+        virtual int band(int y, int rows, const unsigned char* rgb, int stride) = 0;
+
+        // called after the last band
+        virtual void end() {}
+};
+
+#endif // __ROWSINK_H
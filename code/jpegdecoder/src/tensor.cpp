@@ -0,0 +1,220 @@
+#include "tensor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "jpegdecoder.h"
+using namespace std;
+
+uint16_t floatToHalf(float value)
+{
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint32_t sign = (bits >> 16) & 0x8000;
+        int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+        uint32_t mantissa = bits & 0x7FFFFF;
+
+        if (exponent >= 31) {
+                // overflow, infinity and NaN
+                bool nan = ((bits >> 23) & 0xFF) == 0xFF && mantissa != 0;
+                return sign | 0x7C00 | (nan ? 0x200 : 0);
+        }
+        if (exponent <= 0) {
+                // subnormal or zero
+                if (exponent < -10)
+                        return sign;
+                mantissa |= 0x800000;
+                int shift = 14 - exponent;
+                uint32_t half = mantissa >> shift;
+                uint32_t rest = mantissa & ((1u << shift) - 1);
+                uint32_t middle = 1u << (shift - 1);
+                if (rest > middle || (rest == middle && (half & 1)))
+                        half++;
+                return sign | half;
+        }
+        uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+        uint32_t rest = mantissa & 0x1FFF;
+        // a carry into the exponent is the correct result (up to infinity)
+        if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+                half++;
+        return sign | half;
+}
+
+TensorSink::TensorSink(void* data, TensorLayout layout, TensorType type, int batch, int height, int width)
+{
+        this->data = data;
+        this->layout = layout;
+        this->type = type;
+        this->batch = batch;
+        this->height = height;
+        this->width = width;
+        index = 0;
+        resize = false;
+        sourceWidth = 0;
+        sourceHeight = 0;
+        nextRow = 0;
+        for (int c = 0; c < 3; c++) {
+                mean[c] = 0;
+                deviation[c] = 1;
+        }
+        prepareTables();
+}
+
+void TensorSink::setNormalization(const float* mean, const float* deviation)
+{
+        for (int c = 0; c < 3; c++) {
+                this->mean[c] = mean[c];
+                this->deviation[c] = deviation[c];
+        }
+        prepareTables();
+}
+
+void TensorSink::prepareTables()
+{
+        for (int c = 0; c < 3; c++) {
+                for (int v = 0; v < 256; v++) {
+                        floats[c][v] = (v / 255.0f - mean[c]) / deviation[c];
+                        halfs[c][v] = floatToHalf(floats[c][v]);
+                }
+        }
+}
+
+int TensorSink::begin(int width, int height)
+{
+        if (index < 0 || index >= batch)
+                return ERROR_TENSORINDEX;
+        if (!resize && (width != this->width || height != this->height))
+                return ERROR_TENSORSIZE;
+
+        sourceWidth = width;
+        sourceHeight = height;
+        nextRow = 0;
+        if (resize) {
+                previous.resize(width * 3);
+                line.resize(this->width * 3);
+                x0.resize(this->width);
+                x1.resize(this->width);
+                xWeight.resize(this->width);
+                float ratio = (float)width / this->width;
+                for (int x = 0; x < this->width; x++) {
+                        float position = max((x + 0.5f) * ratio - 0.5f, 0.0f);
+                        int left = min((int)position, width - 1);
+                        x0[x] = left * 3;
+                        x1[x] = min(left + 1, width - 1) * 3;
+                        xWeight[x] = (int)((position - left) * 256 + 0.5f);
+                }
+        }
+        return 0;
+}
+
+// converts one row of RGB bytes into the tensor
+void TensorSink::storeRow(int y, const unsigned char* rgb)
+{
+        size_t plane = (size_t)height * width;
+        size_t element = (size_t)index * 3 * plane;
+        if (layout == TENSOR_NCHW)
+                element += (size_t)y * width;
+        else
+                element += (size_t)y * width * 3;
+
+        if (type == TENSOR_UINT8) {
+                unsigned char* target = (unsigned char*)data + element;
+                if (layout == TENSOR_NHWC) {
+                        memcpy(target, rgb, width * 3);
+                        return;
+                }
+                for (int x = 0; x < width; x++, rgb += 3) {
+                        target[x] = rgb[0];
+                        target[plane + x] = rgb[1];
+                        target[2 * plane + x] = rgb[2];
+                }
+        } else if (type == TENSOR_FLOAT16) {
+                uint16_t* target = (uint16_t*)data + element;
+                if (layout == TENSOR_NHWC) {
+                        for (int x = 0; x < width * 3; x += 3) {
+                                target[x] = halfs[0][rgb[x]];
+                                target[x + 1] = halfs[1][rgb[x + 1]];
+                                target[x + 2] = halfs[2][rgb[x + 2]];
+                        }
+                        return;
+                }
+                for (int x = 0; x < width; x++, rgb += 3) {
+                        target[x] = halfs[0][rgb[0]];
+                        target[plane + x] = halfs[1][rgb[1]];
+                        target[2 * plane + x] = halfs[2][rgb[2]];
+                }
+        } else {
+                float* target = (float*)data + element;
+                if (layout == TENSOR_NHWC) {
+                        for (int x = 0; x < width * 3; x += 3) {
+                                target[x] = floats[0][rgb[x]];
+                                target[x + 1] = floats[1][rgb[x + 1]];
+                                target[x + 2] = floats[2][rgb[x + 2]];
+                        }
+                        return;
+                }
+                for (int x = 0; x < width; x++, rgb += 3) {
+                        target[x] = floats[0][rgb[0]];
+                        target[plane + x] = floats[1][rgb[1]];
+                        target[2 * plane + x] = floats[2][rgb[2]];
+                }
+        }
+}
+
+int TensorSink::band(int y, int rows, const unsigned char* rgb, int stride)
+{
+        if (!resize) {
+                for (int row = 0; row < rows; row++)
+                        storeRow(y + row, rgb + row * stride);
+                return 0;
+        }
+
+        // every tensor row whose two source rows are available
+        float ratio = (float)sourceHeight / height;
+        for (; nextRow < height; nextRow++) {
+                float position = max((nextRow + 0.5f) * ratio - 0.5f, 0.0f);
+                int top = min((int)position, sourceHeight - 1);
+                int bottom = min(top + 1, sourceHeight - 1);
+                if (bottom >= y + rows)
+                        break;
+                int weight = (int)((position - top) * 256 + 0.5f);
+                const unsigned char* upper = top < y ? previous.data() : rgb + (top - y) * stride;
+                const unsigned char* lower = rgb + (bottom - y) * stride;
+
+                for (int x = 0; x < width; x++) {
+                        int left = x0[x];
+                        int right = x1[x];
+                        int wx = xWeight[x];
+                        for (int c = 0; c < 3; c++) {
+                                int a = upper[left + c] * (256 - wx) + upper[right + c] * wx;
+                                int b = lower[left + c] * (256 - wx) + lower[right + c] * wx;
+                                line[x * 3 + c] = (a * (256 - weight) + b * weight + (1 << 15)) >> 16;
+                        }
+                }
+                storeRow(nextRow, line.data());
+        }
+        memcpy(previous.data(), rgb + (rows - 1) * stride, sourceWidth * 3);
+        return 0;
+}
+
+int decodeTensor(JpegDecoder& decoder, TensorSink& tensor, int index)
+{
+        int errcode = decoder.probe();
+        if (errcode != 0)
+                return errcode;
+
+        int scale = 1;
+        if (tensor.getResize()) {
+                while (scale < 8 && decoder.getWidth() / (scale * 2) >= tensor.getWidth()
+                       && decoder.getHeight() / (scale * 2) >= tensor.getHeight())
+                        scale *= 2;
+        }
+
+        tensor.setIndex(index);
+        decoder.setScale(scale);
+        decoder.setSink(&tensor);
+        errcode = decoder.decode();
+        decoder.setSink(nullptr);
+        decoder.setScale(1);
+        return errcode;
+}
@@ -0,0 +1,97 @@
+#ifndef __TENSOR_H
+#define __TENSOR_H
+
+#include <cstdint>
+#include <vector>
+#include "rowsink.h"
+
+#define ERROR_TENSORSIZE        0x90    // the image doesn't match the tensor and resizing is off
+#define ERROR_TENSORINDEX       0x91    // the batch slot is outside of the tensor
+
+class JpegDecoder;
+
+enum TensorLayout
+{
+        TENSOR_NCHW,                    // [batch][channel][y][x], planar (PyTorch)
+        TENSOR_NHWC                     // [batch][y][x][channel], interleaved (TensorFlow)
+};
+
+enum TensorType
+{
+        TENSOR_UINT8,                   // the pixel values as they are, no normalization
+        TENSOR_FLOAT16,                 // IEEE half precision, (value / 255 - mean) / std
+        TENSOR_FLOAT32                  // (value / 255 - mean) / std
+};
+
+/*!
+ * Writes the decoded bands straight into one slot of a caller owned batch tensor
+ * (3 channels, RGB). The normalization is folded into a lookup table per channel,
+ * so every pixel is converted exactly once while its band is still in the cache.
+ *
+ * With resizing the image is scaled with a bilinear filter (pixel centers, like
+ * align_corners=false) to the size of the tensor while the bands stream through.
+ * Only the last row of the previous band is kept. decodeTensor additionally picks
+ * the scaled IDCT of the decoder, so the filter never has to shrink by 2 or more.
+ */
+class TensorSink : public RowSink
+{
+private:
+        void* data;
+        TensorLayout layout;
+        TensorType type;
+        int batch;
+        int height;
+        int width;
+        int index;
+        bool resize;
+
+        float mean[3];
+        float deviation[3];
+        // byte value -> output element per channel
+        float floats[3][256];
+        uint16_t halfs[3][256];
+
+        // source image and the resampling state
+        int sourceWidth;
+        int sourceHeight;
+        int nextRow;                            // next row of the tensor
+        std::vector<unsigned char> previous;    // last source row of the previous band
+        std::vector<int> x0;                    // left source pixel (byte offset) of every tensor column
+        std::vector<int> x1;
+        std::vector<int> xWeight;               // weight of x1, 8 bit fixed point
+        std::vector<unsigned char> line;        // one resized row, RGB
+
+        void prepareTables();
+        void storeRow(int y, const unsigned char* rgb);
+
+public:
+        // data holds batch * 3 * height * width elements of the type
+        TensorSink(void* data, TensorLayout layout, TensorType type, int batch, int height, int width);
+
+        // per channel mean and standard deviation for values in [0, 1],
+        // default 0 and 1 (the ImageNet values are { 0.485, 0.456, 0.406 } and { 0.229, 0.224, 0.225 })
+        void setNormalization(const float* mean, const float* deviation);
+        // batch slot of the next image
+        void setIndex(int index) { this->index = index; }
+        // false (default): the image has to have the size of the tensor (ERROR_TENSORSIZE otherwise)
+        void setResize(bool enabled) { resize = enabled; }
+
+        bool getResize() { return resize; }
+        int getWidth() { return width; }
+        int getHeight() { return height; }
+
+        virtual int begin(int width, int height);
+        virtual int band(int y, int rows, const unsigned char* rgb, int stride);
+};
+
+// IEEE 754 binary16 bits of a float (round to nearest even)
+uint16_t floatToHalf(float value);
+
+/*!
+ * Decodes the data of the decoder into the given batch slot of the tensor. When the sink
+ * resizes, the smallest scaled IDCT which still covers the tensor size is used. The
+ * decoder is set back to the picture and full size afterwards. Returns the decoder error.
+ */
+int decodeTensor(JpegDecoder& decoder, TensorSink& tensor, int index);
+
+#endif // __TENSOR_H
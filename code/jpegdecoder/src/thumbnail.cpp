@@ -0,0 +1,216 @@
+#include "thumbnail.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "exif.h"
+#include "jpegdecoder.h"
+using namespace std;
+
+static unsigned int readUShort(const string& raw, size_t position)
+{
+        return ((unsigned char)raw[position] << 8) | (unsigned char)raw[position + 1];
+}
+
+// EXIF IFD1: JPEGInterchangeFormat and JPEGInterchangeFormatLength
+static bool exifThumbnail(const string& raw, size_t segment, size_t length, Thumbnail& thumbnail)
+{
+        ExifReader exif;
+        if (!exif.open(&raw[segment], length))
+                return false;
+
+        unsigned int offset, size;
+        if (!exif.findTag(EXIF_IFD1, EXIF_TAG_JPEGOFFSET, offset) || !exif.findTag(EXIF_IFD1, EXIF_TAG_JPEGLENGTH, size))
+                return false;
+        const char* data = exif.data(offset, size);
+        if (data == nullptr || size < 4)
+                return false;
+
+        thumbnail.type = THUMBNAIL_JPEG;
+        thumbnail.offset = data - raw.data();
+        thumbnail.size = size;
+        thumbnail.width = 0;
+        thumbnail.height = 0;
+        return true;
+}
+
+// JFIF: thumbnail pixels after the density, JFXX: thumbnail extension segment
+static bool jfifThumbnail(const string& raw, size_t segment, size_t length, Thumbnail& thumbnail)
+{
+        const char* data = &raw[segment];
+        if (length >= 14 && memcmp(data, "JFIF\0", 5) == 0) {
+                int width = (unsigned char)data[12];
+                int height = (unsigned char)data[13];
+                if (width == 0 || height == 0 || 14 + (size_t)width * height * 3 > length)
+                        return false;
+                thumbnail.type = THUMBNAIL_RGB;
+                thumbnail.offset = segment + 14;
+                thumbnail.size = width * height * 3;
+                thumbnail.width = width;
+                thumbnail.height = height;
+                return true;
+        }
+        if (length < 6 || memcmp(data, "JFXX\0", 5) != 0)
+                return false;
+
+        unsigned char code = data[5];
+        if (code == 0x10) {
+                thumbnail.type = THUMBNAIL_JPEG;
+                thumbnail.offset = segment + 6;
+                thumbnail.size = length - 6;
+                thumbnail.width = 0;
+                thumbnail.height = 0;
+                return thumbnail.size >= 4;
+        }
+        if ((code != 0x11 && code != 0x13) || length < 8)
+                return false;
+        int width = (unsigned char)data[6];
+        int height = (unsigned char)data[7];
+        size_t size = (size_t)width * height * (code == 0x13 ? 3 : 1) + (code == 0x11 ? 768 : 0);
+        if (width == 0 || height == 0 || 8 + size > length)
+                return false;
+        thumbnail.type = code == 0x13 ? THUMBNAIL_RGB : THUMBNAIL_PALETTE;
+        thumbnail.offset = segment + 8;
+        thumbnail.size = size;
+        thumbnail.width = width;
+        thumbnail.height = height;
+        return true;
+}
+
+int findThumbnail(const string& raw, Thumbnail& thumbnail)
+{
+        thumbnail.type = THUMBNAIL_NONE;
+        if (raw.size() < 4 || (unsigned char)raw[0] != 0xFF || (unsigned char)raw[1] != 0xD8)
+                return ERROR_NOTHUMBNAIL;
+
+        Thumbnail jfif;
+        jfif.type = THUMBNAIL_NONE;
+        size_t position = 2;
+        while (position + 4 <= raw.size()) {
+                if ((unsigned char)raw[position] != 0xFF) {
+                        position++;
+                        continue;
+                }
+                unsigned char marker = raw[position + 1];
+                if (marker == 0xFF) {   // fill byte
+                        position++;
+                        continue;
+                }
+                // the thumbnails are always in front of the image data
+                if (marker == 0xDA || marker == 0xD9)
+                        break;
+                size_t length = readUShort(raw, position + 2);
+                size_t segment = position + 4;
+                if (length < 2 || segment + length - 2 > raw.size())
+                        break;
+
+                if (marker == 0xE1 && exifThumbnail(raw, segment, length - 2, thumbnail))
+                        return 0;
+                if (marker == 0xE0 && jfif.type == THUMBNAIL_NONE)
+                        jfifThumbnail(raw, segment, length - 2, jfif);
+                position = segment + length - 2;
+        }
+
+        if (jfif.type == THUMBNAIL_NONE)
+                return ERROR_NOTHUMBNAIL;
+        thumbnail = jfif;
+        return 0;
+}
+
+int storeThumbnail(const string& raw, const Thumbnail& thumbnail, RowSink* sink)
+{
+        const unsigned char* data = (const unsigned char*)&raw[thumbnail.offset];
+        const unsigned char* palette = thumbnail.type == THUMBNAIL_PALETTE ? data : nullptr;
+        if (palette != nullptr)
+                data += 768;
+
+        int errcode = sink->begin(thumbnail.width, thumbnail.height);
+        if (errcode != 0)
+                return errcode;
+
+        // the whole thumbnail is a single band, written into the memory of the sink if it has some
+        PixelFormat format = sink->format();
+        int stride;
+        unsigned char* band = sink->target(0, stride);
+        vector<unsigned char> buffer;
+        if (band == nullptr) {
+                stride = thumbnail.width * pixelSize(format);
+                buffer.resize(stride * thumbnail.height);
+                band = &buffer[0];
+        }
+
+        for (int y = 0; y < thumbnail.height; y++) {
+                unsigned char* row = band + y * stride;
+                for (int x = 0; x < thumbnail.width; x++) {
+                        const unsigned char* rgb = palette != nullptr ? palette + *data++ * 3 : (data += 3) - 3;
+                        if (format == PIXEL_XRGB32) {
+                                unsigned int pixel = (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+                                memcpy(row + x * 4, &pixel, 4);
+                        } else {
+                                memcpy(row + x * 3, rgb, 3);
+                        }
+                }
+        }
+
+        errcode = sink->band(0, thumbnail.height, band, stride);
+        sink->end();
+        return errcode;
+}
+
+static bool writeFile(const string& path, const char* data, size_t size)
+{
+        ofstream file(path.c_str(), ios::binary);
+        file.write(data, size);
+        return (bool)file;
+}
+
+int thumbnailCommand(int argc, char** argv)
+{
+        if (argc != 3) {
+                cout << "Usage: ./jpgd thumbnail input.jpg output" << endl
+                     << "        JPEG thumbnails are written as they are, uncompressed ones as ppm" << endl;
+                return -1;
+        }
+
+        JpegDecoder decoder;
+        if (!decoder.read(argv[1])) {
+                cout << "Could not read " << argv[1] << endl;
+                return 1;
+        }
+
+        string jpeg;
+        int errcode = decoder.getThumbnail(jpeg);
+        if (errcode == 0) {
+                if (!writeFile(argv[2], jpeg.data(), jpeg.size())) {
+                        cout << "Could not write " << argv[2] << endl;
+                        return 1;
+                }
+                return 0;
+        }
+        if (errcode != ERROR_THUMBNAILFORMAT) {
+                cout << argv[1] << ": error code " << errcode << endl;
+                return 1;
+        }
+
+        errcode = decoder.decodeThumbnail(nullptr);
+        if (errcode != 0) {
+                cout << argv[1] << ": error code " << errcode << endl;
+                return 1;
+        }
+        Picture& picture = decoder.getPicture();
+        string ppm = "P6\n" + to_string(picture.getWidth()) + " " + to_string(picture.getHeight()) + "\n255\n";
+        for (int y = 0; y < picture.getHeight(); y++) {
+                for (int x = 0; x < picture.getWidth(); x++) {
+                        Pixel& pixel = picture.getPixel(x, y);
+                        ppm += (char)pixel.red;
+                        ppm += (char)pixel.green;
+                        ppm += (char)pixel.blue;
+                }
+        }
+        if (!writeFile(argv[2], ppm.data(), ppm.size())) {
+                cout << "Could not write " << argv[2] << endl;
+                return 1;
+        }
+        return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef __THUMBNAIL_H
+#define __THUMBNAIL_H
+
+#include <cstddef>
+#include <string>
+#include "rowsink.h"
+
+#define ERROR_NOTHUMBNAIL       0x80    // the file doesn't contain a thumbnail
+#define ERROR_THUMBNAILFORMAT   0x81    // the thumbnail isn't stored as JPEG (getThumbnail only)
+
+enum ThumbnailType
+{
+        THUMBNAIL_NONE,
+        THUMBNAIL_JPEG,                 // EXIF IFD1 or JFXX extension code 0x10
+        THUMBNAIL_PALETTE,              // JFXX 0x11: 768 byte palette followed by one index per pixel
+        THUMBNAIL_RGB                   // JFIF APP0 or JFXX 0x13: 3 bytes per pixel
+};
+
+// position of an embedded preview image inside the file
+struct Thumbnail
+{
+        ThumbnailType type;
+        size_t offset;                  // of the JPEG data or the pixels (palette) in the file
+        size_t size;
+        int width;                      // only for the uncompressed types
+        int height;
+};
+
+/*!
+ * Walks the segments in front of the first scan and locates the thumbnail. A JPEG
+ * thumbnail of the EXIF IFD1 is preferred over the ones of the JFIF APP0 segments.
+ * Nothing is copied and the scan isn't touched. Returns 0 or ERROR_NOTHUMBNAIL.
+ */
+int findThumbnail(const std::string& raw, Thumbnail& thumbnail);
+
+// hands uncompressed thumbnail pixels to the sink as a single band
+int storeThumbnail(const std::string& raw, const Thumbnail& thumbnail, RowSink* sink);
+
+/*!
+ * ./jpgd thumbnail input.jpg output: writes the embedded thumbnail (JPEG data as is,
+ * uncompressed ones as ppm), argv[0] is "thumbnail".
+ */
+int thumbnailCommand(int argc, char** argv);
+
+#endif // __THUMBNAIL_H
@@ -0,0 +1,252 @@
+#include "transform.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "jpegdecoder.h"
+#include "jpegwriter.h"
+using namespace std;
+
+// every transformation is a mirroring of the source followed by an optional transposition
+struct TransformSteps
+{
+        bool mirrorX;
+        bool mirrorY;
+        bool transpose;
+};
+
+static TransformSteps steps(TransformType type)
+{
+        switch (type) {
+        case TRANSFORM_FLIP_H:          return { true, false, false };
+        case TRANSFORM_FLIP_V:          return { false, true, false };
+        case TRANSFORM_TRANSPOSE:       return { false, false, true };
+        case TRANSFORM_TRANSVERSE:      return { true, true, true };
+        case TRANSFORM_ROT_90:          return { false, true, true };
+        case TRANSFORM_ROT_180:         return { true, true, false };
+        case TRANSFORM_ROT_270:         return { true, false, true };
+        default:                        return { false, false, false };
+        }
+}
+
+static void maxSamplingFactors(const CoefficientImage& image, int& hsfMax, int& vsfMax)
+{
+        hsfMax = 1;
+        vsfMax = 1;
+        for (int c = 0; c < 3; c++) {
+                hsfMax = max(hsfMax, (int)image.components[c].hsf);
+                vsfMax = max(vsfMax, (int)image.components[c].vsf);
+        }
+}
+
+int transformCoefficients(const CoefficientImage& source, TransformType type, CoefficientImage& target)
+{
+        TransformSteps t = steps(type);
+        int hsfMax, vsfMax;
+        maxSamplingFactors(source, hsfMax, vsfMax);
+
+        // drop the partial MCUs on the mirrored axes
+        int width = source.width;
+        int height = source.height;
+        if (t.mirrorX)
+                width -= width % (8 * hsfMax);
+        if (t.mirrorY)
+                height -= height % (8 * vsfMax);
+        if (width == 0 || height == 0)
+                return ERROR_TRANSFORM_SIZE;
+
+        target.width = t.transpose ? height : width;
+        target.height = t.transpose ? width : height;
+        for (int q = 0; q < 4; q++) {
+                target.hasQTable[q] = source.hasQTable[q];
+                for (int i = 0; i < 64; i++)
+                        target.qTables[q][i] = t.transpose ? source.qTables[q][(i % 8) * 8 + i / 8] : source.qTables[q][i];
+        }
+
+        for (int c = 0; c < 3; c++) {
+                const ComponentCoefficients& from = source.components[c];
+                ComponentCoefficients& to = target.components[c];
+
+                // blocks of the source which are used
+                int usedWide = t.mirrorX ? width / (8 * hsfMax) * from.hsf : from.blocksWide;
+                int usedHigh = t.mirrorY ? height / (8 * vsfMax) * from.vsf : from.blocksHigh;
+
+                to.hsf = t.transpose ? from.vsf : from.hsf;
+                to.vsf = t.transpose ? from.hsf : from.vsf;
+                to.qt = from.qt;
+                to.blocksWide = t.transpose ? usedHigh : usedWide;
+                to.blocksHigh = t.transpose ? usedWide : usedHigh;
+                to.blocks.resize(to.blocksWide * to.blocksHigh * 64);
+
+                for (int by = 0; by < to.blocksHigh; by++) {
+                        for (int bx = 0; bx < to.blocksWide; bx++) {
+                                int sx = t.transpose ? by : bx;
+                                int sy = t.transpose ? bx : by;
+                                if (t.mirrorX)
+                                        sx = usedWide - 1 - sx;
+                                if (t.mirrorY)
+                                        sy = usedHigh - 1 - sy;
+                                const short* in = from.block(sx, sy);
+                                short* out = to.block(bx, by);
+
+                                for (int v = 0; v < 8; v++) {
+                                        for (int u = 0; u < 8; u++) {
+                                                int su = t.transpose ? v : u;
+                                                int sv = t.transpose ? u : v;
+                                                // mirroring inverts the odd basis functions
+                                                bool negate = ((t.mirrorX && (su & 1)) != (t.mirrorY && (sv & 1)));
+                                                short value = in[sv * 8 + su];
+                                                out[v * 8 + u] = negate ? -value : value;
+                                        }
+                                }
+                        }
+                }
+        }
+        return 0;
+}
+
+int cropCoefficients(const CoefficientImage& source, int x, int y, int width, int height, CoefficientImage& target)
+{
+        if (x < 0 || y < 0 || width <= 0 || height <= 0 || x >= source.width || y >= source.height)
+                return ERROR_TRANSFORM_CROP;
+
+        int hsfMax, vsfMax;
+        maxSamplingFactors(source, hsfMax, vsfMax);
+        int mcuWidth = 8 * hsfMax;
+        int mcuHeight = 8 * vsfMax;
+
+        int left = x / mcuWidth * mcuWidth;
+        int top = y / mcuHeight * mcuHeight;
+        target.width = min(width + x - left, source.width - left);
+        target.height = min(height + y - top, source.height - top);
+        for (int q = 0; q < 4; q++) {
+                target.hasQTable[q] = source.hasQTable[q];
+                copy(source.qTables[q], source.qTables[q] + 64, target.qTables[q]);
+        }
+
+        int mcusWide = (target.width + mcuWidth - 1) / mcuWidth;
+        int mcusHigh = (target.height + mcuHeight - 1) / mcuHeight;
+        for (int c = 0; c < 3; c++) {
+                const ComponentCoefficients& from = source.components[c];
+                ComponentCoefficients& to = target.components[c];
+                to.hsf = from.hsf;
+                to.vsf = from.vsf;
+                to.qt = from.qt;
+                to.blocksWide = mcusWide * from.hsf;
+                to.blocksHigh = mcusHigh * from.vsf;
+                to.blocks.resize(to.blocksWide * to.blocksHigh * 64);
+
+                int bx0 = left / mcuWidth * from.hsf;
+                int by0 = top / mcuHeight * from.vsf;
+                for (int by = 0; by < to.blocksHigh; by++) {
+                        const short* in = from.block(bx0, by0 + by);
+                        copy(in, in + to.blocksWide * 64, to.block(0, by));
+                }
+        }
+        return 0;
+}
+
+static bool parseType(const string& name, TransformType& type)
+{
+        static const char* names[] = { "none", "flip-h", "flip-v", "transpose", "transverse", "rot90", "rot180", "rot270" };
+        for (int i = 0; i < 8; i++) {
+                if (name == names[i]) {
+                        type = (TransformType)i;
+                        return true;
+                }
+        }
+        return false;
+}
+
+static void usage()
+{
+        cout << "Usage: ./jpgd transform [-r operation]... [-c WxH+X+Y] [-O] [-A] input.jpg output.jpg" << endl
+             << "        -r      flip-h, flip-v, transpose, transverse, rot90, rot180 or rot270," << endl
+             << "                applied in the given order" << endl
+             << "        -c      crop before the other operations, the corner is rounded down to the MCU grid" << endl
+             << "        -O      optimized huffman tables instead of the standard tables" << endl
+             << "        -A      arithmetic coding (SOF9), without operations this just recompresses the file" << endl;
+}
+
+int transformCommand(int argc, char** argv)
+{
+        vector<TransformType> operations;
+        bool crop = false;
+        int cropX = 0, cropY = 0, cropWidth = 0, cropHeight = 0;
+        bool optimize = false;
+        bool arithmetic = false;
+        vector<string> files;
+
+        for (int i = 1; i < argc; i++) {
+                string arg = argv[i];
+                if (arg == "-r" && i + 1 < argc) {
+                        TransformType type;
+                        if (!parseType(argv[++i], type)) {
+                                usage();
+                                return -1;
+                        }
+                        operations.push_back(type);
+                } else if (arg == "-c" && i + 1 < argc) {
+                        if (sscanf(argv[++i], "%dx%d+%d+%d", &cropWidth, &cropHeight, &cropX, &cropY) != 4) {
+                                usage();
+                                return -1;
+                        }
+                        crop = true;
+                } else if (arg == "-O") {
+                        optimize = true;
+                } else if (arg == "-A") {
+                        arithmetic = true;
+                } else if (arg[0] == '-') {
+                        usage();
+                        return -1;
+                } else {
+                        files.push_back(arg);
+                }
+        }
+        if (files.size() != 2) {
+                usage();
+                return -1;
+        }
+
+        JpegDecoder decoder;
+        if (!decoder.read(files[0])) {
+                cout << "Could not read " << files[0] << endl;
+                return 1;
+        }
+        CoefficientImage image;
+        int errcode = decoder.readCoefficients(image);
+        if (errcode == 0 && crop) {
+                CoefficientImage cropped;
+                errcode = cropCoefficients(image, cropX, cropY, cropWidth, cropHeight, cropped);
+                image = std::move(cropped);
+        }
+        for (size_t i = 0; errcode == 0 && i < operations.size(); i++) {
+                CoefficientImage transformed;
+                errcode = transformCoefficients(image, operations[i], transformed);
+                image = std::move(transformed);
+        }
+
+        string output;
+        if (errcode == 0) {
+                JpegWriter writer;
+                writer.setOptimizeHuffman(optimize);
+                writer.setArithmetic(arithmetic);
+                errcode = writer.write(image, output);
+        }
+        if (errcode != 0) {
+                cout << files[0] << ": error code " << errcode << endl;
+                return 1;
+        }
+
+        ofstream file(files[1].c_str(), ios::binary);
+        file.write(output.data(), output.size());
+        if (!file) {
+                cout << "Could not write " << files[1] << endl;
+                return 1;
+        }
+        return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef __TRANSFORM_H
+#define __TRANSFORM_H
+
+#include "coefficients.h"
+
+#define ERROR_TRANSFORM_CROP    0x60    // crop region outside of the image or empty
+#define ERROR_TRANSFORM_SIZE    0x61    // image smaller than one MCU on a mirrored axis
+
+enum TransformType
+{
+        TRANSFORM_NONE,
+        TRANSFORM_FLIP_H,               // mirror left <-> right
+        TRANSFORM_FLIP_V,               // mirror top <-> bottom
+        TRANSFORM_TRANSPOSE,            // mirror at the top left to bottom right diagonal
+        TRANSFORM_TRANSVERSE,           // mirror at the top right to bottom left diagonal
+        TRANSFORM_ROT_90,               // clockwise
+        TRANSFORM_ROT_180,
+        TRANSFORM_ROT_270
+};
+
+/*!
+ * Lossless transformations in the DCT domain: the blocks are moved, their
+ * coefficients transposed and the signs of the odd frequencies on a mirrored
+ * axis inverted. Nothing is dequantized, so no generation loss occurs.
+ *
+ * Partial MCUs at the right or bottom edge can't be moved to the other side,
+ * they are dropped on the mirrored axes (like jpegtran -trim).
+ */
+int transformCoefficients(const CoefficientImage& source, TransformType type, CoefficientImage& target);
+
+// the region is extended to the top left to start on an MCU boundary
+int cropCoefficients(const CoefficientImage& source, int x, int y, int width, int height, CoefficientImage& target);
+
+/*!
+ * ./jpgd transform [options] input.jpg output.jpg, argv[0] is "transform".
+ */
+int transformCommand(int argc, char** argv);
+
+#endif // __TRANSFORM_H
@@ -0,0 +1,44 @@
+#ifndef __UPSAMPLE_H
+#define __UPSAMPLE_H
+
+/*!
+ * Chroma upsampling for one MCU of a single color component.
+ *
+ * The buffer holds up to four 8x8 blocks at the offsets 128 * v + 64 * h
+ * (v, h = 0..1), which is the layout used while storing the pixels of a MCU.
+ * A component with a sampling factor of 1 inside a MCU with a maximum factor
+ * of 2 is replicated into the missing blocks (pixel doubling). horizontal expands
+ * the vsf block rows of the component, vertical then the hsf_max block columns.
+ */
+namespace Upsample
+{
+        inline void horizontal(int hsf_max, int hsf, int vsf, int* values)
+        {
+                if (hsf_max == hsf)
+                        return;
+                for (int v = 0; v < vsf; ++v) {
+                        int* block = values + 128 * v;
+                        // right block first, the left one is expanded in place
+                        for (int k = 63; k >= 0; --k)
+                                block[64 + k] = block[(k / 8) * 8 + 4 + (k % 8) / 2];
+                        for (int k = 63; k >= 0; --k)
+                                block[k] = block[(k / 8) * 8 + (k % 8) / 2];
+                }
+        }
+
+        inline void vertical(int hsf_max, int vsf_max, int vsf, int* values)
+        {
+                if (vsf_max == vsf)
+                        return;
+                for (int h = 0; h < hsf_max; ++h) {
+                        int* block = values + 64 * h;
+                        // lower block first, the upper one is expanded in place
+                        for (int k = 63; k >= 0; --k)
+                                block[128 + k] = block[(4 + k / 16) * 8 + k % 8];
+                        for (int k = 63; k >= 0; --k)
+                                block[k] = block[(k / 16) * 8 + k % 8];
+                }
+        }
+}
+
+#endif // __UPSAMPLE_H
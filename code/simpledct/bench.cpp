@@ -0,0 +1,97 @@
+/*
+ * Compares the DCTPlan transforms with the direct O(n^2) functions of
+ * reference.cpp: time per transform and largest difference of the results for
+ * sizes 8..4096, then the batched transform with 1..threads threads.
+ *
+ * Usage: ./dctbench [threads]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "reference.h"
+#include "simpledct.h"
+using namespace std;
+
+static double now()
+{
+	return chrono::duration<double, micro>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// microseconds per call, repeated for at least 50 ms
+template<typename F>
+static double measure(F function)
+{
+	function();
+	long calls = 0;
+	double start = now();
+	double elapsed;
+	do {
+		function();
+		calls++;
+		elapsed = now() - start;
+	} while (elapsed < 50000.0);
+	return elapsed / calls;
+}
+
+int main(int argc, char** argv)
+{
+	int maxThreads = argc > 1 ? max(1, atoi(argv[1])) : max(1, (int)thread::hardware_concurrency());
+	volatile double sink = 0;
+
+	printf("%6s %14s %14s %9s %12s %12s\n", "n", "direct us", "plan us", "speedup", "error II", "error III");
+	int sizes[] = { 8, 16, 32, 64, 128, 256, 512, 1000, 1024, 2048, 4096 };
+	for (int n : sizes) {
+		vector<double> input(n), output(n), roundtrip(n);
+		for (int i = 0; i < n; i++)
+			input[i] = (rand() % 2001 - 1000) / 10.0;
+		DCTPlan plan(n);
+
+		double direct = measure([&]() {
+			double* result = dct2(&input[0], n, 1.0);
+			sink = result[n - 1];
+			delete[] result;
+		});
+		double planned = measure([&]() {
+			plan.dct2Into(&input[0], &output[0]);
+			sink = output[n - 1];
+		});
+
+		// accuracy of both transforms against the direct sums
+		double* expected = dct2(&input[0], n, 1.0);
+		plan.dct2Into(&input[0], &output[0]);
+		double errorII = 0, errorIII = 0;
+		for (int i = 0; i < n; i++)
+			errorII = max(errorII, fabs(output[i] - expected[i]));
+		double* inverse = dct3(expected, n, 2.0 / n);
+		plan.dct3Into(&output[0], &roundtrip[0], 2.0 / n);
+		for (int i = 0; i < n; i++)
+			errorIII = max(errorIII, fabs(roundtrip[i] - inverse[i]));
+		delete[] expected;
+		delete[] inverse;
+
+		printf("%6d %14.3f %14.3f %8.1fx %12.2e %12.2e\n", n, direct, planned, direct / planned, errorII, errorIII);
+	}
+
+	// feature extraction like workload: many short vectors
+	const int n = 256;
+	const int count = 8192;
+	vector<double> batch((size_t)n * count);
+	for (size_t i = 0; i < batch.size(); i++)
+		batch[i] = (rand() % 2001 - 1000) / 10.0;
+	DCTPlan plan(n, maxThreads);
+
+	printf("\nbatch of %d vectors with %d values\n%8s %14s %14s\n", count, n, "threads", "ms/batch", "ns/vector");
+	for (int threads = 1; threads <= maxThreads; threads *= 2) {
+		double time = measure([&]() {
+			plan.dct2Batch(&batch[0], count, n, 1.0, threads);
+			plan.dct3Batch(&batch[0], count, n, 2.0 / n, threads);
+		}) / 2.0;
+		printf("%8d %14.3f %14.1f\n", threads, time / 1000.0, time * 1000.0 / count);
+		sink = batch[0];
+	}
+	return 0;
+}
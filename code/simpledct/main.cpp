@@ -1,12 +1,12 @@
 #include <iostream>
 #include <cmath>
 #include <math.h>
+#include "reference.h"
+#include "simpledct.h"
 using namespace std;
 
 double sampleData[] = {1024, 0, 0, 0, 0, 0, 0, 0};
 
-double* dct2(double* raw, int n, double scale);
-double* dct3(double* raw, int n, double scale);
 double rnd(double n);
 void printVector(double* raw, int n);
 
@@ -25,49 +25,24 @@ int main(int argc, char** argv)
 	cout << "DCT-III with scalefactor 2/n:" << endl;
 	printVector(decoded, n);	
 
+	// the same with a plan, in place
+	DCTPlan plan(n);
+	double data[sizeof(sampleData) / sizeof(double)];
+	for (int i = 0; i < n; i++)
+		data[i] = sampleData[i];
+	plan.dct2(data);
+	cout << "DCT-II (plan):" << endl;
+	printVector(data, n);
+
+	plan.dct3(data, 2.0 / n);
+	cout << "DCT-III (plan) with scalefactor 2/n:" << endl;
+	printVector(data, n);
+
 	delete[] encoded;
 	delete[] decoded;
 	return 0;
 }
 
-double* dct2(double* raw, int n, double scale)
-{
-	if (n <= 2) {
-		return NULL;
-	}
-
-	double* result = new double[n];
-
-	for (int f = 0; f < n; f++) {
-		double c = 0.0;
-		for (int t = 0; t < n; t++) {
-			c += raw[t] * cos( (M_PI / n) * (t + 0.5) * f );
-		}
-		result[f] = scale * c;
-	}
-
-	return result;
-}
-
-double* dct3(double* raw, int n, double scale)
-{
-	if (n <= 2) {
-		return NULL;
-	}
-
-	double* result = new double[n];
-
-	for (int f = 0; f < n; f++) {
-		double c = 0.5 * raw[0];
-		for (int t = 1; t < n; t++) {
-			c += raw[t] * cos( (M_PI / n) * (f + 0.5) * t);
-		}
-		result[f] = scale * c;
-	}
-
-	return result;
-}
-
 double rnd(double n)
 {
 	n = round(n*1000000)/1000000;
@@ -0,0 +1,43 @@
+#include "reference.h"
+#include <cmath>
+#include <math.h>
+#include <cstddef>
+using namespace std;
+
+double* dct2(double* raw, int n, double scale)
+{
+	if (n <= 2) {
+		return NULL;
+	}
+
+	double* result = new double[n];
+
+	for (int f = 0; f < n; f++) {
+		double c = 0.0;
+		for (int t = 0; t < n; t++) {
+			c += raw[t] * cos( (M_PI / n) * (t + 0.5) * f );
+		}
+		result[f] = scale * c;
+	}
+
+	return result;
+}
+
+double* dct3(double* raw, int n, double scale)
+{
+	if (n <= 2) {
+		return NULL;
+	}
+
+	double* result = new double[n];
+
+	for (int f = 0; f < n; f++) {
+		double c = 0.5 * raw[0];
+		for (int t = 1; t < n; t++) {
+			c += raw[t] * cos( (M_PI / n) * (f + 0.5) * t);
+		}
+		result[f] = scale * c;
+	}
+
+	return result;
+}
@@ -0,0 +1,8 @@
+#ifndef __REFERENCE_H
+#define __REFERENCE_H
+
+// direct O(n^2) transforms, the result has to be freed with delete[]
+double* dct2(double* raw, int n, double scale);
+double* dct3(double* raw, int n, double scale);
+
+#endif // __REFERENCE_H
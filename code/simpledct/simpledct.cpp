@@ -0,0 +1,201 @@
+#include "simpledct.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+using namespace std;
+
+#define MAX_THREADS	64
+
+DCTPlan::DCTPlan(int n, int maxThreads)
+{
+	if (n < 1)
+		throw invalid_argument("DCTPlan: n must be at least 1");
+	this->n = n;
+	this->maxThreads = max(1, maxThreads);
+	fast = n > 0 && (n & (n - 1)) == 0;
+	work.resize((size_t)this->maxThreads * n);
+
+	if (fast) {
+		// the level with len values uses the entries [len / 2 - 1, len - 1)
+		factors.resize(max(1, n - 1));
+		for (int len = 2; len <= n; len *= 2) {
+			int half = len / 2;
+			for (int i = 0; i < half; i++)
+				factors[half - 1 + i] = 1.0 / (cos((i + 0.5) * M_PI / len) * 2.0);
+		}
+	} else {
+		cosines.resize(4 * n);
+		for (int m = 0; m < 4 * n; m++)
+			cosines[m] = cos(M_PI * m / (2.0 * n));
+	}
+}
+
+/*
+ * A fast recursive algorithm for computing the discrete cosine transform,
+ * Byeong Gi Lee, 1984. The sums and the scaled differences of the mirrored halves
+ * are transformed recursively, the odd outputs are the sums of neighbours.
+ * temp has the same size as data.
+ */
+void DCTPlan::forward(double* data, double* temp, int len) const
+{
+	if (len == 1)
+		return;
+	int half = len / 2;
+	const double* factor = &factors[half - 1];
+	for (int i = 0; i < half; i++) {
+		double x = data[i];
+		double y = data[len - 1 - i];
+		temp[i] = x + y;
+		temp[i + half] = (x - y) * factor[i];
+	}
+	forward(temp, data, half);
+	forward(temp + half, data + half, half);
+	for (int i = 0; i < half - 1; i++) {
+		data[i * 2] = temp[i];
+		data[i * 2 + 1] = temp[i + half] + temp[i + half + 1];
+	}
+	data[len - 2] = temp[half - 1];
+	data[len - 1] = temp[len - 1];
+}
+
+// the steps of forward in reverse order, the first input has full weight
+void DCTPlan::inverse(double* data, double* temp, int len) const
+{
+	if (len == 1)
+		return;
+	int half = len / 2;
+	const double* factor = &factors[half - 1];
+	temp[0] = data[0];
+	temp[half] = data[1];
+	for (int i = 1; i < half; i++) {
+		temp[i] = data[i * 2];
+		temp[i + half] = data[i * 2 - 1] + data[i * 2 + 1];
+	}
+	inverse(temp, data, half);
+	inverse(temp + half, data + half, half);
+	for (int i = 0; i < half; i++) {
+		double x = temp[i];
+		double y = temp[i + half] * factor[i];
+		data[i] = x + y;
+		data[len - 1 - i] = x - y;
+	}
+}
+
+// cos(pi / n * (t + 0.5) * f) = cos(pi * (2t + 1) * f / 2n)
+void DCTPlan::directDCT2(double* data, double* temp) const
+{
+	memcpy(temp, data, n * sizeof(double));
+	for (int f = 0; f < n; f++) {
+		double c = 0.0;
+		int step = 2 * f;
+		int m = f;
+		for (int t = 0; t < n; t++) {
+			c += temp[t] * cosines[m];
+			// the steps are smaller than 4n, the index wraps at most once
+			m += step;
+			if (m >= 4 * n)
+				m -= 4 * n;
+		}
+		data[f] = c;
+	}
+}
+
+void DCTPlan::directDCT3(double* data, double* temp) const
+{
+	memcpy(temp, data, n * sizeof(double));
+	for (int f = 0; f < n; f++) {
+		double c = 0.5 * temp[0];
+		int step = 2 * f + 1;
+		int m = step;
+		for (int t = 1; t < n; t++) {
+			c += temp[t] * cosines[m];
+			m += step;
+			if (m >= 4 * n)
+				m -= 4 * n;
+		}
+		data[f] = c;
+	}
+}
+
+void DCTPlan::dct2(double* data, double scale, double* work)
+{
+	if (work == nullptr)
+		work = &this->work[0];
+	if (fast)
+		forward(data, work, n);
+	else
+		directDCT2(data, work);
+	if (scale != 1.0) {
+		for (int i = 0; i < n; i++)
+			data[i] *= scale;
+	}
+}
+
+void DCTPlan::dct3(double* data, double scale, double* work)
+{
+	if (work == nullptr)
+		work = &this->work[0];
+	if (fast) {
+		data[0] *= 0.5;
+		inverse(data, work, n);
+	} else {
+		directDCT3(data, work);
+	}
+	if (scale != 1.0) {
+		for (int i = 0; i < n; i++)
+			data[i] *= scale;
+	}
+}
+
+void DCTPlan::dct2Into(const double* input, double* output, double scale, double* work)
+{
+	memcpy(output, input, n * sizeof(double));
+	dct2(output, scale, work);
+}
+
+void DCTPlan::dct3Into(const double* input, double* output, double scale, double* work)
+{
+	memcpy(output, input, n * sizeof(double));
+	dct3(output, scale, work);
+}
+
+template<bool INVERSE>
+void DCTPlan::batch(double* data, int count, int stride, double scale, int threads)
+{
+	threads = max(1, min(min(min(threads, maxThreads), count), MAX_THREADS));
+	auto run = [=](int thread) {
+		double* temp = &work[(size_t)thread * n];
+		// contiguous ranges of vectors per thread
+		int first = (int)((long)count * thread / threads);
+		int last = (int)((long)count * (thread + 1) / threads);
+		for (int i = first; i < last; i++) {
+			if (INVERSE)
+				dct3(data + (size_t)i * stride, scale, temp);
+			else
+				dct2(data + (size_t)i * stride, scale, temp);
+		}
+	};
+
+	if (threads == 1) {
+		run(0);
+		return;
+	}
+	thread pool[MAX_THREADS];
+	for (int t = 1; t < threads; t++)
+		pool[t - 1] = thread(run, t);
+	run(0);
+	for (int t = 0; t < threads - 1; t++)
+		pool[t].join();
+}
+
+void DCTPlan::dct2Batch(double* data, int count, int stride, double scale, int threads)
+{
+	batch<false>(data, count, stride, scale, threads);
+}
+
+void DCTPlan::dct3Batch(double* data, int count, int stride, double scale, int threads)
+{
+	batch<true>(data, count, stride, scale, threads);
+}
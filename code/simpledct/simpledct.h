@@ -0,0 +1,57 @@
+#ifndef __SIMPLEDCT_H
+#define __SIMPLEDCT_H
+
+#include <vector>
+
+/*
+ * Plan for the DCT-II and DCT-III of one size, in the unnormalized form of
+ * dct2/dct3 in main.cpp:
+ *
+ *	DCT-II:  X[f] = scale * sum(x[t] * cos(pi / n * (t + 0.5) * f))
+ *	DCT-III: X[f] = scale * (x[0] / 2 + sum(x[t] * cos(pi / n * (f + 0.5) * t), t >= 1))
+ *
+ * dct3(dct2(x), scale = 2 / n) returns x. Power of two sizes use the recursive
+ * factorization of Byeong Gi Lee (O(n log n)), other sizes the direct sum with a
+ * table of the cosines. All tables and work buffers are allocated by the
+ * constructor, the transforms don't allocate anything.
+ *
+ * A plan may be shared between threads if every thread passes its own work
+ * buffer (n values), otherwise the work buffer of the plan is used.
+ */
+class DCTPlan
+{
+private:
+	int n;
+	bool fast;			// power of two
+	int maxThreads;
+	std::vector<double> factors;	// 1 / (2 cos((i + 0.5) pi / len)) for every level of the recursion
+	std::vector<double> cosines;	// cos(pi * m / (2n)), m < 4n, used for the direct sum
+	std::vector<double> work;	// maxThreads * n
+
+	void forward(double* data, double* temp, int len) const;
+	void inverse(double* data, double* temp, int len) const;
+	void directDCT2(double* data, double* temp) const;
+	void directDCT3(double* data, double* temp) const;
+	template<bool INVERSE>
+	void batch(double* data, int count, int stride, double scale, int threads);
+
+public:
+	// threads: most threads the batch functions may use, n < 1 throws std::invalid_argument
+	explicit DCTPlan(int n, int maxThreads = 1);
+
+	int size() const { return n; }
+
+	// in place
+	void dct2(double* data, double scale = 1.0, double* work = nullptr);
+	void dct3(double* data, double scale = 1.0, double* work = nullptr);
+
+	// out of place, input and output must not overlap
+	void dct2Into(const double* input, double* output, double scale = 1.0, double* work = nullptr);
+	void dct3Into(const double* input, double* output, double scale = 1.0, double* work = nullptr);
+
+	// count vectors starting at data + i * stride, in place, split between up to threads threads
+	void dct2Batch(double* data, int count, int stride, double scale = 1.0, int threads = 1);
+	void dct3Batch(double* data, int count, int stride, double scale = 1.0, int threads = 1);
+};
+
+#endif // __SIMPLEDCT_H